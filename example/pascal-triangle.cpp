@@ -72,6 +72,10 @@ int main(int argc, char **argv) {
     if (argv0 == "yes") {
       // 並列実行モードにする
       prf::use_parallel_execution = true;
+    } else if (argv0 == "critical") {
+      // 残りの経路が長いクラスタから更新する並列実行モードにする
+      prf::use_parallel_execution = true;
+      prf::parallel_planner = prf::ParallelPlanner::CriticalPath;
     }
   }
 
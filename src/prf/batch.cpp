@@ -0,0 +1,146 @@
+#include "prf/batch.hpp"
+#include "prf/cluster.hpp"
+#include "prf/logger.hpp"
+#include "prf/prf.hpp"
+#include <mutex>
+
+namespace prf {
+
+namespace {
+/**
+ * submit_batchで確保したIDと枠を、途中で例外が投げられても全てExecutorに引き渡す
+ * submitされずに破棄された場合は、残りのIDを空のトランザクションで埋めて投入し、終了を待つ
+ * IDが欠けるとExecutorが後のトランザクションを終了できず、枠も戻らないため
+ */
+class BatchSubmitGuard {
+private:
+  TransactionBatch &batch;
+  ID first;
+  size_t count;
+  bool submitted;
+
+public:
+  BatchSubmitGuard(const BatchSubmitGuard &) = delete;
+  BatchSubmitGuard &operator=(const BatchSubmitGuard &) = delete;
+
+  BatchSubmitGuard(TransactionBatch &batch, ID first, size_t count)
+      : batch(batch), first(first), count(count), submitted(false) {}
+
+  ~BatchSubmitGuard() {
+    current_transaction = nullptr;
+    if (this->submitted) {
+      return;
+    }
+    for (size_t i = this->batch.size(); i < this->count; ++i) {
+      this->batch.add(this->first + i);
+    }
+    this->submit();
+    // 戻るとbatchが破棄されるので、投入したトランザクションの終了を待つ
+    this->batch.wait();
+  }
+
+  void submit() {
+    ExecutorMessage emsg = &this->batch;
+    Executor::messages.push(emsg);
+    this->submitted = true;
+  }
+};
+} // namespace
+
+TransactionBatch::TransactionBatch(size_t capacity)
+    : transactions(capacity), messages(capacity) {}
+
+ID TransactionBatch::register_transactions(u64 count) {
+  // 一つずつ生成されるトランザクションとIDの順番が入れ替わらないように同じロックを取る
+  std::lock_guard<std::mutex> lock(InnerTransaction::new_transaction_mutex);
+  ID first = next_transaction_id.fetch_add(count);
+  RegisterTransactionMessage message(first, count);
+  Executor::messages.push(std::move(message));
+  return first;
+}
+
+InnerTransaction &TransactionBatch::add(ID transaction_id) {
+  InnerTransaction &transaction = this->transactions.construct_back(
+      [transaction_id](void *place) -> InnerTransaction * {
+        return new (place) InnerTransaction(
+            transaction_id, ClusterManager::UNMANAGED_CLUSTER_ID);
+      });
+  // 更新の開始はまとめて依頼するので、破棄するときに依頼させない
+  transaction.updating = true;
+  this->messages.emplace_back(&transaction);
+  return transaction;
+}
+
+size_t TransactionBatch::size() const { return this->messages.size(); }
+
+TransactionExecuteMessage &TransactionBatch::message(size_t index) {
+  return this->messages[index];
+}
+
+void TransactionBatch::wait() {
+  for (size_t i = 0; i < this->messages.size(); ++i) {
+    this->messages[i].wait();
+  }
+}
+
+bool TransactionBatch::finished() {
+  for (size_t i = 0; i < this->messages.size(); ++i) {
+    if (not this->messages[i].finished()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+BatchJoinHandler::BatchJoinHandler(std::unique_ptr<TransactionBatch> batch)
+    : batch(std::move(batch)) {}
+
+BatchJoinHandler::~BatchJoinHandler() { this->join(); }
+
+void BatchJoinHandler::join() {
+  if (this->batch == nullptr) {
+    return;
+  }
+  this->batch->wait();
+}
+
+bool BatchJoinHandler::finished() {
+  if (this->batch == nullptr) {
+    return true;
+  }
+  return this->batch->finished();
+}
+
+BatchJoinHandler
+submit_batch(const std::vector<std::function<void()>> &sends) {
+  if (current_transaction != nullptr) {
+    failure_log("トランザクションの中ではsubmit_batchを使えません");
+  }
+  if (max_inflight_transactions != 0 and
+      sends.size() > max_inflight_transactions) {
+    // 全ての枠を確保してから投入するので、上限を超える数は投入できない
+    failure_log("同時に存在できるトランザクションの数を超えて投入しようとしています");
+  }
+  auto batch = std::make_unique<TransactionBatch>(sends.size());
+  if (sends.empty()) {
+    return BatchJoinHandler(std::move(batch));
+  }
+
+  // 一つずつ確保すると、同時に投入された別のバッチと枠を分け合って互いに待ち続けることがある
+  transaction_window.acquire(sends.size());
+  ID first = TransactionBatch::register_transactions(sends.size());
+
+  {
+    BatchSubmitGuard guard(*batch, first, sends.size());
+    for (size_t i = 0; i < sends.size(); ++i) {
+      InnerTransaction &transaction = batch->add(first + i);
+      current_transaction = &transaction;
+      sends[i]();
+      current_transaction = nullptr;
+    }
+    guard.submit();
+  }
+  return BatchJoinHandler(std::move(batch));
+}
+
+} // namespace prf
@@ -0,0 +1,87 @@
+#pragma once
+#include "prf/executor.hpp"
+#include "prf/transaction.hpp"
+#include "prf/types.hpp"
+#include "prf/utils.hpp"
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace prf {
+
+/**
+ * まとめて投入されたトランザクションとその更新を開始するメッセージ
+ * 一度に確保した領域に並べて置き、Executorへは一つのメッセージとして送る
+ */
+class TransactionBatch {
+private:
+  utils::FixedArray<InnerTransaction> transactions;
+  utils::FixedArray<TransactionExecuteMessage> messages;
+
+public:
+  TransactionBatch(const TransactionBatch &) = delete;
+  TransactionBatch &operator=(const TransactionBatch &) = delete;
+
+  TransactionBatch(size_t capacity);
+
+  /**
+   * 連続するcount個のトランザクションIDを確保し、一つのメッセージでExecutorに登録する
+   * 返り値は確保した最初のID
+   */
+  static ID register_transactions(u64 count);
+
+  /**
+   * 登録済みのIDでトランザクションを作り、末尾に加える
+   */
+  InnerTransaction &add(ID transaction_id);
+
+  size_t size() const;
+
+  TransactionExecuteMessage &message(size_t index);
+
+  /**
+   * 全てのトランザクションの更新が終了するまでブロッキングする
+   */
+  void wait();
+
+  /**
+   * 全てのトランザクションの更新が終了しているかをブロッキングせず返す
+   */
+  bool finished();
+};
+
+/**
+ * submit_batchで投入したトランザクションをまとめて待つためのクラス
+ * JoinHandlerと同じく、破棄されるときに終了を待つ
+ */
+class BatchJoinHandler {
+private:
+  std::unique_ptr<TransactionBatch> batch;
+
+public:
+  BatchJoinHandler(const BatchJoinHandler &) = delete;
+  BatchJoinHandler &operator=(const BatchJoinHandler &) = delete;
+
+  BatchJoinHandler(BatchJoinHandler &&) = default;
+  BatchJoinHandler(std::unique_ptr<TransactionBatch>);
+  ~BatchJoinHandler();
+
+  void join();
+
+  /**
+   * 全ての更新処理が終了しているかをブロッキングせず返す
+   */
+  bool finished();
+};
+
+/**
+ * 互いに独立したトランザクションをまとめて投入する
+ * sendsのそれぞれは自分専用のトランザクションの中で順に呼び出されるので、その中でsendする
+ * IDの確保とExecutorへの登録、更新の開始はそれぞれ一度のメッセージで済ませる
+ * トランザクションの中で呼び出すことはできない
+ * max_inflight_transactionsが設定されている場合、その数を超えて投入することはできない
+ */
+BatchJoinHandler
+submit_batch(const std::vector<std::function<void()>> &sends);
+
+} // namespace prf
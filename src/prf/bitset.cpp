@@ -0,0 +1,182 @@
+#include "prf/bitset.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace prf {
+
+namespace {
+// 語の列をまとめて処理するカーネル
+// 端数はスカラーで処理する
+
+void or_words(u64 *dst, const u64 *src, size_t n) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 4 <= n; i += 4) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(dst + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(src + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(a, b));
+  }
+#elif defined(__SSE2__)
+  for (; i + 2 <= n; i += 2) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(a, b));
+  }
+#endif
+  for (; i < n; ++i) {
+    dst[i] |= src[i];
+  }
+}
+
+void and_words(u64 *dst, const u64 *src, size_t n) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 4 <= n; i += 4) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(dst + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(src + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_and_si256(a, b));
+  }
+#elif defined(__SSE2__)
+  for (; i + 2 <= n; i += 2) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_and_si128(a, b));
+  }
+#endif
+  for (; i < n; ++i) {
+    dst[i] &= src[i];
+  }
+}
+
+void and_not_words(u64 *dst, const u64 *src, size_t n) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 4 <= n; i += 4) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(dst + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(src + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_andnot_si256(b, a));
+  }
+#elif defined(__SSE2__)
+  for (; i + 2 <= n; i += 2) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_andnot_si128(b, a));
+  }
+#endif
+  for (; i < n; ++i) {
+    dst[i] &= ~src[i];
+  }
+}
+
+/**
+ * from以降で最初に0でない語の位置を返す
+ * 無ければnを返す
+ */
+size_t first_nonzero_word(const u64 *words, size_t from, size_t n) {
+  size_t i = from;
+#if defined(__AVX2__)
+  for (; i + 4 <= n; i += 4) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(words + i));
+    if (not _mm256_testz_si256(v, v)) {
+      break;
+    }
+  }
+#elif defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 2 <= n; i += 2) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(words + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(v, zero)) != 0xFFFF) {
+      break;
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    if (words[i] != 0) {
+      return i;
+    }
+  }
+  return n;
+}
+} // namespace
+
+Bitset::Bitset() : bits(0), words() {}
+
+Bitset::Bitset(size_t bits) : bits(bits), words((bits + 63) / 64, 0) {}
+
+void Bitset::clear() {
+  for (u64 &word : words) {
+    word = 0;
+  }
+}
+
+bool Bitset::none() const {
+  return first_nonzero_word(words.data(), 0, words.size()) == words.size();
+}
+
+size_t Bitset::count() const {
+  size_t res = 0;
+  for (const u64 word : words) {
+    res += __builtin_popcountll(word);
+  }
+  return res;
+}
+
+bool Bitset::intersects(const Bitset &other) const {
+  for (size_t i = 0; i < words.size(); ++i) {
+    if ((words[i] & other.words[i]) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Bitset &Bitset::operator|=(const Bitset &other) {
+  or_words(words.data(), other.words.data(), words.size());
+  return *this;
+}
+
+Bitset &Bitset::operator&=(const Bitset &other) {
+  and_words(words.data(), other.words.data(), words.size());
+  return *this;
+}
+
+Bitset &Bitset::and_not(const Bitset &other) {
+  and_not_words(words.data(), other.words.data(), words.size());
+  return *this;
+}
+
+size_t Bitset::find_first() const {
+  size_t word = first_nonzero_word(words.data(), 0, words.size());
+  if (word == words.size()) {
+    return bits;
+  }
+  return (word << 6) + __builtin_ctzll(words[word]);
+}
+
+size_t Bitset::find_next(size_t index) const {
+  ++index;
+  if (index >= bits) {
+    return bits;
+  }
+  size_t word = index >> 6;
+  // 同じ語の中でindex以降に立っているビット
+  u64 rest = words[word] & (~(u64)0 << (index & 63));
+  if (rest != 0) {
+    return (word << 6) + __builtin_ctzll(rest);
+  }
+  word = first_nonzero_word(words.data(), word + 1, words.size());
+  if (word == words.size()) {
+    return bits;
+  }
+  return (word << 6) + __builtin_ctzll(words[word]);
+}
+
+bool Bitset::operator==(const Bitset &other) const {
+  return bits == other.bits and words == other.words;
+}
+
+} // namespace prf
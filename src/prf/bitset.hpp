@@ -0,0 +1,77 @@
+#pragma once
+#include "prf/types.hpp"
+#include <cstddef>
+#include <vector>
+
+namespace prf {
+
+/**
+ * 実行時に大きさの決まるビット集合
+ * クラスタ間の到達可能性など、クラスタIDを添字にした集合を扱うのに使う
+ *
+ * 集合演算と走査はAVX2が有効ならAVX2で、そうでなければSSE2で複数の語をまとめて処理する
+ * 立っているビットを順に見る場合は次のように書く
+ * for (size_t i = s.find_first(); i < s.size(); i = s.find_next(i))
+ */
+class Bitset {
+private:
+  size_t bits;
+  std::vector<u64> words;
+
+public:
+  Bitset();
+  Bitset(size_t bits);
+
+  size_t size() const { return bits; }
+
+  bool test(size_t index) const {
+    return (words[index >> 6] >> (index & 63)) & 1;
+  }
+
+  void set(size_t index) { words[index >> 6] |= (u64)1 << (index & 63); }
+
+  void reset(size_t index) { words[index >> 6] &= ~((u64)1 << (index & 63)); }
+
+  /**
+   * 全てのビットを0にする
+   */
+  void clear();
+
+  /**
+   * 立っているビットが一つも無いか
+   */
+  bool none() const;
+
+  /**
+   * 立っているビットの数
+   */
+  size_t count() const;
+
+  /**
+   * 共通して立っているビットがあるか
+   */
+  bool intersects(const Bitset &other) const;
+
+  Bitset &operator|=(const Bitset &other);
+  Bitset &operator&=(const Bitset &other);
+
+  /**
+   * otherで立っているビットを落とす
+   */
+  Bitset &and_not(const Bitset &other);
+
+  /**
+   * 最初に立っているビットの位置を返す
+   * 一つも無ければsize()を返す
+   */
+  size_t find_first() const;
+
+  /**
+   * indexより後で最初に立っているビットの位置を返す
+   * 一つも無ければsize()を返す
+   */
+  size_t find_next(size_t index) const;
+
+  bool operator==(const Bitset &other) const;
+};
+} // namespace prf
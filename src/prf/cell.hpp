@@ -5,7 +5,10 @@
 #include "prf/logger.hpp"
 #include "prf/time_invariant_values.hpp"
 #include "prf/transaction.hpp"
+#include "prf/value_pool.hpp"
+#include "prf/version_chain.hpp"
 #include <functional>
+#include <future>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -18,12 +21,16 @@ namespace prf {
 // Cell系列が内部で保持するクラス
 template <class T> class CellInternal : public TimeInvariantValues {
 private:
+  // valuesに置く値の確保に使う
+  // そのまま持てる型(is_inline_value_v)では使わない
+  // valuesより後に破棄されるよう先に宣言する
+  ValuePool value_pool;
+
   // トランザクションIDに対応する値を保存する
-  std::map<ID, std::shared_ptr<T>> values;
+  // 読み込みはロックを取らない
+  VersionChain<T> values;
 
-  // values自体の排他ロックのためにある
-  // values[x]
-  // が返す個々の参照自体には排他ロックが存在しないので、それを前提とした設計をする必要がある
+  // valuesへの書き込みと破棄、send_coalescedの状態の排他ロックのためにある
   std::mutex mtx;
 
   std::function<std::optional<T>(ID transaction_id)> updater;
@@ -31,45 +38,103 @@ private:
   /**
    * 時変値の変化をFRPの外でlistenしている関数のリスト
    */
-  std::vector<std::function<void(std::shared_ptr<T>)>> listeners;
+  std::vector<std::function<void(ValueRef<T>)>> listeners;
+
+  /**
+   * listenersと同じ順に並べた、listener毎の呼び出しのキュー
+   */
+  std::vector<std::unique_ptr<ListenerQueue>> listener_queues;
+
+  /**
+   * FRPの外でlistenしている関数のうち、トランザクションの順序を問わないもののリスト
+   */
+  std::vector<std::function<void(ValueRef<T>)>> unordered_listeners;
+
+  /**
+   * send_coalescedで作られ、まだ値が読まれていない版
+   * この版の値は後から来たsend_coalescedの値で上書きしてよい
+   * 値が読まれるか、通常のsendがあった時点で無効にする
+   * 有効な間は版のguardedを立てておき、読み込みにもmtxを取らせる
+   * mtxで保護する
+   */
+  typename VersionChain<T>::Version *coalescing_version;
+
+  /**
+   * coalescing_versionを無効にする
+   * mtxを取ってから呼び出すこと
+   */
+  void seal_coalescing();
+
+  /**
+   * send_coalescedでトランザクションを開始している最中か
+   * 開始を待つ間に来た値はcoalesced_valueに溜めておき、最後の値だけを送る
+   * mtxで保護する
+   */
+  bool coalescing_opening;
+  std::optional<T> coalesced_value;
 
 public:
-  CellInternal<T>(ID cluster_id,
-                  std::function<std::optional<T>(ID transaction_id)> updater);
+  CellInternal(ID cluster_id,
+               std::function<std::optional<T>(ID transaction_id)> updater);
 
-  CellInternal<T>(ID cluster_id, T initial_value,
-                  std::function<std::optional<T>(ID transaction_id)> updater);
+  CellInternal(ID cluster_id, T initial_value,
+               std::function<std::optional<T>(ID transaction_id)> updater);
 
-  CellInternal<T>(ID cluster_id, T initial_value);
+  CellInternal(ID cluster_id, T initial_value);
 
   /**
    * transaction以前(現在実行中のトランザクションを含めた)に生成された値を取得する
    * 存在しなかった場合は std::nullopt を返す
    */
-  std::optional<std::shared_ptr<T>> sample(ID transaction_id);
+  std::optional<ValueRef<T>> sample(ID transaction_id);
 
   /**
    * sample() と違いその論理時刻に値が存在することが保証される場合に呼び出す
    * 無い時はエラーで終了する
    */
-  std::shared_ptr<T> unsafeSample(ID transaction_id);
+  ValueRef<T> unsafeSample(ID transaction_id);
 
   /**
    * FRPの外からlistenする
    */
-  void listenFromOuter(std::function<void(std::shared_ptr<T>)>);
+  void listenFromOuter(std::function<void(ValueRef<T>)>);
+
+  /**
+   * FRPの外から、トランザクションの順序を問わずにlistenする
+   */
+  void listenUnorderedFromOuter(std::function<void(ValueRef<T>)>);
 
   // transactionに対応する時刻にvalueを登録する
   void send(T value, InnerTransaction *transaction);
 
   void send(T value);
 
+  /**
+   * 新しくトランザクションを作る必要があり、その数が上限に達している場合は送らずにfalseを返す
+   */
+  bool try_send(T value);
+
+  /**
+   * 新しいトランザクションで値を送り、更新の終了を待たずに戻る
+   * トランザクションの中で呼び出すことはできない
+   */
+  std::future<void> send_async(T value, std::function<void()> on_complete);
+
+  /**
+   * まだ値が読まれていないsend_coalescedのトランザクションがあれば、その値を置き換える
+   * 無ければ新しいトランザクションで値を送り、更新の終了を待たずに戻る
+   * トランザクションの中で呼び出した場合はsendと同じ
+   */
+  void send_coalesced(T value);
+
   void update(InnerTransaction *transaction) override;
 
   void refresh(ID transaction_id) override;
 
   void finalize(InnerTransaction *transaction) override;
 
+  void deliver_unordered(ID transaction_id) override;
+
   template <class U> friend class CellLoop;
   template <class U> friend class GlobalCellLoop;
 };
@@ -108,7 +173,7 @@ public:
     ID cluster_id = clusterManager.current_id();
     std::function<U(ID)> updater = [internal = this->internal,
                                     f](ID transaction_id) -> U {
-      std::shared_ptr<T> value = internal->unsafeSample(transaction_id);
+      ValueRef<T> value = internal->unsafeSample(transaction_id);
       return f(*value);
     };
     CellInternal<U> *inter = new CellInternal<U>(cluster_id, updater);
@@ -118,6 +183,13 @@ public:
 
   template <class F> void listen(F f) const;
 
+  /**
+   * 値が確定した時点で、前のトランザクションの終了を待たずにfを呼び出す
+   * 呼び出しはスレッドプールで行なわれ、トランザクションの順序も呼び出し同士の順序も保証されない
+   * 集計のような順序に依らない処理に使う
+   */
+  template <class F> void listen_unordered(F f) const;
+
   template <class U1, class F>
   Cell<typename std::invoke_result<F, T &, U1 &>::type> lift(Cell<U1> c1,
                                                              F f) const;
@@ -187,6 +259,27 @@ public:
   CellSink(T);
 
   void send(T value) const;
+
+  /**
+   * 同時に存在できるトランザクションの数が上限に達していれば、待たずにfalseを返す
+   */
+  bool try_send(T value) const;
+
+  /**
+   * 更新の終了を待たずに戻る
+   * on_completeは更新が終了した後にワーカーのスレッドで呼び出される
+   * 同時に存在できるトランザクションの数が上限に達していれば、空くまでは待たされる
+   */
+  std::future<void> send_async(T value,
+                               std::function<void()> on_complete = nullptr) const;
+
+  /**
+   * 最新の値だけが意味を持つセル向けに、送った値をまとめる
+   * 前にsend_coalescedで送った値がまだ下流で読まれていなければ、新しいトランザクションを作らずその値を置き換える
+   * 置き換えられた値はlistenerからも観測されない
+   * 更新の終了は待たずに戻る
+   */
+  void send_coalesced(T value) const;
 };
 
 template <class T> class CellLoop : public Cell<T> {
@@ -216,13 +309,15 @@ public:
 template <class T>
 CellInternal<T>::CellInternal(
     ID cluster_id, std::function<std::optional<T>(ID transaction_id)> updater)
-    : TimeInvariantValues(cluster_id), updater(updater){};
+    : TimeInvariantValues(cluster_id), updater(updater),
+      coalescing_version(nullptr), coalescing_opening(false){};
 
 template <class T>
 CellInternal<T>::CellInternal(
     ID cluster_id, T initial_value,
     std::function<std::optional<T>(ID transaction_id)> updater)
-    : TimeInvariantValues(cluster_id), updater(updater) {
+    : TimeInvariantValues(cluster_id), updater(updater),
+      coalescing_version(nullptr), coalescing_opening(false) {
   // 初期値はEecutorの初期化処理に含める
   Executor::after_build_hooks.push_back(
       [this, initial_value](InnerTransaction *transaction) -> void {
@@ -252,37 +347,118 @@ CellInternal<T>::CellInternal(ID cluster_id, T initial_value)
 template <class T> void CellInternal<T>::send(T value) {
   if (current_transaction == nullptr) {
     Transaction trans;
-    send(value, current_transaction);
+    send(std::move(value), current_transaction);
   } else {
-    send(value, current_transaction);
+    send(std::move(value), current_transaction);
   }
 }
 
+template <class T>
+std::future<void> CellInternal<T>::send_async(T value,
+                                    std::function<void()> on_complete) {
+  if (current_transaction != nullptr) {
+    failure_log("トランザクションの中ではsend_asyncを使えません");
+  }
+  Transaction trans;
+  send(std::move(value), current_transaction);
+  return trans.commit_async(on_complete);
+}
+
+template <class T> bool CellInternal<T>::try_send(T value) {
+  if (current_transaction != nullptr) {
+    send(std::move(value), current_transaction);
+    return true;
+  }
+  Transaction trans(std::try_to_lock);
+  if (not trans.is_open()) {
+    return false;
+  }
+  send(std::move(value), current_transaction);
+  return true;
+}
+
+template <class T> void CellInternal<T>::send_coalesced(T value) {
+  if (current_transaction != nullptr) {
+    send(std::move(value), current_transaction);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (coalescing_version != nullptr) {
+      // まだ誰も読んでいないので、そのトランザクションの値として差し替える
+      coalescing_version->value =
+          make_value<T>(value_pool, std::move(value));
+      return;
+    }
+    coalesced_value = std::move(value);
+    if (coalescing_opening) {
+      // 開始中のトランザクションが最後の値を拾う
+      return;
+    }
+    coalescing_opening = true;
+  }
+
+  // 枠が空くのを待つ間に来た値もまとめられる
+  Transaction trans;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    ID transaction_id = current_transaction->get_id();
+    seal_coalescing();
+    // 読み込みが排他を取らずに値を読まないよう、繋ぐ時点で版のguardedを立てておく
+    coalescing_version =
+        values.put(transaction_id,
+                   make_value<T>(value_pool, std::move(*coalesced_value)),
+                   true);
+    coalesced_value.reset();
+    coalescing_opening = false;
+  }
+  this->register_listeners_update(current_transaction);
+  this->register_cleanup(current_transaction);
+  trans.commit_async();
+}
+
 template <class T>
 void CellInternal<T>::send(T value, InnerTransaction *transaction) {
   {
     std::lock_guard<std::mutex> lock(mtx);
-    values[transaction->get_id()] = std::make_shared<T>(value);
+    // これより後の値があるので、前のトランザクションの値は置き換えられない
+    seal_coalescing();
+    values.put(transaction->get_id(),
+               make_value<T>(value_pool, std::move(value)));
   }
   this->register_listeners_update(transaction);
   this->register_cleanup(transaction);
 }
 
 template <class T>
-std::optional<std::shared_ptr<T>> CellInternal<T>::sample(ID transaction_id) {
-  std::lock_guard<std::mutex> lock(mtx);
+std::optional<ValueRef<T>> CellInternal<T>::sample(ID transaction_id) {
+  typename VersionChain<T>::ReadGuard guard(values);
   // Cellは複数の論理時間に渡って値が存在するので、指定したトランザクション以前を探すことになる
-  auto itr = values.upper_bound(transaction_id);
-  if (itr == values.begin()) {
+  typename VersionChain<T>::Version *version = values.find(transaction_id);
+  if (version == nullptr) {
     return std::nullopt;
   }
-  --itr;
-  return itr->second;
+  if (version->guarded.load()) {
+    // 一度読まれた値は置き換えない
+    std::lock_guard<std::mutex> lock(mtx);
+    if (version == coalescing_version) {
+      seal_coalescing();
+    }
+  }
+  return version->value;
+}
+
+template <class T> void CellInternal<T>::seal_coalescing() {
+  if (coalescing_version == nullptr) {
+    return;
+  }
+  coalescing_version->guarded.store(false);
+  coalescing_version = nullptr;
 }
 
 template <class T>
-std::shared_ptr<T> CellInternal<T>::unsafeSample(ID transaction_id) {
-  std::optional<std::shared_ptr<T>> res = this->sample(transaction_id);
+ValueRef<T> CellInternal<T>::unsafeSample(ID transaction_id) {
+  std::optional<ValueRef<T>> res = this->sample(transaction_id);
   if (not res.has_value()) {
     failure_log("論理時刻に対応する値がStreamに存在しませんでした");
   }
@@ -291,39 +467,58 @@ std::shared_ptr<T> CellInternal<T>::unsafeSample(ID transaction_id) {
 
 template <class T>
 void CellInternal<T>::listenFromOuter(
-    std::function<void(std::shared_ptr<T>)> f) {
+    std::function<void(ValueRef<T>)> f) {
   listeners.push_back(f);
+  listener_queues.push_back(std::make_unique<ListenerQueue>());
+}
+
+template <class T>
+void CellInternal<T>::listenUnorderedFromOuter(
+    std::function<void(ValueRef<T>)> f) {
+  unordered_listeners.push_back(f);
+}
+
+template <class T>
+void CellInternal<T>::deliver_unordered(ID transaction_id) {
+  if (unordered_listeners.empty()) {
+    return;
+  }
+  ValueRef<T> value = this->unsafeSample(transaction_id);
+  for (std::function<void(ValueRef<T>)> &listener :
+       unordered_listeners) {
+    Executor::global_executor->post(
+        [&listener, value]() -> void { listener(value); });
+  }
 }
 
 template <class T> void CellInternal<T>::update(InnerTransaction *transaction) {
   ID transaction_id = transaction->get_id();
   std::optional<T> res = this->updater(transaction_id);
   if (res) {
-    this->send(*res, transaction);
+    this->send(std::move(*res), transaction);
   }
 }
 
 template <class T> void CellInternal<T>::refresh(ID transaction_id) {
   std::lock_guard<std::mutex> lock(mtx);
-  if (values.find(transaction_id) == values.end()) {
+  if (not values.contains(transaction_id)) {
     failure_log("このトランザクションで新しく値が設定されていません");
   }
-  // 指定されたTransactionより以前にある値を消去する
-  while (true) {
-    auto itr = values.begin();
-    if (itr->first < transaction_id) {
-      values.erase(itr);
-    } else {
-      break;
-    }
+  if (coalescing_version != nullptr and
+      coalescing_version->id < transaction_id) {
+    seal_coalescing();
   }
+  // 指定されたTransactionより以前にある値を消去する
+  values.truncate(transaction_id);
 }
 
 template <class T>
 void CellInternal<T>::finalize(InnerTransaction *transaction) {
-  std::shared_ptr<T> value = this->unsafeSample(transaction->get_id());
-  for (std::function<void(std::shared_ptr<T>)> &listener : listeners) {
-    listener(value);
+  ValueRef<T> value = this->unsafeSample(transaction->get_id());
+  for (size_t i = 0; i < listeners.size(); ++i) {
+    std::function<void(ValueRef<T>)> &listener = listeners[i];
+    transaction->deliver(*listener_queues[i],
+                         [&listener, value]() -> void { listener(value); });
   }
 }
 
@@ -337,7 +532,14 @@ Cell<T>::Cell(T initial_value)
       is_global_looper(false) {}
 
 template <class T> template <class F> void Cell<T>::listen(F f) const {
-  this->internal->listenFromOuter([f](std::shared_ptr<T> v) -> void { f(*v); });
+  this->internal->listenFromOuter([f](ValueRef<T> v) -> void { f(*v); });
+}
+
+template <class T>
+template <class F>
+void Cell<T>::listen_unordered(F f) const {
+  this->internal->listenUnorderedFromOuter(
+      [f](ValueRef<T> v) -> void { f(*v); });
 }
 
 template <class T>
@@ -346,7 +548,21 @@ CellSink<T>::CellSink(T initial_value)
                                        initial_value)) {}
 
 template <class T> void CellSink<T>::send(T value) const {
-  this->internal->send(value);
+  this->internal->send(std::move(value));
+}
+
+template <class T>
+std::future<void>
+CellSink<T>::send_async(T value, std::function<void()> on_complete) const {
+  return this->internal->send_async(std::move(value), on_complete);
+}
+
+template <class T> bool CellSink<T>::try_send(T value) const {
+  return this->internal->try_send(std::move(value));
+}
+
+template <class T> void CellSink<T>::send_coalesced(T value) const {
+  this->internal->send_coalesced(std::move(value));
 }
 
 template <class T>
@@ -394,7 +610,8 @@ template <class T> void GlobalCellLoop<T>::loop(Cell<T> c) {
     current_transaction->register_before_update_hook(
         [internal, res](ID id) -> void {
           std::lock_guard<std::mutex> lock(internal->mtx);
-          internal->values[id] = std::make_shared<T>(res);
+          internal->values.put(id,
+                               make_value<T>(internal->value_pool, res));
         });
     return std::nullopt;
   };
@@ -419,11 +636,11 @@ Cell<typename std::invoke_result<F, T &, U1 &>::type> Cell<T>::lift(Cell<U1> c1,
       [internal = this->internal, c1,
        f](ID transaction_id) -> std::optional<V> {
     // Loopを利用していると、片方のCellを初期化する前に呼び出される可能性があるので、nullのときは同じくnullを返す
-    std::optional<std::shared_ptr<T>> v = internal->sample(transaction_id);
+    std::optional<ValueRef<T>> v = internal->sample(transaction_id);
     if (not v) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U1>> v1 = c1.internal->sample(transaction_id);
+    std::optional<ValueRef<U1>> v1 = c1.internal->sample(transaction_id);
     if (not v1) {
       return std::nullopt;
     }
@@ -456,15 +673,15 @@ Cell<T>::lift(Cell<U1> c1, Cell<U2> c2, F f) const {
       [internal = this->internal, c1, c2,
        f](ID transaction_id) -> std::optional<V> {
     // Loopを利用していると、片方のCellを初期化する前に呼び出される可能性があるので、nullのときは同じくnullを返す
-    std::optional<std::shared_ptr<T>> v = internal->sample(transaction_id);
+    std::optional<ValueRef<T>> v = internal->sample(transaction_id);
     if (not v) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U1>> v1 = c1.internal->sample(transaction_id);
+    std::optional<ValueRef<U1>> v1 = c1.internal->sample(transaction_id);
     if (not v1) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U2>> v2 = c2.internal->sample(transaction_id);
+    std::optional<ValueRef<U2>> v2 = c2.internal->sample(transaction_id);
     if (not v2) {
       return std::nullopt;
     }
@@ -502,19 +719,19 @@ Cell<T>::lift(Cell<U1> c1, Cell<U2> c2, Cell<U3> c3, F f) const {
       [internal = this->internal, c1, c2, c3,
        f](ID transaction_id) -> std::optional<V> {
     // Loopを利用していると、片方のCellを初期化する前に呼び出される可能性があるので、nullのときは同じくnullを返す
-    std::optional<std::shared_ptr<T>> v = internal->sample(transaction_id);
+    std::optional<ValueRef<T>> v = internal->sample(transaction_id);
     if (not v) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U1>> v1 = c1.internal->sample(transaction_id);
+    std::optional<ValueRef<U1>> v1 = c1.internal->sample(transaction_id);
     if (not v1) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U2>> v2 = c2.internal->sample(transaction_id);
+    std::optional<ValueRef<U2>> v2 = c2.internal->sample(transaction_id);
     if (not v2) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U3>> v3 = c3.internal->sample(transaction_id);
+    std::optional<ValueRef<U3>> v3 = c3.internal->sample(transaction_id);
     if (not v3) {
       return std::nullopt;
     }
@@ -557,23 +774,23 @@ Cell<T>::lift(Cell<U1> c1, Cell<U2> c2, Cell<U3> c3, Cell<U4> c4, F f) const {
       [internal = this->internal, c1, c2, c3, c4,
        f](ID transaction_id) -> std::optional<V> {
     // Loopを利用していると、片方のCellを初期化する前に呼び出される可能性があるので、nullのときは同じくnullを返す
-    std::optional<std::shared_ptr<T>> v = internal->sample(transaction_id);
+    std::optional<ValueRef<T>> v = internal->sample(transaction_id);
     if (not v) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U1>> v1 = c1.internal->sample(transaction_id);
+    std::optional<ValueRef<U1>> v1 = c1.internal->sample(transaction_id);
     if (not v1) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U2>> v2 = c2.internal->sample(transaction_id);
+    std::optional<ValueRef<U2>> v2 = c2.internal->sample(transaction_id);
     if (not v2) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U3>> v3 = c3.internal->sample(transaction_id);
+    std::optional<ValueRef<U3>> v3 = c3.internal->sample(transaction_id);
     if (not v3) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U4>> v4 = c4.internal->sample(transaction_id);
+    std::optional<ValueRef<U4>> v4 = c4.internal->sample(transaction_id);
     if (not v4) {
       return std::nullopt;
     }
@@ -623,27 +840,27 @@ Cell<T>::lift(Cell<U1> c1, Cell<U2> c2, Cell<U3> c3, Cell<U4> c4, Cell<U5> c5,
       [internal = this->internal, c1, c2, c3, c4, c5,
        f](ID transaction_id) -> std::optional<V> {
     // Loopを利用していると、片方のCellを初期化する前に呼び出される可能性があるので、nullのときは同じくnullを返す
-    std::optional<std::shared_ptr<T>> v = internal->sample(transaction_id);
+    std::optional<ValueRef<T>> v = internal->sample(transaction_id);
     if (not v) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U1>> v1 = c1.internal->sample(transaction_id);
+    std::optional<ValueRef<U1>> v1 = c1.internal->sample(transaction_id);
     if (not v1) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U2>> v2 = c2.internal->sample(transaction_id);
+    std::optional<ValueRef<U2>> v2 = c2.internal->sample(transaction_id);
     if (not v2) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U3>> v3 = c3.internal->sample(transaction_id);
+    std::optional<ValueRef<U3>> v3 = c3.internal->sample(transaction_id);
     if (not v3) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U4>> v4 = c4.internal->sample(transaction_id);
+    std::optional<ValueRef<U4>> v4 = c4.internal->sample(transaction_id);
     if (not v4) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U5>> v5 = c5.internal->sample(transaction_id);
+    std::optional<ValueRef<U5>> v5 = c5.internal->sample(transaction_id);
     if (not v5) {
       return std::nullopt;
     }
@@ -699,31 +916,31 @@ Cell<T>::lift(Cell<U1> c1, Cell<U2> c2, Cell<U3> c3, Cell<U4> c4, Cell<U5> c5,
       [internal = this->internal, c1, c2, c3, c4, c5, c6,
        f](ID transaction_id) -> std::optional<V> {
     // Loopを利用していると、片方のCellを初期化する前に呼び出される可能性があるので、nullのときは同じくnullを返す
-    std::optional<std::shared_ptr<T>> v = internal->sample(transaction_id);
+    std::optional<ValueRef<T>> v = internal->sample(transaction_id);
     if (not v) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U1>> v1 = c1.internal->sample(transaction_id);
+    std::optional<ValueRef<U1>> v1 = c1.internal->sample(transaction_id);
     if (not v1) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U2>> v2 = c2.internal->sample(transaction_id);
+    std::optional<ValueRef<U2>> v2 = c2.internal->sample(transaction_id);
     if (not v2) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U3>> v3 = c3.internal->sample(transaction_id);
+    std::optional<ValueRef<U3>> v3 = c3.internal->sample(transaction_id);
     if (not v3) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U4>> v4 = c4.internal->sample(transaction_id);
+    std::optional<ValueRef<U4>> v4 = c4.internal->sample(transaction_id);
     if (not v4) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U5>> v5 = c5.internal->sample(transaction_id);
+    std::optional<ValueRef<U5>> v5 = c5.internal->sample(transaction_id);
     if (not v5) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U6>> v6 = c6.internal->sample(transaction_id);
+    std::optional<ValueRef<U6>> v6 = c6.internal->sample(transaction_id);
     if (not v6) {
       return std::nullopt;
     }
@@ -785,35 +1002,35 @@ Cell<T>::lift(Cell<U1> c1, Cell<U2> c2, Cell<U3> c3, Cell<U4> c4, Cell<U5> c5,
       [internal = this->internal, c1, c2, c3, c4, c5, c6, c7,
        f](ID transaction_id) -> std::optional<V> {
     // Loopを利用していると、片方のCellを初期化する前に呼び出される可能性があるので、nullのときは同じくnullを返す
-    std::optional<std::shared_ptr<T>> v = internal->sample(transaction_id);
+    std::optional<ValueRef<T>> v = internal->sample(transaction_id);
     if (not v) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U1>> v1 = c1.internal->sample(transaction_id);
+    std::optional<ValueRef<U1>> v1 = c1.internal->sample(transaction_id);
     if (not v1) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U2>> v2 = c2.internal->sample(transaction_id);
+    std::optional<ValueRef<U2>> v2 = c2.internal->sample(transaction_id);
     if (not v2) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U3>> v3 = c3.internal->sample(transaction_id);
+    std::optional<ValueRef<U3>> v3 = c3.internal->sample(transaction_id);
     if (not v3) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U4>> v4 = c4.internal->sample(transaction_id);
+    std::optional<ValueRef<U4>> v4 = c4.internal->sample(transaction_id);
     if (not v4) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U5>> v5 = c5.internal->sample(transaction_id);
+    std::optional<ValueRef<U5>> v5 = c5.internal->sample(transaction_id);
     if (not v5) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U6>> v6 = c6.internal->sample(transaction_id);
+    std::optional<ValueRef<U6>> v6 = c6.internal->sample(transaction_id);
     if (not v6) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U7>> v7 = c7.internal->sample(transaction_id);
+    std::optional<ValueRef<U7>> v7 = c7.internal->sample(transaction_id);
     if (not v7) {
       return std::nullopt;
     }
@@ -880,39 +1097,39 @@ Cell<T>::lift(Cell<U1> c1, Cell<U2> c2, Cell<U3> c3, Cell<U4> c4, Cell<U5> c5,
       [internal = this->internal, c1, c2, c3, c4, c5, c6, c7, c8,
        f](ID transaction_id) -> std::optional<V> {
     // Loopを利用していると、片方のCellを初期化する前に呼び出される可能性があるので、nullのときは同じくnullを返す
-    std::optional<std::shared_ptr<T>> v = internal->sample(transaction_id);
+    std::optional<ValueRef<T>> v = internal->sample(transaction_id);
     if (not v) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U1>> v1 = c1.internal->sample(transaction_id);
+    std::optional<ValueRef<U1>> v1 = c1.internal->sample(transaction_id);
     if (not v1) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U2>> v2 = c2.internal->sample(transaction_id);
+    std::optional<ValueRef<U2>> v2 = c2.internal->sample(transaction_id);
     if (not v2) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U3>> v3 = c3.internal->sample(transaction_id);
+    std::optional<ValueRef<U3>> v3 = c3.internal->sample(transaction_id);
     if (not v3) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U4>> v4 = c4.internal->sample(transaction_id);
+    std::optional<ValueRef<U4>> v4 = c4.internal->sample(transaction_id);
     if (not v4) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U5>> v5 = c5.internal->sample(transaction_id);
+    std::optional<ValueRef<U5>> v5 = c5.internal->sample(transaction_id);
     if (not v5) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U6>> v6 = c6.internal->sample(transaction_id);
+    std::optional<ValueRef<U6>> v6 = c6.internal->sample(transaction_id);
     if (not v6) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U7>> v7 = c7.internal->sample(transaction_id);
+    std::optional<ValueRef<U7>> v7 = c7.internal->sample(transaction_id);
     if (not v7) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U8>> v8 = c8.internal->sample(transaction_id);
+    std::optional<ValueRef<U8>> v8 = c8.internal->sample(transaction_id);
     if (not v8) {
       return std::nullopt;
     }
@@ -984,43 +1201,43 @@ Cell<T>::lift(Cell<U1> c1, Cell<U2> c2, Cell<U3> c3, Cell<U4> c4, Cell<U5> c5,
       [internal = this->internal, c1, c2, c3, c4, c5, c6, c7, c8, c9,
        f](ID transaction_id) -> std::optional<V> {
     // Loopを利用していると、片方のCellを初期化する前に呼び出される可能性があるので、nullのときは同じくnullを返す
-    std::optional<std::shared_ptr<T>> v = internal->sample(transaction_id);
+    std::optional<ValueRef<T>> v = internal->sample(transaction_id);
     if (not v) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U1>> v1 = c1.internal->sample(transaction_id);
+    std::optional<ValueRef<U1>> v1 = c1.internal->sample(transaction_id);
     if (not v1) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U2>> v2 = c2.internal->sample(transaction_id);
+    std::optional<ValueRef<U2>> v2 = c2.internal->sample(transaction_id);
     if (not v2) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U3>> v3 = c3.internal->sample(transaction_id);
+    std::optional<ValueRef<U3>> v3 = c3.internal->sample(transaction_id);
     if (not v3) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U4>> v4 = c4.internal->sample(transaction_id);
+    std::optional<ValueRef<U4>> v4 = c4.internal->sample(transaction_id);
     if (not v4) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U5>> v5 = c5.internal->sample(transaction_id);
+    std::optional<ValueRef<U5>> v5 = c5.internal->sample(transaction_id);
     if (not v5) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U6>> v6 = c6.internal->sample(transaction_id);
+    std::optional<ValueRef<U6>> v6 = c6.internal->sample(transaction_id);
     if (not v6) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U7>> v7 = c7.internal->sample(transaction_id);
+    std::optional<ValueRef<U7>> v7 = c7.internal->sample(transaction_id);
     if (not v7) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U8>> v8 = c8.internal->sample(transaction_id);
+    std::optional<ValueRef<U8>> v8 = c8.internal->sample(transaction_id);
     if (not v8) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U9>> v9 = c9.internal->sample(transaction_id);
+    std::optional<ValueRef<U9>> v9 = c9.internal->sample(transaction_id);
     if (not v9) {
       return std::nullopt;
     }
@@ -1098,47 +1315,47 @@ Cell<T>::lift(Cell<U1> c1, Cell<U2> c2, Cell<U3> c3, Cell<U4> c4, Cell<U5> c5,
       [internal = this->internal, c1, c2, c3, c4, c5, c6, c7, c8, c9, c10,
        f](ID transaction_id) -> std::optional<V> {
     // Loopを利用していると、片方のCellを初期化する前に呼び出される可能性があるので、nullのときは同じくnullを返す
-    std::optional<std::shared_ptr<T>> v = internal->sample(transaction_id);
+    std::optional<ValueRef<T>> v = internal->sample(transaction_id);
     if (not v) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U1>> v1 = c1.internal->sample(transaction_id);
+    std::optional<ValueRef<U1>> v1 = c1.internal->sample(transaction_id);
     if (not v1) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U2>> v2 = c2.internal->sample(transaction_id);
+    std::optional<ValueRef<U2>> v2 = c2.internal->sample(transaction_id);
     if (not v2) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U3>> v3 = c3.internal->sample(transaction_id);
+    std::optional<ValueRef<U3>> v3 = c3.internal->sample(transaction_id);
     if (not v3) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U4>> v4 = c4.internal->sample(transaction_id);
+    std::optional<ValueRef<U4>> v4 = c4.internal->sample(transaction_id);
     if (not v4) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U5>> v5 = c5.internal->sample(transaction_id);
+    std::optional<ValueRef<U5>> v5 = c5.internal->sample(transaction_id);
     if (not v5) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U6>> v6 = c6.internal->sample(transaction_id);
+    std::optional<ValueRef<U6>> v6 = c6.internal->sample(transaction_id);
     if (not v6) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U7>> v7 = c7.internal->sample(transaction_id);
+    std::optional<ValueRef<U7>> v7 = c7.internal->sample(transaction_id);
     if (not v7) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U8>> v8 = c8.internal->sample(transaction_id);
+    std::optional<ValueRef<U8>> v8 = c8.internal->sample(transaction_id);
     if (not v8) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U9>> v9 = c9.internal->sample(transaction_id);
+    std::optional<ValueRef<U9>> v9 = c9.internal->sample(transaction_id);
     if (not v9) {
       return std::nullopt;
     }
-    std::optional<std::shared_ptr<U10>> v10 =
+    std::optional<ValueRef<U10>> v10 =
         c10.internal->sample(transaction_id);
     if (not v10) {
       return std::nullopt;
@@ -62,4 +62,9 @@ Cluster::Cluster(std::string name) : closed(false) {
   NodeManager::globalNodeManager->register_cluster_name(
       clusterManager.current_id(), name);
 }
+
+Cluster::Cluster(std::string name, u64 cost_hint_ns) : Cluster(name) {
+  NodeManager::globalNodeManager->register_cluster_cost_hint(
+      clusterManager.current_id(), cost_hint_ns);
+}
 } // namespace prf
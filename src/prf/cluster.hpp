@@ -26,6 +26,8 @@ public:
    * Sink系列が属するClusterのIDである
    * ユーザが手動で生成したTransactionは、このIDを参照することとする
    * このIDは割り当て前と後で値が変わらない
+   * ただし割り当て後は、互いに繋がっていないSink系列は別々のClusterに分けられ、
+   * このIDのClusterにはそのうちの一つだけが残る
    */
   static const ID UNMANAGED_CLUSTER_ID;
 };
@@ -54,5 +56,11 @@ public:
    * Clusterに名前を付けて作成する
    */
   Cluster(std::string);
+
+  /**
+   * Clusterに名前と更新時間の見積もり(ナノ秒)を付けて作成する
+   * 見積もりは更新時間を計測するまでの間、ParallelPlanner::CriticalPathの重みに使われる
+   */
+  Cluster(std::string, u64 cost_hint_ns);
 };
 } // namespace prf
@@ -1,9 +1,16 @@
 #pragma once
-#include "prf/thread.hpp"
+#include "prf/types.hpp"
+#include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <optional>
 #include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace prf {
 template <class T> class ConcurrentQueue {
@@ -11,6 +18,11 @@ template <class T> class ConcurrentQueue {
   std::condition_variable wait;
   std::queue<T> data;
 
+  /**
+   * このQueueを利用しているスレッドに停止が通知されたか
+   */
+  bool stopped = false;
+
 public:
   void push(T value);
   /**
@@ -19,27 +31,37 @@ public:
   std::optional<T> pop();
   std::optional<T> try_pop();
 
+  /**
+   * 値が来るまでブロッキングし、その時点でキューにある値を全てoutの末尾へ移す
+   * 一度のロックでまとめて取り出すので、連続して来たメッセージを纏めて処理したい場合に使う
+   * スレッドを停止するときにfalseが返される
+   */
+  bool drain(std::vector<T> &out);
+
   /**
    * このQueueを利用しているスレッドに停止を通知する
    */
   void notify_stop();
+
+  /**
+   * 停止の通知を取り消して再度利用できるようにする
+   */
+  void clear_stop();
 };
 
 template <class T> void ConcurrentQueue<T>::push(T value) {
   std::lock_guard<std::mutex> lock(data_lock);
-  data.push(value);
+  data.push(std::move(value));
   wait.notify_one();
 }
 
 template <class T> std::optional<T> ConcurrentQueue<T>::pop() {
   std::unique_lock<std::mutex> lock(data_lock);
-  wait.wait(lock, [this] {
-    return not this->data.empty() or stop_the_threads.load();
-  });
-  if (stop_the_threads.load()) {
+  wait.wait(lock, [this] { return not this->data.empty() or this->stopped; });
+  if (stopped) {
     return std::nullopt;
   }
-  T res = data.front();
+  T res = std::move(data.front());
   data.pop();
   if (not data.empty()) {
     wait.notify_one();
@@ -52,11 +74,314 @@ template <class T> std::optional<T> ConcurrentQueue<T>::try_pop() {
   if (data.empty()) {
     return std::nullopt;
   } else {
-    std::optional<T> res = data.front();
+    std::optional<T> res = std::move(data.front());
     data.pop();
     return res;
   }
 }
 
-template <class T> void ConcurrentQueue<T>::notify_stop() { wait.notify_all(); }
+template <class T> bool ConcurrentQueue<T>::drain(std::vector<T> &out) {
+  std::unique_lock<std::mutex> lock(data_lock);
+  wait.wait(lock, [this] { return not this->data.empty() or this->stopped; });
+  if (stopped) {
+    return false;
+  }
+  while (not data.empty()) {
+    out.push_back(std::move(data.front()));
+    data.pop();
+  }
+  return true;
+}
+
+template <class T> void ConcurrentQueue<T>::notify_stop() {
+  std::lock_guard<std::mutex> lock(data_lock);
+  stopped = true;
+  wait.notify_all();
+}
+
+template <class T> void ConcurrentQueue<T>::clear_stop() {
+  std::lock_guard<std::mutex> lock(data_lock);
+  stopped = false;
+}
+
+/**
+ * MpscRingQueueの容量の既定値
+ * 2のべき乗である必要がある
+ */
+const u64 DEFAULT_RING_QUEUE_CAPACITY = 1 << 15;
+
+/**
+ * 複数のスレッドからpushされ、単一のスレッドだけがpopする有界のキュー
+ * push/popは共にロックを取らずに行なわれ、値はムーブで受け渡される
+ * 消費者が待機している場合に限って起床のためにロックを取る
+ *
+ * 容量を越えてpushされた場合は、ロックを取って溢れた分の列に積み、待たずに戻る。
+ * ExecutorとPlannerのように互いのキューへpushし合うスレッドが両方とも満杯で待つと進まなくなるため。
+ * 溢れた分の列が空になるまでは、後からのpushも順序を保つためにそちらへ積む。
+ */
+template <class T> class MpscRingQueue {
+private:
+  struct Slot {
+    /**
+     * このスロットの世代
+     * pos と一致すれば書き込み可能、pos + 1 と一致すれば読み出し可能
+     */
+    std::atomic<u64> sequence;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  const u64 capacity;
+  const u64 mask;
+  std::unique_ptr<Slot[]> slots;
+
+  /**
+   * 生産者が次に書き込む位置
+   * 偽共有を避けるためにキャッシュラインを分けておく
+   */
+  alignas(64) std::atomic<u64> enqueue_pos;
+  /**
+   * 消費者が次に読み出す位置
+   */
+  alignas(64) std::atomic<u64> dequeue_pos;
+
+  /**
+   * 容量を越えてpushされた値
+   * overflow_mtxで保護する
+   */
+  std::deque<T> overflow;
+  std::mutex overflow_mtx;
+
+  /**
+   * overflowに積まれている値の数
+   * 0でない間はpushもoverflowに積む
+   */
+  std::atomic<u64> overflow_count;
+
+  /**
+   * このキューに停止が通知されたか
+   */
+  std::atomic_bool stopped;
+
+  /**
+   * 消費者がsleep_condで待機しているか
+   */
+  std::atomic_bool consumer_sleeping;
+  std::mutex sleep_mtx;
+  std::condition_variable sleep_cond;
+
+  /**
+   * 空のときに眠る前に譲歩しながら値を待つ回数
+   */
+  static const int SPIN_COUNT = 64;
+
+  T *slot_value(Slot &slot);
+  bool has_value();
+  void push_overflow(T &&value);
+  std::optional<T> try_pop_overflow();
+  void wake_consumer();
+
+public:
+  MpscRingQueue(const MpscRingQueue &) = delete;
+  MpscRingQueue &operator=(const MpscRingQueue &) = delete;
+
+  /**
+   * capacityは2のべき乗でなければならない
+   */
+  MpscRingQueue(u64 capacity = DEFAULT_RING_QUEUE_CAPACITY);
+  ~MpscRingQueue();
+
+  void push(T &&value);
+  void push(const T &value);
+
+  /**
+   * 値が来るまでブロッキングする
+   * 停止が通知されたときにnulloptが返される
+   * 消費者のスレッドからのみ呼び出すこと
+   */
+  std::optional<T> pop();
+
+  /**
+   * 消費者のスレッドからのみ呼び出すこと
+   */
+  std::optional<T> try_pop();
+
+  /**
+   * 値が来るまでブロッキングし、その時点でキューにある値を全てoutの末尾へ移す
+   * 停止が通知されたときにfalseが返される
+   * 消費者のスレッドからのみ呼び出すこと
+   */
+  bool drain(std::vector<T> &out);
+
+  /**
+   * このQueueを利用しているスレッドに停止を通知する
+   */
+  void notify_stop();
+
+  /**
+   * 停止の通知を取り消して再度利用できるようにする
+   */
+  void clear_stop();
+};
+
+template <class T>
+MpscRingQueue<T>::MpscRingQueue(u64 capacity)
+    : capacity(capacity), mask(capacity - 1), slots(new Slot[capacity]),
+      enqueue_pos(0), dequeue_pos(0), overflow_count(0), stopped(false),
+      consumer_sleeping(false) {
+  for (u64 i = 0; i < capacity; ++i) {
+    slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+template <class T> MpscRingQueue<T>::~MpscRingQueue() {
+  while (try_pop()) {
+  }
+}
+
+template <class T> T *MpscRingQueue<T>::slot_value(Slot &slot) {
+  return std::launder(reinterpret_cast<T *>(slot.storage));
+}
+
+template <class T> void MpscRingQueue<T>::push(const T &value) {
+  T copied(value);
+  push(std::move(copied));
+}
+
+template <class T> void MpscRingQueue<T>::push(T &&value) {
+  if (overflow_count.load() != 0) {
+    // 先に溢れた値より前に取り出されないよう、続けて溢れた分の列に積む
+    push_overflow(std::move(value));
+    return;
+  }
+  u64 pos = enqueue_pos.load(std::memory_order_relaxed);
+  Slot *slot;
+  while (true) {
+    slot = &slots[pos & mask];
+    u64 seq = slot->sequence.load(std::memory_order_acquire);
+    i64 diff = (i64)seq - (i64)pos;
+    if (diff == 0) {
+      if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // 満杯なので、消費者を待たずに溢れた分の列に積む
+      push_overflow(std::move(value));
+      return;
+    } else {
+      pos = enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+  new (slot->storage) T(std::move(value));
+  slot->sequence.store(pos + 1, std::memory_order_release);
+  wake_consumer();
+}
+
+template <class T> void MpscRingQueue<T>::push_overflow(T &&value) {
+  {
+    std::lock_guard<std::mutex> lock(overflow_mtx);
+    overflow.push_back(std::move(value));
+    overflow_count.fetch_add(1);
+  }
+  wake_consumer();
+}
+
+template <class T> std::optional<T> MpscRingQueue<T>::try_pop_overflow() {
+  if (overflow_count.load() == 0) {
+    return std::nullopt;
+  }
+  std::lock_guard<std::mutex> lock(overflow_mtx);
+  std::optional<T> res(std::move(overflow.front()));
+  overflow.pop_front();
+  overflow_count.fetch_sub(1);
+  return res;
+}
+
+template <class T> void MpscRingQueue<T>::wake_consumer() {
+  // 書き込みの公開と consumer_sleeping の読み出しの順序を保証する
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (consumer_sleeping.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(sleep_mtx);
+    sleep_cond.notify_one();
+  }
+}
+
+template <class T> bool MpscRingQueue<T>::has_value() {
+  u64 pos = dequeue_pos.load(std::memory_order_relaxed);
+  u64 seq = slots[pos & mask].sequence.load(std::memory_order_acquire);
+  return seq == pos + 1 or overflow_count.load() != 0;
+}
+
+template <class T> std::optional<T> MpscRingQueue<T>::try_pop() {
+  u64 pos = dequeue_pos.load(std::memory_order_relaxed);
+  Slot &slot = slots[pos & mask];
+  u64 seq = slot.sequence.load(std::memory_order_acquire);
+  if (seq != pos + 1) {
+    // 溢れた値はリングに積まれた値より後なので、リングが空になってから取り出す
+    // 書き込み途中の値があれば、それが公開されるのを待つ
+    if (enqueue_pos.load() != pos) {
+      return std::nullopt;
+    }
+    return try_pop_overflow();
+  }
+  T *value = slot_value(slot);
+  std::optional<T> res(std::move(*value));
+  value->~T();
+  slot.sequence.store(pos + capacity, std::memory_order_release);
+  dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+  return res;
+}
+
+template <class T> std::optional<T> MpscRingQueue<T>::pop() {
+  for (int i = 0; i < SPIN_COUNT; ++i) {
+    if (stopped.load()) {
+      return std::nullopt;
+    }
+    std::optional<T> res = try_pop();
+    if (res) {
+      return res;
+    }
+    std::this_thread::yield();
+  }
+  while (true) {
+    if (stopped.load()) {
+      return std::nullopt;
+    }
+    std::optional<T> res = try_pop();
+    if (res) {
+      return res;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mtx);
+    consumer_sleeping.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    sleep_cond.wait(lock,
+                    [this] { return this->has_value() or this->stopped.load(); });
+    consumer_sleeping.store(false);
+  }
+}
+
+template <class T> bool MpscRingQueue<T>::drain(std::vector<T> &out) {
+  std::optional<T> first = pop();
+  if (not first) {
+    return false;
+  }
+  out.push_back(std::move(*first));
+  // 取り出している間に来続けても終わるように、一度に取り出すのは容量までにする
+  for (u64 i = 1; i < capacity; ++i) {
+    std::optional<T> res = try_pop();
+    if (not res) {
+      break;
+    }
+    out.push_back(std::move(*res));
+  }
+  return true;
+}
+
+template <class T> void MpscRingQueue<T>::notify_stop() {
+  std::lock_guard<std::mutex> lock(sleep_mtx);
+  stopped.store(true);
+  sleep_cond.notify_all();
+}
+
+template <class T> void MpscRingQueue<T>::clear_stop() { stopped.store(false); }
 } // namespace prf
@@ -0,0 +1,123 @@
+#pragma once
+
+// C++20のコルーチンからトランザクションの終了を待つための機能
+// ライブラリ本体はC++17でビルドされるので、このヘッダはC++20でコンパイルする側でのみ使える
+
+#if __cplusplus < 202002L
+#error "prf/coroutine.hpp はC++20以降でのみ利用できます"
+#endif
+
+#include "prf/executor.hpp"
+#include "prf/transaction.hpp"
+#include <coroutine>
+#include <functional>
+#include <utility>
+
+namespace prf {
+
+/**
+ * 中断したコルーチンを再開させる場所
+ * 受け取った関数をどこかのスレッドで呼び出す
+ * 空の場合はPRFのスレッドプールで再開する
+ */
+using ResumeExecutor = std::function<void(std::function<void()>)>;
+
+namespace coroutine_detail {
+/**
+ * resumeをexecutorで、それが無ければPRFのスレッドプールで実行する
+ */
+inline void dispatch(const ResumeExecutor &executor,
+                     std::function<void()> resume) {
+  if (executor) {
+    executor(std::move(resume));
+  } else if (Executor::global_executor != nullptr) {
+    Executor::global_executor->post(std::move(resume));
+  } else {
+    resume();
+  }
+}
+} // namespace coroutine_detail
+
+/**
+ * JoinHandlerの終了を待つAwaitable
+ * 待っている間はスレッドをブロッキングせず、終了したらexecutorで再開する
+ * executorが無い場合はPRFのスレッドプールで再開するので、
+ * 再開したコルーチンからsend等の終了を待つ操作をしてはいけない。ワーカーが塞がり更新処理が進まなくなる
+ */
+class JoinAwaiter {
+private:
+  JoinHandler &handler;
+  ResumeExecutor executor;
+
+public:
+  JoinAwaiter(JoinHandler &handler, ResumeExecutor executor)
+      : handler(handler), executor(std::move(executor)) {}
+
+  bool await_ready() { return this->handler.finished(); }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    // thenの中で再開されたコルーチンがこのAwaiterを破棄することがあるので、必要なものは複製しておく
+    ResumeExecutor executor = this->executor;
+    this->handler.then([executor, handle]() -> void {
+      // thenはExecutorのスレッドで呼ばれるので、その場では再開しない
+      coroutine_detail::dispatch(executor,
+                                 [handle]() -> void { handle.resume(); });
+    });
+  }
+
+  void await_resume() {}
+};
+
+/**
+ * トランザクションを非同期に終了して、その終了を待つAwaitable
+ * 終了処理の後、JoinAwaiterと同じくexecutorで、それが無ければPRFのスレッドプールで再開する
+ * スレッドプールで再開した場合は、JoinAwaiterと同じくsend等の終了を待つ操作をしてはいけない
+ */
+class CommitAwaiter {
+private:
+  Transaction &transaction;
+  ResumeExecutor executor;
+
+public:
+  CommitAwaiter(Transaction &transaction, ResumeExecutor executor)
+      : transaction(transaction), executor(std::move(executor)) {}
+
+  bool await_ready() { return false; }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    ResumeExecutor executor = this->executor;
+    this->transaction.commit_async([executor, handle]() -> void {
+      // 完了時のコールバックの中で再開すると、戻るまでfutureの完了とメッセージの破棄が遅れるので、その場では再開しない
+      coroutine_detail::dispatch(executor,
+                                 [handle]() -> void { handle.resume(); });
+    });
+  }
+
+  void await_resume() {}
+};
+
+/**
+ * co_await handler でJoinHandlerの終了を待つ
+ * PRFのスレッドプールで再開する
+ */
+inline JoinAwaiter operator co_await(JoinHandler &handler) {
+  return JoinAwaiter(handler, nullptr);
+}
+
+/**
+ * co_await resume_on(handler, executor) でJoinHandlerの終了を待ち、executorで再開する
+ */
+inline JoinAwaiter resume_on(JoinHandler &handler, ResumeExecutor executor) {
+  return JoinAwaiter(handler, std::move(executor));
+}
+
+/**
+ * co_await commit(transaction) でトランザクションを終了し、その終了を待つ
+ * executorを渡すとそこで再開する
+ */
+inline CommitAwaiter commit(Transaction &transaction,
+                            ResumeExecutor executor = nullptr) {
+  return CommitAwaiter(transaction, std::move(executor));
+}
+
+} // namespace prf
@@ -0,0 +1,188 @@
+#include "prf/dataflow.hpp"
+#include "prf/executor.hpp"
+#include "prf/logger.hpp"
+
+namespace prf {
+
+DataflowScheduler::FlowTransaction::FlowTransaction(
+    ID transaction_id, InnerTransaction *transaction,
+    const std::vector<u64> &predecessors)
+    : transaction_id(transaction_id), transaction(transaction),
+      waiting_predecessors(new std::atomic<u64>[predecessors.size()]),
+      unresolved(predecessors.size()), decided(predecessors.size(), false) {
+  for (size_t i = 0; i < predecessors.size(); ++i) {
+    this->waiting_predecessors[i].store(predecessors[i]);
+  }
+}
+
+DataflowScheduler::DataflowScheduler(
+    const std::vector<std::vector<ID>> &cluster_successors,
+    ThreadPool &thread_pool, Runner runner)
+    : thread_pool(thread_pool), runner(runner), successors(cluster_successors),
+      predecessors(cluster_successors.size(), 0), started(false),
+      next_finalize_id(0) {
+  for (const auto &succs : this->successors) {
+    for (const ID succ : succs) {
+      ++this->predecessors[succ];
+    }
+  }
+  for (ID id = 0; id < this->successors.size(); ++id) {
+    if (this->predecessors[id] == 0) {
+      this->sources.push_back(id);
+    }
+    this->clusters.push_back(std::make_unique<FlowCluster>());
+  }
+}
+
+void DataflowScheduler::register_transaction(ID transaction_id) {
+  if (this->started) {
+    return;
+  }
+  // 最初のトランザクションから順に解決されるようにしておく
+  this->started = true;
+  for (auto &cluster : this->clusters) {
+    std::lock_guard<std::mutex> lock(cluster->mtx);
+    cluster->next_id = transaction_id;
+  }
+  std::lock_guard<std::mutex> lock(this->finalize_mtx);
+  this->next_finalize_id = transaction_id;
+}
+
+void DataflowScheduler::start(ID transaction_id,
+                              InnerTransaction *transaction) {
+  FlowTransaction *flow =
+      new FlowTransaction(transaction_id, transaction, this->predecessors);
+  if (this->clusters.empty()) {
+    this->finish_transaction(flow);
+    return;
+  }
+
+  std::vector<Item> ready;
+  for (const ID source : this->sources) {
+    this->arrive(flow, source, ready);
+  }
+  // Executorのスレッドでは更新せず、全てスレッドプールに任せる
+  this->drive(std::move(ready), false);
+}
+
+void DataflowScheduler::arrive(FlowTransaction *flow, ID cluster_id,
+                               std::vector<Item> &ready) {
+  FlowCluster &cluster = *this->clusters[cluster_id];
+  {
+    std::lock_guard<std::mutex> lock(cluster.mtx);
+    if (cluster.next_id != flow->transaction_id) {
+      // 前のトランザクションがこのクラスタを解決するまで待つ
+      cluster.parked[flow->transaction_id] = flow;
+      return;
+    }
+  }
+  ready.push_back({flow, cluster_id});
+}
+
+bool DataflowScheduler::decide(FlowTransaction *flow, ID cluster_id) {
+  std::lock_guard<std::mutex> lock(flow->decide_mtx);
+  flow->decided[cluster_id] = true;
+  return flow->transaction->is_target_cluster(cluster_id);
+}
+
+void DataflowScheduler::run(FlowTransaction *flow, ID cluster_id) {
+  std::vector<ID> pending({cluster_id});
+  while (not pending.empty()) {
+    ID updating = pending.back();
+    pending.pop_back();
+
+    ExecuteResult result = this->runner(flow->transaction, updating);
+
+    std::lock_guard<std::mutex> lock(flow->decide_mtx);
+    std::set<ID> futures =
+        flow->transaction->register_execution_result(result);
+    for (const ID future : futures) {
+      if (flow->decided[future]) {
+        // GlobalCellLoopのように依存関係に現れない更新で、既に読み飛ばしたクラスタが対象になった
+        info_log("解決済みのクラスタを追加で更新します Transaction: %ld, "
+                 "Cluster: %ld",
+                 flow->transaction_id, future);
+        pending.push_back(future);
+      }
+    }
+  }
+}
+
+void DataflowScheduler::resolve(FlowTransaction *flow, ID cluster_id,
+                                std::vector<Item> &ready) {
+  {
+    // 同じクラスタで次のトランザクションが待っていれば進める
+    FlowCluster &cluster = *this->clusters[cluster_id];
+    std::lock_guard<std::mutex> lock(cluster.mtx);
+    cluster.next_id = flow->transaction_id + 1;
+    auto itr = cluster.parked.find(cluster.next_id);
+    if (itr != cluster.parked.end()) {
+      ready.push_back({itr->second, cluster_id});
+      cluster.parked.erase(itr);
+    }
+  }
+  for (const ID succ : this->successors[cluster_id]) {
+    if (flow->waiting_predecessors[succ].fetch_sub(1) == 1) {
+      this->arrive(flow, succ, ready);
+    }
+  }
+  // 最後のクラスタを解決したスレッドだけがトランザクションを片付ける
+  if (flow->unresolved.fetch_sub(1) == 1) {
+    this->finish_transaction(flow);
+  }
+}
+
+void DataflowScheduler::drive(std::vector<Item> ready, bool continue_here) {
+  while (true) {
+    std::vector<Item> runnable;
+    while (not ready.empty()) {
+      Item item = ready.back();
+      ready.pop_back();
+      if (this->decide(item.first, item.second)) {
+        runnable.push_back(item);
+      } else {
+        // 更新対象でないクラスタはその場で読み飛ばす
+        this->resolve(item.first, item.second, ready);
+      }
+    }
+    if (runnable.empty()) {
+      return;
+    }
+
+    size_t first = continue_here ? 1 : 0;
+    for (size_t i = first; i < runnable.size(); ++i) {
+      Item item = runnable[i];
+      this->thread_pool.request([this, item]() -> void {
+        this->run(item.first, item.second);
+        std::vector<Item> next;
+        this->resolve(item.first, item.second, next);
+        this->drive(std::move(next), true);
+      });
+    }
+    if (not continue_here) {
+      return;
+    }
+
+    // 一つは奪われずにこのスレッドで続けて更新する
+    this->run(runnable[0].first, runnable[0].second);
+    this->resolve(runnable[0].first, runnable[0].second, ready);
+  }
+}
+
+void DataflowScheduler::finish_transaction(FlowTransaction *flow) {
+  ID transaction_id = flow->transaction_id;
+  delete flow;
+
+  // 終了処理はIDの順に行なう必要があるので、前のトランザクションが揃うまで溜めておく
+  std::lock_guard<std::mutex> lock(this->finalize_mtx);
+  this->resolved_transactions.insert(transaction_id);
+  while (this->resolved_transactions.count(this->next_finalize_id) != 0) {
+    this->resolved_transactions.erase(this->next_finalize_id);
+    FinalizeTransactionMessage msg;
+    msg.transaction_id = this->next_finalize_id;
+    Executor::messages.push(std::move(msg));
+    ++this->next_finalize_id;
+  }
+}
+
+} // namespace prf
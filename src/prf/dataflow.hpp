@@ -0,0 +1,160 @@
+#pragma once
+#include "prf/concurrent_queue.hpp"
+#include "prf/executor.hpp"
+#include "prf/thread_pool.hpp"
+#include "prf/transaction.hpp"
+#include "prf/types.hpp"
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace prf {
+
+/**
+ * Plannerを使わず、クラスタ間の依存関係から直接更新を進めるスケジューラ
+ *
+ * トランザクション毎に全てのクラスタについて「未解決の先行クラスタの数」を持ち、
+ * 0になったクラスタを解決する。解決とは、更新対象なら更新し、そうでなければ読み飛ばすことである。
+ * クラスタを解決したスレッドがそのまま後続のクラスタの数を減らし、
+ * 準備のできたクラスタの一つを自分で続けて更新し、残りはスレッドプールに積む。
+ *
+ * rank_based_plannerと同じく、同じクラスタは古いトランザクションから順に解決される。
+ * 先行クラスタが揃っていても、一つ前のトランザクションがそのクラスタを解決するまでは待たされる。
+ *
+ * 全てのクラスタを解決したトランザクションは、ID順にFinalizeTransactionMessageとしてExecutorへ送られる。
+ */
+class DataflowScheduler {
+public:
+  /**
+   * サブトランザクションを作ってクラスタを更新する関数
+   */
+  using Runner = std::function<ExecuteResult(InnerTransaction *, ID)>;
+
+private:
+  /**
+   * 更新中のトランザクションの状態
+   */
+  class FlowTransaction {
+  public:
+    ID transaction_id;
+    InnerTransaction *transaction;
+
+    /**
+     * クラスタ毎の未解決の先行クラスタの数
+     */
+    std::unique_ptr<std::atomic<u64>[]> waiting_predecessors;
+
+    /**
+     * まだ解決していないクラスタの数
+     */
+    std::atomic<u64> unresolved;
+
+    /**
+     * クラスタ毎に更新するか否かを決めたか
+     * 更新結果の登録と同じロックで保護し、決めた後に更新対象になったクラスタを取りこぼさないようにする
+     */
+    std::vector<bool> decided;
+    std::mutex decide_mtx;
+
+    FlowTransaction(ID transaction_id, InnerTransaction *transaction,
+                    const std::vector<u64> &predecessors);
+  };
+
+  /**
+   * クラスタ毎の、トランザクションを跨いだ解決の順序の管理
+   */
+  class FlowCluster {
+  public:
+    /**
+     * 次にこのクラスタを解決するトランザクションのID
+     */
+    ID next_id;
+
+    /**
+     * 先行クラスタは揃ったが、前のトランザクションを待っているトランザクション
+     */
+    std::map<ID, FlowTransaction *> parked;
+
+    std::mutex mtx;
+  };
+
+  /**
+   * 解決を待つ(トランザクション, クラスタ)
+   */
+  using Item = std::pair<FlowTransaction *, ID>;
+
+  ThreadPool &thread_pool;
+  Runner runner;
+
+  std::vector<std::vector<ID>> successors;
+  std::vector<u64> predecessors;
+  std::vector<ID> sources;
+
+  std::vector<std::unique_ptr<FlowCluster>> clusters;
+
+  /**
+   * 最初に登録されたトランザクションが来たか
+   * Executorのスレッドからのみ触る
+   */
+  bool started;
+
+  /**
+   * 全てのクラスタを解決したトランザクションのうち、まだ終了を依頼していないもの
+   */
+  std::set<ID> resolved_transactions;
+  ID next_finalize_id;
+  std::mutex finalize_mtx;
+
+  /**
+   * 先行クラスタが揃ったクラスタを、順番が来ていればreadyに積み、そうでなければ待たせる
+   */
+  void arrive(FlowTransaction *, ID cluster_id, std::vector<Item> &ready);
+
+  /**
+   * クラスタが更新対象かを決める
+   */
+  bool decide(FlowTransaction *, ID cluster_id);
+
+  /**
+   * クラスタを更新して結果をトランザクションに登録する
+   * 既に解決済みのクラスタが新たに更新対象になった場合は、それもこの場で更新する
+   */
+  void run(FlowTransaction *, ID cluster_id);
+
+  /**
+   * クラスタの解決を反映し、準備のできた後続をreadyに積む
+   */
+  void resolve(FlowTransaction *, ID cluster_id, std::vector<Item> &ready);
+
+  /**
+   * readyが無くなるまで解決を進める
+   * continueがtrueなら更新するクラスタの一つを呼び出したスレッドで続けて更新する
+   */
+  void drive(std::vector<Item> ready, bool continue_here);
+
+  void finish_transaction(FlowTransaction *);
+
+public:
+  DataflowScheduler(const DataflowScheduler &) = delete;
+  DataflowScheduler &operator=(const DataflowScheduler &) = delete;
+
+  DataflowScheduler(const std::vector<std::vector<ID>> &cluster_successors,
+                    ThreadPool &thread_pool, Runner runner);
+
+  /**
+   * トランザクションが登録されたことを報せる
+   * IDの順に呼び出すこと
+   */
+  void register_transaction(ID transaction_id);
+
+  /**
+   * トランザクションの更新を開始する
+   */
+  void start(ID transaction_id, InnerTransaction *transaction);
+};
+} // namespace prf
@@ -1,7 +1,12 @@
 #include "prf/executor.hpp"
+#include "prf/batch.hpp"
 #include "prf/concurrent_queue.hpp"
+#include "prf/dataflow.hpp"
+#include "prf/incremental_planner.hpp"
 #include "prf/logger.hpp"
+#include "prf/node.hpp"
 #include "prf/planner.hpp"
+#include "prf/prf.hpp"
 #include "prf/thread.hpp"
 #include "prf/thread_pool.hpp"
 #include "prf/time_invariant_values.hpp"
@@ -15,9 +20,30 @@
 namespace prf {
 TransactionExecuteMessage::TransactionExecuteMessage(
     InnerTransaction *transaction)
-    : transaction(transaction) {}
+    : detached(false), on_complete(nullptr), transaction(transaction) {}
 
-RegisterTransactionMessage::RegisterTransactionMessage(ID id_) : id(id_) {}
+TransactionExecuteMessage::TransactionExecuteMessage(
+    InnerTransaction *transaction, std::function<void()> on_complete)
+    : detached(true), on_complete(on_complete), transaction(transaction) {}
+
+bool TransactionExecuteMessage::is_detached() { return this->detached; }
+
+std::future<void> TransactionExecuteMessage::get_future() {
+  return this->completed.get_future();
+}
+
+void TransactionExecuteMessage::complete() {
+  if (this->on_complete) {
+    this->on_complete();
+  }
+  this->completed.set_value();
+}
+
+RegisterTransactionMessage::RegisterTransactionMessage(ID id_)
+    : id(id_), count(1) {}
+
+RegisterTransactionMessage::RegisterTransactionMessage(ID id_, u64 count_)
+    : id(id_), count(count_) {}
 
 void TransactionExecuteMessage::done() { this->waiter.done(); }
 
@@ -25,11 +51,19 @@ void TransactionExecuteMessage::wait() { this->waiter.wait(); }
 
 bool TransactionExecuteMessage::finished() { return this->waiter.sample(); }
 
-void Executor::initialize(std::map<ID, std::string> cluster_names) {
+void TransactionExecuteMessage::then(std::function<void()> f) {
+  this->waiter.then(f);
+}
+
+void Executor::initialize(std::map<ID, std::string> cluster_names,
+                          std::unique_ptr<IncrementalRankPlanner> planner,
+                          bool use_dataflow) {
   std::lock_guard<std::mutex> lock(executor_mutex);
   if (global_executor == nullptr) {
-    global_executor = new Executor(cluster_names);
+    global_executor =
+        new Executor(cluster_names, std::move(planner), use_dataflow);
     // global_executorの処理はバックグラウンドのスレッドで行なう
+    running_threads.fetch_add(1);
     std::thread t([] {
       global_executor->start_loop();
       wait_threads.fetch_sub(1);
@@ -41,164 +75,318 @@ void Executor::initialize(std::map<ID, std::string> cluster_names) {
 }
 
 void Executor::start_loop() {
+  std::vector<ExecutorMessage> batch;
   while (true) {
-    std::optional<ExecutorMessage> omsg = messages.pop();
-    if (not omsg) {
+    batch.clear();
+    // 溜まっているメッセージはまとめて取り出して処理する
+    if (not messages.drain(batch)) {
       break;
     }
-    ExecutorMessage msg = *omsg;
+    for (ExecutorMessage &msg : batch) {
+      this->handleMessage(msg);
+    }
+    if (this->planner) {
+      this->run_planner();
+    }
+  }
+  info_log("Executorの実行を停止します");
+  this->thread_pool.stop();
+}
 
-    if (std::holds_alternative<TransactionExecuteMessage *>(msg)) {
-      TransactionExecuteMessage *&temsg =
-          std::get<TransactionExecuteMessage *>(msg);
+void Executor::handleMessage(ExecutorMessage &msg) {
+  if (std::holds_alternative<TransactionExecuteMessage *>(msg)) {
+    this->handleExecuteMessage(std::get<TransactionExecuteMessage *>(msg));
+    return;
+  }
+  if (std::holds_alternative<StartUpdateClusterMessage>(msg)) {
+    this->handleStartUpdateClusterMessage(
+        std::get<StartUpdateClusterMessage>(msg));
+    return;
+  }
+  if (std::holds_alternative<FinalizeTransactionMessage>(msg)) {
+    this->handleFinalizeMessage(std::get<FinalizeTransactionMessage>(msg));
+    return;
+  }
+  if (std::holds_alternative<RegisterTransactionMessage>(msg)) {
+    this->handleRegisterMessage(std::get<RegisterTransactionMessage>(msg));
+    return;
+  }
+  if (std::holds_alternative<FinishUpdateClusterMessage>(msg)) {
+    this->handleFinishUpdateClusterMessage(
+        std::get<FinishUpdateClusterMessage>(msg));
+    return;
+  }
+  if (std::holds_alternative<TransactionBatch *>(msg)) {
+    this->handleBatchExecuteMessage(std::get<TransactionBatch *>(msg));
+    return;
+  }
+  // 来ることは無いが、一応追加しておく
+  warn_log("メッセージが適切に処理されませんでした");
+}
+
+void Executor::handleExecuteMessage(TransactionExecuteMessage *temsg) {
+  ID transaction_id = temsg->transaction->get_id();
+
+  info_log("新しいトランザクションが開始しました ID: %ld", transaction_id);
+
+  this->transactions[transaction_id] = temsg;
+  // Sink系列の値はこの時点で確定している
+  temsg->transaction->deliver_unordered();
+
+  if (this->dataflow) {
+    this->dataflow->start(transaction_id, temsg->transaction);
+    return;
+  }
+
+  std::set<ID> clusters = temsg->transaction->target_clusters();
+  UpdateTransactionMessage utmsg;
+  utmsg.transaction_id = transaction_id;
+  for (ID cluster : clusters) {
+    utmsg.future.push_back(cluster);
+  }
+  if (this->ordering_domains) {
+    for (ID domain : temsg->transaction->target_domains()) {
+      utmsg.domains.push_back(domain);
+    }
+  }
+  this->notify_planner(std::move(utmsg));
+}
 
-      ID transaction_id = temsg->transaction->get_id();
+void Executor::handleStartUpdateClusterMessage(
+    const StartUpdateClusterMessage &ftmsg) {
+  ID transaction_id = ftmsg.transaction_id;
+  ID cluster_id = ftmsg.cluster_id;
 
-      info_log("新しいトランザクションが開始しました ID: %ld", transaction_id);
+  if (this->transactions.count(transaction_id) == 0) {
+    warn_log("トランザクションがExecutorに登録されていません ID: %ld",
+             transaction_id);
+    return;
+  }
+  if (this->transaction_updatings[transaction_id].count(cluster_id) != 0) {
+    // 既に更新している場合はスキップする
+    return;
+  }
+  this->transaction_updatings[transaction_id].insert(cluster_id);
+
+  info_log("クラスタの更新を依頼されました Transaction: %ld, "
+           "Cluster: %ld, name: %s",
+           transaction_id, cluster_id,
+           this->cluster_names[cluster_id].c_str());
 
-      this->transactions[transaction_id] = temsg;
+  InnerTransaction *transaction =
+      this->transactions[transaction_id]->transaction;
 
-      std::set<ID> clusters = temsg->transaction->target_clusters();
+  // Plannerを兼ねる場合は終了時にまとめて報せるので、開始の通知は送らない
+  bool unified = this->planner != nullptr;
+
+  this->thread_pool.request([this, transaction, transaction_id, cluster_id,
+                             unified]() -> void {
+    if (not unified) {
+      // 更新が開始したことを通知
       UpdateTransactionMessage utmsg;
       utmsg.transaction_id = transaction_id;
-      for (ID cluster : clusters) {
-        utmsg.future.push_back(cluster);
-      }
-      PlannerManager::messages.push(utmsg);
-
-      continue;
+      utmsg.now.push_back(cluster_id);
+      PlannerManager::messages.push(std::move(utmsg));
     }
-    if (std::holds_alternative<StartUpdateClusterMessage>(msg)) {
-      StartUpdateClusterMessage &ftmsg =
-          std::get<StartUpdateClusterMessage>(msg);
 
-      ID transaction_id = ftmsg.transaction_id;
-      ID cluster_id = ftmsg.cluster_id;
+    ExecuteResult result = this->execute_cluster(transaction, cluster_id);
+
+    std::set<ID> futures = transaction->register_execution_result(result);
 
-      if (this->transactions.count(transaction_id) == 0) {
-        warn_log("トランザクションがExecutorに登録されていません ID: %ld",
-                 transaction_id);
-        continue;
+    if (unified) {
+      // 更新の開始と終了、後続のクラスタを一度にExecutorへ通知
+      FinishUpdateClusterMessage fumsg;
+      fumsg.transaction_id = transaction_id;
+      fumsg.cluster_id = cluster_id;
+      for (auto future : futures) {
+        fumsg.future.push_back(future);
       }
-      if (this->transaction_updatings[transaction_id].count(cluster_id) != 0) {
-        // 既に更新している場合はスキップする
-        continue;
+      Executor::messages.push(std::move(fumsg));
+    } else {
+      // 更新の終了を通知
+      UpdateTransactionMessage utmsg;
+      utmsg.transaction_id = transaction_id;
+      for (auto future : futures) {
+        utmsg.future.push_back(future);
       }
-      this->transaction_updatings[transaction_id].insert(cluster_id);
-
-      info_log("クラスタの更新を依頼されました Transaction: %ld, "
-               "Cluster: %ld, name: %s",
-               transaction_id, cluster_id,
-               this->cluster_names[cluster_id].c_str());
-
-      InnerTransaction *transaction =
-          this->transactions[transaction_id]->transaction;
-
-      this->thread_pool.request([this, transaction, transaction_id,
-                                 cluster_id]() -> void {
-        {
-          // 更新が開始したことを通知
-          UpdateTransactionMessage utmsg;
-          utmsg.transaction_id = transaction_id;
-          utmsg.now.push_back(cluster_id);
-          PlannerManager::messages.push(utmsg);
-        }
-
-        InnerTransaction *subtransaction =
-            transaction->generate_sub_transaction(cluster_id);
-
-        // current_transactionをsubtransactionに設定してから更新する
-        current_transaction = subtransaction;
-        ExecuteResult result = subtransaction->execute();
-        current_transaction = nullptr;
-
-        std::set<ID> futures = transaction->register_execution_result(result);
-
-        {
-          std::lock_guard<std::mutex> lock(this->before_update_hooks_mtx);
-          for (auto hook : result.before_update_hooks) {
-            this->before_update_hooks_buffers[transaction_id].push_back(hook);
-          }
-        }
-
-        {
-          // 更新の終了を通知
-          UpdateTransactionMessage utmsg;
-          utmsg.transaction_id = transaction_id;
-          for (auto future : futures) {
-            utmsg.future.push_back(future);
-          }
-          utmsg.finish.push_back(cluster_id);
-          PlannerManager::messages.push(utmsg);
-        }
-
-        info_log("クラスタの更新が終了しました Transaction: %ld, "
-                 "Cluster: %ld, name: %s",
-                 transaction_id, cluster_id,
-                 this->cluster_names[cluster_id].c_str());
-      });
-      continue;
+      utmsg.finish.push_back(cluster_id);
+      PlannerManager::messages.push(std::move(utmsg));
     }
-    if (std::holds_alternative<FinalizeTransactionMessage>(msg)) {
-      FinalizeTransactionMessage &ftmsg =
-          std::get<FinalizeTransactionMessage>(msg);
 
-      ID transaction_id = ftmsg.transaction_id;
+    info_log("クラスタの更新が終了しました Transaction: %ld, "
+             "Cluster: %ld, name: %s",
+             transaction_id, cluster_id,
+             this->cluster_names[cluster_id].c_str());
+  });
+}
 
-      if (this->transactions.count(transaction_id) == 0) {
-        // 複数回終了命令が来る可能性があるので、ここで吸収する
-        info_log("トランザクションがExecutorに登録されていません ID: %ld",
-                 transaction_id);
-        continue;
-      }
+ExecuteResult Executor::execute_cluster(InnerTransaction *transaction,
+                                       ID cluster_id) {
+  ID transaction_id = transaction->get_id();
+
+  InnerTransaction *subtransaction =
+      transaction->generate_sub_transaction(cluster_id);
+
+  // current_transactionをsubtransactionに設定してから更新する
+  current_transaction = subtransaction;
+  ProfileTimer timer;
+  ExecuteResult result = subtransaction->execute();
+  this->profiler.record(cluster_id, timer.elapsed_wall_ns(),
+                        timer.elapsed_cpu_ns());
+  current_transaction = nullptr;
+  // クラスタの更新を終えたので、このクラスタの値は確定している
+  subtransaction->deliver_unordered();
+  // サブトランザクションの管理用の領域はここでまとめて解放される
+  delete subtransaction;
+
+  {
+    std::lock_guard<std::mutex> lock(this->before_update_hooks_mtx);
+    for (auto hook : result.before_update_hooks) {
+      this->before_update_hooks_buffers[transaction_id].push_back(hook);
+    }
+  }
+  return result;
+}
+
+void Executor::handleFinalizeMessage(const FinalizeTransactionMessage &ftmsg) {
+  ID transaction_id = ftmsg.transaction_id;
+
+  if (this->transactions.count(transaction_id) == 0) {
+    // 複数回終了命令が来る可能性があるので、ここで吸収する
+    info_log("トランザクションがExecutorに登録されていません ID: %ld",
+             transaction_id);
+    return;
+  }
+
+  info_log("トランザクションの終了を依頼されました ID: %ld", transaction_id);
+
+  TransactionExecuteMessage *temsg = this->transactions[transaction_id];
+  auto notify = [this, temsg]() -> void {
+    // listenerの呼び出しまで終えたので、次のトランザクションに枠を譲る
+    transaction_window.release();
+    if (temsg->is_detached()) {
+      // 終了を待つ者がいないので、完了の通知はワーカーに任せてそこで片付ける
+      // 完了を待つ側が解放を観測できるよう、トランザクションは通知より先に破棄する
+      this->thread_pool.request([temsg]() -> void {
+        delete temsg->transaction;
+        temsg->transaction = nullptr;
+        temsg->complete();
+        delete temsg;
+      });
+    } else {
+      temsg->done();
+    }
+  };
+  if (this->pipelined_listeners) {
+    // listenerの呼び出しを待たずに次のメッセージに進み、呼び出しが全て終わったら完了を通知する
+    temsg->transaction->finalize(notify);
+  } else {
+    temsg->transaction->finalize();
+  }
+  if (not this->pipelined_listeners) {
+    notify();
+  }
 
-      info_log("トランザクションの終了を依頼されました ID: %ld",
-               transaction_id);
+  this->transactions.erase(transaction_id);
+  this->transaction_updatings.erase(transaction_id);
 
-      this->transactions[transaction_id]->transaction->finalize();
-      this->transactions[transaction_id]->done();
+  {
+    std::lock_guard<std::mutex> lock(this->before_update_hooks_mtx);
+    for (auto hook : this->before_update_hooks_buffers[transaction_id]) {
+      this->before_update_hooks.push_back(hook);
+    }
+    this->before_update_hooks_buffers.erase(transaction_id);
+  }
 
-      this->transactions.erase(transaction_id);
-      this->transaction_updatings.erase(transaction_id);
+  {
+    // トランザクションの終了をPlannerに通知
+    FinishTransactionMessage fmsg;
+    fmsg.transaction_id = transaction_id;
+    this->notify_planner(std::move(fmsg));
+  }
+}
 
-      {
-        std::lock_guard<std::mutex> lock(this->before_update_hooks_mtx);
-        for (auto hook : this->before_update_hooks_buffers[transaction_id]) {
-          this->before_update_hooks.push_back(hook);
-        }
-        this->before_update_hooks_buffers.erase(transaction_id);
-      }
+void Executor::handleRegisterMessage(const RegisterTransactionMessage &rtmsg) {
+  // まとめて生成されたトランザクションは一つずつ生成された場合と同じように扱う
+  for (ID transaction_id = rtmsg.id; transaction_id < rtmsg.id + rtmsg.count;
+       ++transaction_id) {
+    info_log("新しいトランザクションが登録されました ID: %ld", transaction_id);
 
-      {
-        // トランザクションの終了をPlannerに通知
-        FinishTransactionMessage ftmsg;
-        ftmsg.transaction_id = transaction_id;
-        PlannerManager::messages.push(ftmsg);
-      }
+    this->invoke_before_update_hooks(transaction_id);
+
+    if (this->dataflow) {
+      this->dataflow->register_transaction(transaction_id);
       continue;
     }
-    if (std::holds_alternative<RegisterTransactionMessage>(msg)) {
-      RegisterTransactionMessage &rtmsg =
-          std::get<RegisterTransactionMessage>(msg);
 
-      ID transaction_id = rtmsg.id;
+    // Plannerにトランザクションの開始を通知
+    StartTransactionMessage stmsg;
+    stmsg.transaction_id = transaction_id;
+    this->notify_planner(std::move(stmsg));
+  }
+}
 
-      info_log("新しいトランザクションが登録されました ID: %ld", transaction_id);
+void Executor::handleBatchExecuteMessage(TransactionBatch *batch) {
+  for (size_t i = 0; i < batch->size(); ++i) {
+    this->handleExecuteMessage(&batch->message(i));
+  }
+}
 
-      this->invoke_before_update_hooks(transaction_id);
+void Executor::handleFinishUpdateClusterMessage(
+    const FinishUpdateClusterMessage &fumsg) {
+  UpdateTransactionMessage utmsg;
+  utmsg.transaction_id = fumsg.transaction_id;
+  utmsg.now.push_back(fumsg.cluster_id);
+  utmsg.future = fumsg.future;
+  utmsg.finish.push_back(fumsg.cluster_id);
+  this->notify_planner(std::move(utmsg));
+}
 
-      // Plannerにトランザクションの開始を通知
-      StartTransactionMessage stmsg;
-      stmsg.transaction_id = transaction_id;
-      PlannerManager::messages.push(stmsg);
+void Executor::notify_planner(PlannerMessage message) {
+  if (this->dataflow) {
+    // 依存関係から直接更新を進める場合はPlannerが存在しない
+    return;
+  }
+  if (not this->planner) {
+    PlannerManager::messages.push(std::move(message));
+    return;
+  }
+  if (std::holds_alternative<StartTransactionMessage>(message)) {
+    this->planner->handleStartMessage(
+        std::get<StartTransactionMessage>(message));
+    return;
+  }
+  if (std::holds_alternative<UpdateTransactionMessage>(message)) {
+    this->planner->handleUpdateMessage(
+        std::get<UpdateTransactionMessage>(message));
+    return;
+  }
+  if (std::holds_alternative<FinishTransactionMessage>(message)) {
+    this->planner->handleFinishMessage(
+        std::get<FinishTransactionMessage>(message));
+    return;
+  }
+}
 
-      continue;
+void Executor::run_planner() {
+  std::vector<ExecutorMessage> decisions;
+  while (true) {
+    decisions.clear();
+    this->planner->plan(decisions);
+    if (decisions.empty()) {
+      break;
+    }
+    // トランザクションの終了によって更に仕事が割り当てられることがあるので繰り返す
+    for (ExecutorMessage &msg : decisions) {
+      this->handleMessage(msg);
     }
-    // 来ることは無いが、一応追加しておく
-    warn_log("メッセージが適切に処理されませんでした");
   }
-  info_log("Executorの実行を停止します");
-  this->thread_pool.stop();
+}
+
+ClusterProfiler &Executor::get_profiler() { return this->profiler; }
+
+void Executor::post(std::function<void()> task) {
+  this->thread_pool.request(task);
 }
 
 void Executor::invoke_after_build_hooks() {
@@ -213,13 +401,31 @@ std::vector<std::function<void(InnerTransaction *)>>
     Executor::after_build_hooks =
         std::vector<std::function<void(InnerTransaction *)>>();
 
-ConcurrentQueue<ExecutorMessage> Executor::messages;
+MpscRingQueue<ExecutorMessage> Executor::messages;
 Executor *Executor::global_executor = nullptr;
 std::mutex Executor::executor_mutex;
 
-Executor::Executor(std::map<ID, std::string> cluster_names)
+Executor::Executor(std::map<ID, std::string> cluster_names,
+                   std::unique_ptr<IncrementalRankPlanner> planner,
+                   bool use_dataflow)
     : thread_pool(ThreadPool::create_suitable_pool()),
-      cluster_names(cluster_names) {}
+      cluster_names(cluster_names),
+      profiler(NodeManager::globalNodeManager->get_cluster_successors().size(),
+               cluster_names),
+      planner(std::move(planner)), dataflow(nullptr),
+      pipelined_listeners(use_pipelined_listeners),
+      ordering_domains(use_ordering_domains) {
+  if (use_dataflow) {
+    this->dataflow = std::make_unique<DataflowScheduler>(
+        NodeManager::globalNodeManager->get_cluster_successors(),
+        this->thread_pool,
+        [this](InnerTransaction *transaction, ID cluster_id) -> ExecuteResult {
+          return this->execute_cluster(transaction, cluster_id);
+        });
+  }
+}
+
+Executor::~Executor() {}
 
 void Executor::invoke_before_update_hooks(ID transaction_id) {
   std::lock_guard<std::mutex> lock(this->before_update_hooks_mtx);
@@ -1,10 +1,14 @@
 #pragma once
 #include "prf/concurrent_queue.hpp"
+#include "prf/planner_message.hpp"
+#include "prf/profiler.hpp"
 #include "prf/thread_pool.hpp"
 #include "prf/transaction.hpp"
 #include "prf/types.hpp"
 #include <functional>
+#include <future>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <set>
 #include <variant>
@@ -12,6 +16,10 @@
 namespace prf {
 
 class InnerTransaction;
+class IncrementalRankPlanner;
+class DataflowScheduler;
+class TransactionBatch;
+struct ExecuteResult;
 
 /**
  * あるトランザクションの更新を開始するメッセージ
@@ -19,6 +27,14 @@ class InnerTransaction;
 class TransactionExecuteMessage {
   utils::Waiter waiter;
 
+  /**
+   * 終了を待つ者がいないか
+   * trueの場合、Executorが終了処理の後にトランザクションを破棄し、complete()を呼び出してメッセージを破棄する
+   */
+  bool detached;
+  std::function<void()> on_complete;
+  std::promise<void> completed;
+
 public:
   /**
    * 更新して欲しいトランザクション
@@ -26,6 +42,26 @@ public:
   InnerTransaction *transaction;
 
   TransactionExecuteMessage(InnerTransaction *transaction);
+
+  /**
+   * 終了を待つ者がいないメッセージを作る
+   * on_completeは終了処理の後にワーカーのスレッドで呼び出される
+   */
+  TransactionExecuteMessage(InnerTransaction *transaction,
+                            std::function<void()> on_complete);
+
+  bool is_detached();
+
+  /**
+   * 終了を待つ者がいないメッセージの完了を通知するfuture
+   */
+  std::future<void> get_future();
+
+  /**
+   * 終了を待つ者がいないメッセージについて、on_completeを呼び出してfutureを完了させる
+   */
+  void complete();
+
   /**
    * 更新処理が終了したことを通知する
    */
@@ -40,12 +76,23 @@ public:
    * 更新処理が終了しているかをブロッキング無しに返す
    */
   bool finished();
+
+  /**
+   * 更新処理が終了したときにfを呼び出すよう登録する
+   */
+  void then(std::function<void()> f);
 };
 
+/**
+ * トランザクションが生成されたことを報せるメッセージ
+ * まとめて生成された場合は、idから連続するcount個のトランザクションを表す
+ */
 class RegisterTransactionMessage {
 public:
   RegisterTransactionMessage(ID);
+  RegisterTransactionMessage(ID, u64 count);
   ID id;
+  u64 count;
 };
 
 /**
@@ -74,12 +121,31 @@ public:
   ID transaction_id;
 };
 
+/**
+ * クラスタの更新が終了したことをワーカーから直接Executorに報せるメッセージ
+ * ExecutorがPlannerを兼ねる場合にのみ使われ、
+ * 更新の開始と終了、新たに更新する予定になったクラスタを一度にまとめて運ぶ
+ */
+class FinishUpdateClusterMessage {
+public:
+  ID transaction_id;
+  /**
+   * 更新が終了したクラスタ
+   */
+  ID cluster_id;
+  /**
+   * 更新の結果、新たに更新する予定になったクラスタ
+   */
+  std::vector<ID> future;
+};
+
 /**
  * Executorが受け付けるメッセージの型
  */
 using ExecutorMessage =
     std::variant<TransactionExecuteMessage *, StartUpdateClusterMessage,
-                 FinalizeTransactionMessage, RegisterTransactionMessage>;
+                 FinalizeTransactionMessage, RegisterTransactionMessage,
+                 FinishUpdateClusterMessage, TransactionBatch *>;
 
 /**
  *トランザクションの更新処理をするクラス
@@ -129,23 +195,93 @@ private:
    */
   std::map<ID, std::string> cluster_names;
 
+  /**
+   * クラスタの更新時間の計測結果
+   */
+  ClusterProfiler profiler;
+
+  /**
+   * ExecutorがPlannerを兼ねる場合のPlanner
+   * 設定されている場合はPlannerManagerとメッセージをやりとりせず、このスレッドで計画を建てる
+   */
+  std::unique_ptr<IncrementalRankPlanner> planner;
+
+  /**
+   * Plannerを使わずクラスタ間の依存関係から直接更新を進める場合のスケジューラ
+   */
+  std::unique_ptr<DataflowScheduler> dataflow;
+
+  /**
+   * listenerの呼び出しをスレッドプールに任せるか
+   */
+  bool pipelined_listeners;
+
+  /**
+   * トランザクションが触る順序の単位をPlannerに報せるか
+   */
+  bool ordering_domains;
+
+  /**
+   * メッセージそれぞれをハンドリングするメソッド
+   */
+  void handleMessage(ExecutorMessage &);
+  void handleExecuteMessage(TransactionExecuteMessage *);
+  void handleStartUpdateClusterMessage(const StartUpdateClusterMessage &);
+  void handleFinalizeMessage(const FinalizeTransactionMessage &);
+  void handleRegisterMessage(const RegisterTransactionMessage &);
+  void handleFinishUpdateClusterMessage(const FinishUpdateClusterMessage &);
+  void handleBatchExecuteMessage(TransactionBatch *);
+
+  /**
+   * サブトランザクションを作ってクラスタを更新する
+   * 更新結果のトランザクションへの登録は呼び出し側で行なう
+   */
+  ExecuteResult execute_cluster(InnerTransaction *, ID cluster_id);
+
+  /**
+   * トランザクションの状態の変化をPlannerに報せる
+   * Plannerを兼ねる場合は直接反映し、そうでない場合はPlannerManagerに送る
+   */
+  void notify_planner(PlannerMessage);
+
+  /**
+   * Plannerを兼ねる場合に、新たに依頼できる仕事が無くなるまで計画を建てて処理する
+   */
+  void run_planner();
+
 public:
-  Executor(std::map<ID, std::string> cluster_names);
+  Executor(std::map<ID, std::string> cluster_names,
+           std::unique_ptr<IncrementalRankPlanner> planner, bool use_dataflow);
+  ~Executor();
 
   /**
    * Executorが起動していない場合に起動する
+   * plannerを渡した場合、ExecutorはPlannerManagerを使わずに自身で計画を建てる
+   * use_dataflowがtrueの場合、Plannerを使わずクラスタ間の依存関係から直接更新を進める
    */
-  static void initialize(std::map<ID, std::string> cluster_names);
+  static void initialize(std::map<ID, std::string> cluster_names,
+                         std::unique_ptr<IncrementalRankPlanner> planner,
+                         bool use_dataflow);
 
   /**
    * Executorの処理を開始する
    */
   void start_loop();
 
+  /**
+   * クラスタの更新時間の計測結果を返す
+   */
+  ClusterProfiler &get_profiler();
+
+  /**
+   * Executorのスレッドプールで仕事を実行する
+   */
+  void post(std::function<void()> task);
+
   /**
    * Executorへのメッセージのキュー
    */
-  static ConcurrentQueue<ExecutorMessage> messages;
+  static MpscRingQueue<ExecutorMessage> messages;
   static Executor *global_executor;
   static std::mutex executor_mutex;
 
@@ -0,0 +1,205 @@
+#include "prf/incremental_planner.hpp"
+#include "prf/logger.hpp"
+#include <algorithm>
+#include <limits>
+
+namespace prf {
+
+IncrementalRankPlanner::State::State(ID transaction_id)
+    : transaction_id(transaction_id), initialized(false),
+      finalize_requested(false), clusters() {}
+
+IncrementalRankPlanner::IncrementalRankPlanner(
+    const std::vector<Rank> &cluster_ranks) {
+  // ランクの値を順位に詰めておき、ランク毎の表を配列で持てるようにする
+  std::vector<u64> values;
+  for (const Rank &rank : cluster_ranks) {
+    values.push_back(rank.value);
+  }
+  std::sort(values.begin(), values.end());
+  values.erase(std::unique(values.begin(), values.end()), values.end());
+
+  for (const Rank &rank : cluster_ranks) {
+    this->rank_index.push_back(
+        std::lower_bound(values.begin(), values.end(), rank.value) -
+        values.begin());
+  }
+  this->rank_holders.resize(values.size());
+  this->waiting.resize(values.size());
+  this->cluster_owners.resize(cluster_ranks.size());
+}
+
+IncrementalRankPlanner::State *
+IncrementalRankPlanner::find_state(ID transaction_id) {
+  if (this->states.empty()) {
+    return nullptr;
+  }
+  ID id_min = this->states.front().transaction_id;
+  ID id_max = this->states.back().transaction_id;
+  if (transaction_id < id_min or id_max < transaction_id) {
+    return nullptr;
+  }
+  // statesは連番で入っているのでランダムアクセスできる
+  return &this->states[transaction_id - id_min];
+}
+
+void IncrementalRankPlanner::enqueue_head(ID cluster_id) {
+  const std::set<ID> &owners = this->cluster_owners[cluster_id];
+  if (owners.empty()) {
+    return;
+  }
+  State *head = this->find_state(*owners.begin());
+  if (head->clusters[cluster_id] == ClusterStatus::Future) {
+    this->waiting[this->rank_index[cluster_id]].insert(
+        {head->transaction_id, cluster_id});
+  }
+}
+
+void IncrementalRankPlanner::hold(State &state, ID cluster_id) {
+  ID transaction_id = state.transaction_id;
+  size_t rank = this->rank_index[cluster_id];
+  std::set<ID> &owners = this->cluster_owners[cluster_id];
+
+  if (not owners.empty() and transaction_id < *owners.begin()) {
+    // 先頭が入れ替わるので、前の先頭は待ち行列から外す
+    this->waiting[rank].erase({*owners.begin(), cluster_id});
+  }
+  owners.insert(transaction_id);
+  ++this->rank_holders[rank][transaction_id];
+  state.clusters[cluster_id] = ClusterStatus::Future;
+  this->enqueue_head(cluster_id);
+}
+
+void IncrementalRankPlanner::release(State &state, ID cluster_id) {
+  ID transaction_id = state.transaction_id;
+  size_t rank = this->rank_index[cluster_id];
+  std::set<ID> &owners = this->cluster_owners[cluster_id];
+
+  bool was_head = *owners.begin() == transaction_id;
+  owners.erase(transaction_id);
+  this->waiting[rank].erase({transaction_id, cluster_id});
+
+  auto itr = this->rank_holders[rank].find(transaction_id);
+  if (itr->second == 1) {
+    this->rank_holders[rank].erase(itr);
+  } else {
+    --itr->second;
+  }
+  state.clusters.erase(cluster_id);
+
+  if (was_head) {
+    this->enqueue_head(cluster_id);
+  }
+}
+
+void IncrementalRankPlanner::handleStartMessage(
+    const StartTransactionMessage &message) {
+  // statesはIDが連番で入ることを期待しているので、間を埋めながら追加する
+  ID next = this->states.empty() ? message.transaction_id
+                                 : this->states.back().transaction_id + 1;
+  for (; next <= message.transaction_id; ++next) {
+    this->states.push_back(State(next));
+    this->uninitialized.insert(next);
+  }
+}
+
+void IncrementalRankPlanner::handleUpdateMessage(
+    const UpdateTransactionMessage &message) {
+  State *state = this->find_state(message.transaction_id);
+  if (state == nullptr) {
+    warn_log("対応するトランザクションが存在しなかった (transaction_id: %lu)",
+             message.transaction_id);
+    return;
+  }
+
+  // 終了したクラスタが後続のクラスタを追加するので、必ず追加を先に反映する
+  for (const ID id : message.future) {
+    if (state->clusters.count(id) == 0) {
+      this->hold(*state, id);
+    }
+  }
+  for (const ID id : message.now) {
+    auto itr = state->clusters.find(id);
+    if (itr == state->clusters.end()) {
+      warn_log(
+          "事前に実行する予定と通知されていないトランザクションを更新している "
+          "(transaction_id: %lu, cluster_id: %lu))",
+          message.transaction_id, id);
+      this->hold(*state, id);
+    }
+    this->waiting[this->rank_index[id]].erase({message.transaction_id, id});
+    state->clusters[id] = ClusterStatus::Now;
+  }
+  for (const ID id : message.finish) {
+    if (state->clusters.count(id) == 0) {
+      warn_log("実行中と通知されていないトランザクションを終了している "
+               "(transaction_id: %lu, cluster_id: %lu))",
+               message.transaction_id, id);
+      continue;
+    }
+    this->release(*state, id);
+  }
+
+  // 状態が更新されたトランザクションは初期化されたものと見做す
+  state->initialized = true;
+  this->uninitialized.erase(message.transaction_id);
+}
+
+void IncrementalRankPlanner::handleFinishMessage(
+    const FinishTransactionMessage &message) {
+  if (this->states.empty() or
+      this->states.front().transaction_id != message.transaction_id) {
+    warn_log("現存する一番古いトランザクション以外は終了できません "
+             "(transaction_id: %lu)",
+             message.transaction_id);
+    return;
+  }
+  State &state = this->states.front();
+  while (not state.clusters.empty()) {
+    this->release(state, state.clusters.begin()->first);
+  }
+  this->uninitialized.erase(message.transaction_id);
+  this->states.pop_front();
+}
+
+void IncrementalRankPlanner::plan(std::vector<ExecutorMessage> &out) {
+  if (this->states.empty()) {
+    return;
+  }
+  const ID oldest = this->states.front().transaction_id;
+
+  // これ未満のIDのトランザクションだけが、今見ているランクのクラスタを更新できる
+  ID limit = this->uninitialized.empty() ? std::numeric_limits<ID>::max()
+                                         : *this->uninitialized.begin();
+
+  for (size_t rank = 0; rank < this->waiting.size() and oldest < limit;
+       ++rank) {
+    std::set<std::pair<ID, ID>> &candidates = this->waiting[rank];
+    while (not candidates.empty() and candidates.begin()->first < limit) {
+      auto [transaction_id, cluster_id] = *candidates.begin();
+      candidates.erase(candidates.begin());
+      this->find_state(transaction_id)->clusters[cluster_id] =
+          ClusterStatus::Requested;
+
+      StartUpdateClusterMessage msg;
+      msg.transaction_id = transaction_id;
+      msg.cluster_id = cluster_id;
+      out.push_back(std::move(msg));
+    }
+    // このランクを保持しているトランザクションより後では、より高いランクを更新できない
+    if (not this->rank_holders[rank].empty()) {
+      limit = std::min(limit, this->rank_holders[rank].begin()->first);
+    }
+  }
+
+  State &front = this->states.front();
+  if (front.initialized and front.clusters.empty() and
+      not front.finalize_requested) {
+    front.finalize_requested = true;
+    FinalizeTransactionMessage msg;
+    msg.transaction_id = front.transaction_id;
+    out.push_back(std::move(msg));
+  }
+}
+
+} // namespace prf
@@ -0,0 +1,117 @@
+#pragma once
+#include "prf/executor.hpp"
+#include "prf/planner.hpp"
+#include "prf/rank.hpp"
+#include "prf/types.hpp"
+#include <deque>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace prf {
+
+/**
+ * rank_based_plannerと同じ方針で実行計画を建てるが、状態を差分で更新するPlanner
+ *
+ * rank_based_plannerは状態が変わる度に全てのトランザクションを走査し直すが、
+ * こちらはメッセージが来る度に変化したクラスタの分だけ内部の表を更新する。
+ * トランザクションTのクラスタcは、c を保持するトランザクションの中でTが一番古く、
+ * T以前のトランザクションがcより低いランクのクラスタを一つも保持していないときに更新できる。
+ *
+ * PlannerManagerのスレッドから直接呼び出されることを想定しているので、スレッドセーフではない
+ */
+class IncrementalRankPlanner {
+private:
+  /**
+   * トランザクション内でのクラスタの状態
+   */
+  enum class ClusterStatus {
+    /**
+     * 更新する予定だがまだ更新を依頼していない
+     */
+    Future,
+    /**
+     * 更新を依頼したが開始の通知が来ていない
+     */
+    Requested,
+    /**
+     * 更新中
+     */
+    Now,
+  };
+
+  class State {
+  public:
+    ID transaction_id;
+    bool initialized;
+    /**
+     * 終了の依頼を既に出したか
+     */
+    bool finalize_requested;
+    /**
+     * 保持しているクラスタとその状態
+     */
+    std::map<ID, ClusterStatus> clusters;
+
+    State(ID transaction_id);
+  };
+
+  /**
+   * クラスタIDからランクの順位を引く表
+   * ランクの値を小さいものから詰めて番号を振り直したもの
+   */
+  std::vector<size_t> rank_index;
+
+  /**
+   * ランクの順位から、そのランクのクラスタを保持しているトランザクションとその個数を引く表
+   */
+  std::vector<std::map<ID, u64>> rank_holders;
+
+  /**
+   * クラスタIDから、そのクラスタを保持しているトランザクションを引く表
+   * 先頭のトランザクションだけがそのクラスタを更新できる
+   */
+  std::vector<std::set<ID>> cluster_owners;
+
+  /**
+   * ランクの順位から、更新を依頼できるのを待っている(トランザクション, クラスタ)を引く表
+   * クラスタを保持しているトランザクションの中で一番古いものだけが入る
+   */
+  std::vector<std::set<std::pair<ID, ID>>> waiting;
+
+  /**
+   * 初期化されていないトランザクション
+   * これより後のトランザクションにはクラスタを割り当てない
+   */
+  std::set<ID> uninitialized;
+
+  /**
+   * dequeのfrontから順に古いトランザクションの状態が格納されている
+   */
+  std::deque<State> states;
+
+  State *find_state(ID transaction_id);
+
+  void hold(State &state, ID cluster_id);
+  void release(State &state, ID cluster_id);
+
+  /**
+   * クラスタを保持している一番古いトランザクションが未依頼であれば待ち行列に入れる
+   */
+  void enqueue_head(ID cluster_id);
+
+public:
+  IncrementalRankPlanner(const std::vector<Rank> &cluster_ranks);
+
+  void handleStartMessage(const StartTransactionMessage &);
+  void handleUpdateMessage(const UpdateTransactionMessage &);
+  void handleFinishMessage(const FinishTransactionMessage &);
+
+  /**
+   * 現在の状態から新たに依頼できる更新と終了をoutの末尾に追加する
+   * 一度追加したものは二度と追加しない
+   */
+  void plan(std::vector<ExecutorMessage> &out);
+};
+} // namespace prf
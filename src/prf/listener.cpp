@@ -0,0 +1,55 @@
+#include "prf/listener.hpp"
+#include "prf/executor.hpp"
+
+namespace prf {
+
+ListenerQueue::ListenerQueue() : running(false) {}
+
+void ListenerQueue::post(std::function<void()> call) {
+  {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->calls.push_back(std::move(call));
+    if (this->running) {
+      // 処理中のスレッドが続けて呼び出す
+      return;
+    }
+    this->running = true;
+  }
+  Executor::global_executor->post([this]() -> void { this->drain(); });
+}
+
+void ListenerQueue::drain() {
+  while (true) {
+    std::function<void()> call;
+    {
+      std::lock_guard<std::mutex> lock(this->mtx);
+      if (this->calls.empty()) {
+        this->running = false;
+        return;
+      }
+      call = std::move(this->calls.front());
+      this->calls.pop_front();
+    }
+    call();
+  }
+}
+
+ListenerDelivery::ListenerDelivery(std::function<void()> on_delivered)
+    : pending(1), on_delivered(on_delivered) {}
+
+void ListenerDelivery::post(ListenerQueue &queue, std::function<void()> call) {
+  this->pending.fetch_add(1);
+  queue.post([this, call]() -> void {
+    call();
+    this->finish();
+  });
+}
+
+void ListenerDelivery::finish() {
+  if (this->pending.fetch_sub(1) != 1) {
+    return;
+  }
+  this->on_delivered();
+  delete this;
+}
+} // namespace prf
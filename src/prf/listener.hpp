@@ -0,0 +1,72 @@
+#pragma once
+#include "prf/types.hpp"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+namespace prf {
+
+/**
+ * FRPの外でlistenしている関数一つ分の呼び出しを溜めるキュー
+ *
+ * 積まれた呼び出しは積まれた順に一つずつExecutorのスレッドプールで実行する
+ * 異なるキューの呼び出しは並列に実行される
+ * Executorはトランザクションの順に終了処理をするので、一つのlistenerはトランザクションの順に呼び出される
+ */
+class ListenerQueue {
+private:
+  std::deque<std::function<void()>> calls;
+
+  /**
+   * スレッドプールでこのキューを処理中か
+   */
+  bool running;
+
+  std::mutex mtx;
+
+  /**
+   * キューが空になるまで呼び出しを実行する
+   */
+  void drain();
+
+public:
+  ListenerQueue(const ListenerQueue &) = delete;
+  ListenerQueue &operator=(const ListenerQueue &) = delete;
+
+  ListenerQueue();
+
+  void post(std::function<void()> call);
+};
+
+/**
+ * 一つのトランザクションが積んだlistenerの呼び出しが全て終わるのを数える
+ * 最後の呼び出しが終わったらon_deliveredを呼び出して自身を破棄する
+ */
+class ListenerDelivery {
+private:
+  /**
+   * 終わっていない呼び出しの数
+   * 呼び出しを積み終えるまで0にならないよう、積んでいる側の分を一つ含める
+   */
+  std::atomic<u64> pending;
+
+  std::function<void()> on_delivered;
+
+public:
+  ListenerDelivery(const ListenerDelivery &) = delete;
+  ListenerDelivery &operator=(const ListenerDelivery &) = delete;
+
+  ListenerDelivery(std::function<void()> on_delivered);
+
+  /**
+   * callをqueueに積み、終わったら数を減らす
+   */
+  void post(ListenerQueue &queue, std::function<void()> call);
+
+  /**
+   * 一つ分の呼び出しが終わったことを報せる
+   */
+  void finish();
+};
+} // namespace prf
@@ -11,7 +11,7 @@
 
 namespace prf {
 // Node
-Node::Node(ID cluster_id) : cluster_id(cluster_id) {
+Node::Node(ID cluster_id) : cluster_id(cluster_id), domain_id(0) {
   node_id = next_node_id.fetch_add(1);
 }
 
@@ -19,10 +19,13 @@ ID Node::get_cluster_id() { return cluster_id; }
 void Node::set_cluster_id(ID id) { cluster_id = id; };
 Rank &Node::get_in_cluster_rank() { return in_cluster_rank; }
 ID Node::get_node_id() { return node_id; }
+ID Node::get_domain_id() { return domain_id; }
+void Node::set_domain_id(ID id) { domain_id = id; }
 
 const std::vector<Node *> &Node::get_childs() { return childs; }
 const std::vector<Node *> &Node::get_same_clusters() { return same_clusters; }
 const std::vector<Node *> &Node::get_loop_childs() { return loop_childs; }
+const std::vector<Node *> &Node::get_global_childs() { return global_childs; }
 
 void Node::link_to(Node *other) { childs.push_back(other); }
 
@@ -35,10 +38,14 @@ void Node::loop_child_to(Node *other) {
   loop_childs.push_back(other);
 }
 
+void Node::global_link_to(Node *other) { global_childs.push_back(other); }
+
 std::atomic_ulong next_node_id(0);
 
 // NodeManager
-NodeManager::NodeManager() : nodes(), cluster_ranks(), already_build(false) {}
+NodeManager::NodeManager()
+    : nodes(), cluster_ranks(), cluster_successors(), cluster_descendants(),
+      domain_count(0), already_build(false) {}
 
 void NodeManager::register_node(Node *node) { this->nodes.push_back(node); }
 
@@ -66,25 +73,20 @@ void NodeManager::split_cluster_by_associates() {
     }
   }
 
-  bool find = false;
+  // ClusterId = UNMANAGED_CLUSTER_ID
+  // つまりSink系列のノードは纏めず、上で繋がったもの毎に別々のクラスタにする
+  // Sink系列のクラスタが更新されることは無いので、分けても順序は変わらない
+  // 全てのトランザクションが一つのクラスタを通らないようにするためである
   Node *sink_node = nullptr;
-  {
-    // ClusterId = UNMANAGED_CLUSTER_ID
-    // つまりSink系列のノードは単一のクラスタに纏める
-    for (Node *n : nodes) {
-      if (n->get_cluster_id() == ClusterManager::UNMANAGED_CLUSTER_ID) {
-        if (find) {
-          uf.merge(node2u64[n], node2u64[sink_node]);
-        } else {
-          find = true;
-          sink_node = n;
-        }
-      }
-    }
-    if (not find) {
-      info_log("グラフにSink系列の時変値が存在しませんでした");
+  for (Node *n : nodes) {
+    if (n->get_cluster_id() == ClusterManager::UNMANAGED_CLUSTER_ID) {
+      sink_node = n;
+      break;
     }
   }
+  if (sink_node == nullptr) {
+    info_log("グラフにSink系列の時変値が存在しませんでした");
+  }
 
   std::vector<u64> unionfind_ids;
   for (auto i : node2u64) {
@@ -94,6 +96,7 @@ void NodeManager::split_cluster_by_associates() {
   std::map<u64, u64> unionfind_id2cluster_id = numbering(unionfind_ids);
 
   std::map<ID, std::string> mapped_cluster_names;
+  std::map<ID, u64> mapped_cluster_cost_hints;
 
   for (Node *node : nodes) {
     u64 unionfind_id = uf.get_parent(node2u64[node]);
@@ -103,14 +106,31 @@ void NodeManager::split_cluster_by_associates() {
     if (mapped_cluster_names[cluster_id] == "") {
       mapped_cluster_names[cluster_id] = "NO_NAME";
     }
+    auto hint = this->cluster_cost_hints.find(node->get_cluster_id());
+    if (hint != this->cluster_cost_hints.end()) {
+      mapped_cluster_cost_hints[cluster_id] = hint->second;
+    }
     node->set_cluster_id(cluster_id);
   }
-  // IDの再割り当てでSink系列のノードのクラスタIDがUNMANAGED_CLUSTER_IDじゃなくなったら現在そうであるクラスタとswapする
+  // IDの再割り当てで最初のSink系列のノードのクラスタIDがUNMANAGED_CLUSTER_IDじゃなくなったら現在そうであるクラスタとswapする
+  // UNMANAGED_CLUSTER_IDのクラスタを他の系列が使わないようにするためである
   if (sink_node != nullptr and
       sink_node->get_cluster_id() != ClusterManager::UNMANAGED_CLUSTER_ID) {
     std::swap(mapped_cluster_names[sink_node->get_cluster_id()],
               mapped_cluster_names[ClusterManager::UNMANAGED_CLUSTER_ID]);
     ID sink_id = sink_node->get_cluster_id();
+    {
+      auto sink_hint = mapped_cluster_cost_hints.extract(sink_id);
+      auto unmanaged_hint = mapped_cluster_cost_hints.extract(
+          ClusterManager::UNMANAGED_CLUSTER_ID);
+      if (sink_hint) {
+        mapped_cluster_cost_hints[ClusterManager::UNMANAGED_CLUSTER_ID] =
+            sink_hint.mapped();
+      }
+      if (unmanaged_hint) {
+        mapped_cluster_cost_hints[sink_id] = unmanaged_hint.mapped();
+      }
+    }
     for (Node *node : nodes) {
       ID fixed_id = node->get_cluster_id();
       if (fixed_id == sink_id) {
@@ -122,6 +142,7 @@ void NodeManager::split_cluster_by_associates() {
     }
   }
   this->cluster_names = mapped_cluster_names;
+  this->cluster_cost_hints = mapped_cluster_cost_hints;
 }
 
 void NodeManager::generate_cluster_ranks() {
@@ -144,6 +165,15 @@ void NodeManager::generate_cluster_ranks() {
     }
   }
 
+  cluster_successors.assign(max_id + 1, std::vector<ID>());
+  for (ID i = 0; i < cluster_childs.size(); ++i) {
+    for (const ID child_id : cluster_childs[i]) {
+      if (child_id != i) {
+        cluster_successors[i].push_back(child_id);
+      }
+    }
+  }
+
   std::vector<ID> updates;
 
   for (ID i = 0; i < cluster_childs.size(); ++i) {
@@ -231,6 +261,87 @@ void NodeManager::build() {
   split_cluster_by_associates();
   generate_cluster_ranks();
   generate_in_cluster_ranks();
+  generate_cluster_descendants();
+  generate_ordering_domains();
+}
+
+void NodeManager::generate_ordering_domains() {
+  std::map<Node *, u64> node2u64 = numbering(nodes);
+  UnionFind uf(node2u64.size());
+
+  for (Node *node : nodes) {
+    for (Node *child : node->get_childs()) {
+      uf.merge(node2u64[node], node2u64[child]);
+    }
+    for (Node *child : node->get_loop_childs()) {
+      uf.merge(node2u64[node], node2u64[child]);
+    }
+    for (Node *child : node->get_global_childs()) {
+      uf.merge(node2u64[node], node2u64[child]);
+    }
+  }
+
+  // 同じクラスタは纏めて更新されるので同じ単位にする
+  std::map<ID, Node *> cluster_representatives;
+  for (Node *node : nodes) {
+    ID cluster_id = node->get_cluster_id();
+    auto itr = cluster_representatives.find(cluster_id);
+    if (itr == cluster_representatives.end()) {
+      cluster_representatives[cluster_id] = node;
+    } else {
+      uf.merge(node2u64[node], node2u64[itr->second]);
+    }
+  }
+
+  std::vector<u64> unionfind_ids;
+  for (auto i : node2u64) {
+    unionfind_ids.push_back(uf.get_parent(i.second));
+  }
+  std::map<u64, u64> unionfind_id2domain_id = numbering(unionfind_ids);
+  for (Node *node : nodes) {
+    node->set_domain_id(
+        unionfind_id2domain_id[uf.get_parent(node2u64[node])]);
+  }
+  this->domain_count = unionfind_id2domain_id.size();
+}
+
+void NodeManager::generate_cluster_descendants() {
+  size_t size = cluster_successors.size();
+
+  // 後続が全て計算済みのクラスタから順に、後続の到達集合を合わせていく
+  std::vector<u64> remaining(size, 0);
+  std::vector<std::vector<ID>> predecessors(size);
+  for (ID id = 0; id < size; ++id) {
+    remaining[id] = cluster_successors[id].size();
+    for (const ID succ : cluster_successors[id]) {
+      predecessors[succ].push_back(id);
+    }
+  }
+
+  cluster_descendants.assign(size, Bitset(size));
+  cluster_order.clear();
+
+  std::vector<ID> updates;
+  for (ID id = 0; id < size; ++id) {
+    if (remaining[id] == 0) {
+      updates.push_back(id);
+    }
+  }
+  while (not updates.empty()) {
+    const ID updating_id = updates.back();
+    updates.pop_back();
+    cluster_order.push_back(updating_id);
+
+    for (const ID succ : cluster_successors[updating_id]) {
+      cluster_descendants[updating_id].set(succ);
+      cluster_descendants[updating_id] |= cluster_descendants[succ];
+    }
+    for (const ID pred : predecessors[updating_id]) {
+      if (--remaining[pred] == 0) {
+        updates.push_back(pred);
+      }
+    }
+  }
 }
 
 const std::vector<Rank> &NodeManager::get_cluster_ranks() {
@@ -240,6 +351,34 @@ const std::vector<Rank> &NodeManager::get_cluster_ranks() {
   return cluster_ranks;
 }
 
+const std::vector<std::vector<ID>> &NodeManager::get_cluster_successors() {
+  if (not already_build) {
+    failure_log("クラスタの依存関係を知るにはビルドをしてください");
+  }
+  return cluster_successors;
+}
+
+const std::vector<ID> &NodeManager::get_cluster_order() {
+  if (not already_build) {
+    failure_log("クラスタの順序を知るにはビルドをしてください");
+  }
+  return cluster_order;
+}
+
+size_t NodeManager::get_domain_count() {
+  if (not already_build) {
+    failure_log("順序の単位を知るにはビルドをしてください");
+  }
+  return domain_count;
+}
+
+const std::vector<Bitset> &NodeManager::get_cluster_descendants() {
+  if (not already_build) {
+    failure_log("クラスタの到達可能性を知るにはビルドをしてください");
+  }
+  return cluster_descendants;
+}
+
 void NodeManager::register_cluster_name(ID cluster_id,
                                         std::string cluster_name) {
   this->cluster_names[cluster_id] = cluster_name;
@@ -249,5 +388,13 @@ std::map<ID, std::string> NodeManager::get_cluster_names() {
   return this->cluster_names;
 }
 
+void NodeManager::register_cluster_cost_hint(ID cluster_id, u64 cost_ns) {
+  this->cluster_cost_hints[cluster_id] = cost_ns;
+}
+
+std::map<ID, u64> NodeManager::get_cluster_cost_hints() {
+  return this->cluster_cost_hints;
+}
+
 NodeManager *NodeManager::globalNodeManager = new NodeManager();
 }; // namespace prf
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "prf/bitset.hpp"
 #include "prf/rank.hpp"
 #include "prf/types.hpp"
 #include <atomic>
@@ -15,7 +16,8 @@ private:
   // 所属しているクラスタのID
   // ビルド時にクラスタIDを再度割り当てる
   // 同じクラスタIDであっても連結成分でない場合は異なるクラスタIDになる
-  // Sink系列の場合は必ずクラスタのIDが0になる
+  // Sink系列の場合はビルド前のクラスタのIDが0になる
+  // ビルド後は繋がっているSink系列毎に別々のクラスタになり、そのうち一つが0を使う
   ID cluster_id;
 
   // クラスター内の優先順位
@@ -24,6 +26,10 @@ private:
   // このノードのID
   ID node_id;
 
+  // このノードが属する順序の単位のID
+  // ビルド時に依存グラフの弱連結成分毎に割り当てる
+  ID domain_id;
+
   // このノードに依存しているノード
   std::vector<Node *> childs;
 
@@ -33,6 +39,10 @@ private:
   // Loopなどの依存関係は無いが同一クラスタに属するべきものを入れる
   std::vector<Node *> same_clusters;
 
+  // 依存関係は無いが、このノードの更新に連動して更新されるノード
+  // GlobalCellLoopのように、トランザクションを跨いで値を渡すものを入れる
+  std::vector<Node *> global_childs;
+
 public:
   Node(ID);
 
@@ -40,16 +50,22 @@ public:
   void set_cluster_id(ID);
   Rank &get_in_cluster_rank();
   ID get_node_id();
+  ID get_domain_id();
+  void set_domain_id(ID);
 
   const std::vector<Node *> &get_childs();
   const std::vector<Node *> &get_loop_childs();
   const std::vector<Node *> &get_same_clusters();
+  const std::vector<Node *> &get_global_childs();
 
   // 別のノードを子ノードとする
   void link_to(Node *);
 
   // 別のノードをLoopでの子ノードとする
   void loop_child_to(Node *);
+
+  // 依存関係は作らず、別のノードを連動して更新されるノードとする
+  void global_link_to(Node *);
 };
 
 extern std::atomic_ulong next_node_id;
@@ -60,6 +76,14 @@ private:
   std::vector<Node *> nodes;
   // クラスターに割り当てるランク
   std::vector<Rank> cluster_ranks;
+  // クラスターから直接依存しているクラスターを引く表(自分自身は含まない)
+  std::vector<std::vector<ID>> cluster_successors;
+  // クラスターから推移的に到達できるクラスターの集合(自分自身は含まない)
+  std::vector<Bitset> cluster_descendants;
+  // 後続より後に現れないように、葉から順に並べたクラスター
+  std::vector<ID> cluster_order;
+  // 順序の単位の数
+  size_t domain_count;
   bool already_build;
 
   /**
@@ -67,12 +91,21 @@ private:
    */
   std::map<ID, std::string> cluster_names;
 
+  /**
+   * ID -> Clusterの更新時間の見積もり(ナノ秒)
+   */
+  std::map<ID, u64> cluster_cost_hints;
+
   // ノード間の関係性に基づいてクラスタの再割り当てを行なう
   void split_cluster_by_associates();
   // クラスタにランクを割り当てる
   void generate_cluster_ranks();
   // クラスタ内のランクを割り当てる
   void generate_in_cluster_ranks();
+  // クラスタ間の到達可能性と、葉から順に並べた順序を計算する
+  void generate_cluster_descendants();
+  // 依存グラフの弱連結成分毎にノードへ順序の単位を割り当てる
+  void generate_ordering_domains();
 
 public:
   NodeManager();
@@ -89,8 +122,27 @@ public:
 
   std::map<ID, std::string> get_cluster_names();
 
+  /**
+   * Clusterに更新時間の見積もりを登録する
+   */
+  void register_cluster_cost_hint(ID, u64);
+
+  std::map<ID, u64> get_cluster_cost_hints();
+
   const std::vector<Rank> &get_cluster_ranks();
 
+  const std::vector<std::vector<ID>> &get_cluster_successors();
+
+  const std::vector<Bitset> &get_cluster_descendants();
+
+  const std::vector<ID> &get_cluster_order();
+
+  /**
+   * 順序の単位の数
+   * 順序の単位のIDは0からこの値未満で、ノードのget_domain_idで引ける
+   */
+  size_t get_domain_count();
+
   static NodeManager *globalNodeManager;
 };
 
@@ -1,12 +1,17 @@
 #include "prf/planner.hpp"
 #include "prf/concurrent_queue.hpp"
 #include "prf/executor.hpp"
+#include "prf/incremental_planner.hpp"
 #include "prf/logger.hpp"
+#include "prf/node.hpp"
 #include "prf/prf.hpp"
 #include "prf/rank.hpp"
 #include "prf/thread.hpp"
+#include <algorithm>
 #include <atomic>
+#include <iterator>
 #include <limits>
+#include <optional>
 #include <set>
 #include <thread>
 #include <variant>
@@ -16,19 +21,31 @@ void PlannerManager::handleMessage(PlannerMessage message) {
   if (std::holds_alternative<StartTransactionMessage>(message)) {
     const StartTransactionMessage &msg =
         std::get<StartTransactionMessage>(message);
-    this->handleStartMessage(msg);
+    if (this->incremental_planner) {
+      this->incremental_planner->handleStartMessage(msg);
+    } else {
+      this->handleStartMessage(msg);
+    }
     return;
   }
   if (std::holds_alternative<UpdateTransactionMessage>(message)) {
     const UpdateTransactionMessage &msg =
         std::get<UpdateTransactionMessage>(message);
-    this->handleUpdateMessage(msg);
+    if (this->incremental_planner) {
+      this->incremental_planner->handleUpdateMessage(msg);
+    } else {
+      this->handleUpdateMessage(msg);
+    }
     return;
   }
   if (std::holds_alternative<FinishTransactionMessage>(message)) {
     const FinishTransactionMessage &msg =
         std::get<FinishTransactionMessage>(message);
-    this->handleFinishMessage(msg);
+    if (this->incremental_planner) {
+      this->incremental_planner->handleFinishMessage(msg);
+    } else {
+      this->handleFinishMessage(msg);
+    }
     return;
   }
   warn_log("メッセージが適切に処理されなかった");
@@ -45,16 +62,31 @@ bool need_refresh_message(const PlannerMessage &message) {
   return false;
 }
 
-TransactionState::TransactionState(ID transaction_id)
-    : transaction_id(transaction_id), initialized(false), future(), now(),
-      target_ranks() {}
+TransactionState::TransactionState(ID transaction_id, size_t cluster_count,
+                                   size_t rank_count)
+    : transaction_id(transaction_id), initialized(false), future(cluster_count),
+      now(cluster_count), target_ranks(rank_count, 0) {}
+
+u64 TransactionState::lowest_rank() const {
+  for (u64 rank = 0; rank < this->target_ranks.size(); ++rank) {
+    if (this->target_ranks[rank] != 0) {
+      return rank;
+    }
+  }
+  return this->target_ranks.size();
+}
+
+TransactionState PlannerManager::make_state(ID transaction_id) const {
+  return TransactionState(transaction_id, this->cluster_ranks.size(),
+                          this->rank_count);
+}
 
 void PlannerManager::handleStartMessage(
     const StartTransactionMessage &message) {
   info_log("トランザクションが登録されました %ld", message.transaction_id);
   // キューが空のときはそのまま追加する
   if (this->transaction_states.empty()) {
-    TransactionState add(message.transaction_id);
+    TransactionState add = this->make_state(message.transaction_id);
     this->transaction_states.push_back(add);
   } else {
     // そうでない場合はIDに対応する状態を追加する
@@ -62,7 +94,8 @@ void PlannerManager::handleStartMessage(
     // はIDが連番で入ることを期待しているので、順番に入れる
     while (this->transaction_states.back().transaction_id <
            message.transaction_id) {
-      TransactionState add(this->transaction_states.back().transaction_id + 1);
+      TransactionState add =
+          this->make_state(this->transaction_states.back().transaction_id + 1);
       this->transaction_states.push_back(add);
     }
   }
@@ -70,6 +103,24 @@ void PlannerManager::handleStartMessage(
 
 void PlannerManager::handleUpdateMessage(
     const UpdateTransactionMessage &message) {
+  if (this->domain_count != 0) {
+    auto itr = this->transaction_domains.find(message.transaction_id);
+    if (itr != this->transaction_domains.end()) {
+      // 単位の中ではIDの昇順に並んでいる
+      std::deque<TransactionState> &states =
+          this->domain_states[this->domains.get_parent(itr->second)];
+      auto state = std::lower_bound(
+          states.begin(), states.end(), message.transaction_id,
+          [](const TransactionState &s, ID id) -> bool {
+            return s.transaction_id < id;
+          });
+      info_log("トランザクションの状態の変更が通知されました ID: %ld",
+               message.transaction_id);
+      this->apply_update(*state, message);
+      return;
+    }
+  }
+
   if (this->transaction_states.empty()) {
     warn_log("現在アクティブなトランザクションが存在しない");
     return;
@@ -94,40 +145,43 @@ void PlannerManager::handleUpdateMessage(
   // 下記のようにランダムアクセスできる
   u64 idx = (u64)id_arg - (u64)id_min;
   TransactionState &state = this->transaction_states[idx];
+  this->apply_update(state, message);
 
+  if (this->domain_count != 0) {
+    if (not message.domains.empty()) {
+      this->pending_domains[id_arg] = message.domains;
+    }
+    this->assign_domains();
+  }
+}
+
+void PlannerManager::apply_update(TransactionState &state,
+                                  const UpdateTransactionMessage &message) {
   for (const ID id : message.future) {
-    if (state.future.count(id) == 0) {
-      state.future.insert(id);
+    if (not state.future.test(id)) {
+      state.future.set(id);
       ++state.target_ranks[this->cluster_ranks[id].value];
     }
   }
   for (const ID id : message.now) {
-    auto itr = state.future.find(id);
-    if (itr == state.future.end()) {
+    if (not state.future.test(id)) {
       warn_log(
           "事前に実行する予定と通知されていないトランザクションを更新している "
           "(transaction_id: %lu, cluster_id: %lu))",
-          id_arg, id);
+          message.transaction_id, id);
     } else {
-      state.future.erase(itr);
+      state.future.reset(id);
     }
-    state.now.insert(id);
+    state.now.set(id);
   }
   for (const ID id : message.finish) {
-    auto itr = state.now.find(id);
-    if (itr == state.now.end()) {
+    if (not state.now.test(id)) {
       warn_log("実行中と通知されていないトランザクションを終了している "
                "(transaction_id: %lu, cluster_id: %lu))",
-               id_arg, id);
+               message.transaction_id, id);
     } else {
-      state.now.erase(itr);
-      u64 rank = this->cluster_ranks[id].value;
-      auto itr = state.target_ranks.find(rank);
-      if (itr->second == 1) {
-        state.target_ranks.erase(itr);
-      } else {
-        --itr->second;
-      }
+      state.now.reset(id);
+      --state.target_ranks[this->cluster_ranks[id].value];
     }
   }
 
@@ -135,9 +189,81 @@ void PlannerManager::handleUpdateMessage(
   state.initialized = true;
 }
 
+void PlannerManager::assign_domains() {
+  while (not this->transaction_states.empty() and
+         this->transaction_states.front().initialized) {
+    TransactionState &state = this->transaction_states.front();
+    ID transaction_id = state.transaction_id;
+
+    std::vector<ID> touched;
+    auto pending = this->pending_domains.find(transaction_id);
+    if (pending != this->pending_domains.end()) {
+      touched = std::move(pending->second);
+      this->pending_domains.erase(pending);
+    }
+    // どの単位も触らないトランザクションはすぐに終わるので、どこに置いてもよい
+    ID domain = this->domains.get_parent(touched.empty() ? 0 : touched[0]);
+    for (size_t i = 1; i < touched.size(); ++i) {
+      domain = this->merge_domains(domain, touched[i]);
+    }
+
+    this->domain_states[domain].push_back(std::move(state));
+    this->transaction_domains[transaction_id] = domain;
+    this->transaction_states.pop_front();
+  }
+}
+
+ID PlannerManager::merge_domains(ID a, ID b) {
+  ID root_a = this->domains.get_parent(a);
+  ID root_b = this->domains.get_parent(b);
+  if (root_a == root_b) {
+    return root_a;
+  }
+  info_log("順序の単位を纏めます %ld, %ld", root_a, root_b);
+  this->domains.merge(root_a, root_b);
+  ID root = this->domains.get_parent(root_a);
+  ID other = root == root_a ? root_b : root_a;
+
+  std::deque<TransactionState> merged;
+  std::deque<TransactionState> &states_a = this->domain_states[root_a];
+  std::deque<TransactionState> &states_b = this->domain_states[root_b];
+  std::merge(std::make_move_iterator(states_a.begin()),
+             std::make_move_iterator(states_a.end()),
+             std::make_move_iterator(states_b.begin()),
+             std::make_move_iterator(states_b.end()),
+             std::back_inserter(merged),
+             [](const TransactionState &x, const TransactionState &y) -> bool {
+               return x.transaction_id < y.transaction_id;
+             });
+  this->domain_states[root] = std::move(merged);
+  this->domain_states[other].clear();
+  return root;
+}
+
 void PlannerManager::handleFinishMessage(
     const FinishTransactionMessage &message) {
   ID id_arg = message.transaction_id;
+  if (this->domain_count != 0) {
+    auto itr = this->transaction_domains.find(id_arg);
+    if (itr == this->transaction_domains.end()) {
+      warn_log("対応するトランザクションが存在しません (transaction_id: %lu)",
+               id_arg);
+      return;
+    }
+    // 単位の中で一番古いトランザクションであれば、他の単位を待たずに終了できる
+    std::deque<TransactionState> &states =
+        this->domain_states[this->domains.get_parent(itr->second)];
+    if (states.front().transaction_id != id_arg) {
+      warn_log("順序の単位で一番古いトランザクション以外は終了できません "
+               "(transaction_id: %lu)",
+               id_arg);
+      return;
+    }
+    info_log("トランザクションの終了が依頼されました id: %ld", id_arg);
+    states.pop_front();
+    this->transaction_domains.erase(itr);
+    return;
+  }
   if (this->transaction_states.empty()) {
     warn_log("対応するトランザクションが存在しません (transaction_id: %lu)",
              id_arg);
@@ -160,59 +286,189 @@ void PlannerManager::handleFinishMessage(
   this->transaction_states.pop_front();
 }
 
+PlanningSnapshot::PlanningSnapshot(
+    u64 version, std::vector<std::deque<TransactionState>> domain_states)
+    : version(version), domain_states(std::move(domain_states)) {}
+
+namespace {
+/**
+ * ランクの値の上限+1を求める
+ */
+size_t count_ranks(const std::vector<Rank> &cluster_ranks) {
+  size_t res = 0;
+  for (const Rank &rank : cluster_ranks) {
+    res = std::max(res, (size_t)rank.value + 1);
+  }
+  return res;
+}
+} // namespace
+
 PlannerManager::PlannerManager(std::vector<Rank> cluster_ranks,
-                               std::vector<Planner> planners)
-    : cluster_ranks(cluster_ranks), transaction_states(),
-      stop_planning_needed(false), planners(planners) {}
+                               std::vector<Planner> planners,
+                               size_t domain_count)
+    : cluster_ranks(cluster_ranks), rank_count(count_ranks(cluster_ranks)),
+      transaction_states(), domain_count(domain_count),
+      domain_states(domain_count), domains(domain_count), planners(planners),
+      snapshot(nullptr), snapshot_version(0), planners_stopped(false),
+      incremental_planner(nullptr) {
+  for (size_t i = 0; i < this->planners.size(); ++i) {
+    this->cancel_flags.push_back(std::make_unique<std::atomic_bool>(false));
+  }
+}
 
-void PlannerManager::start_planning() {
-  for (auto &planner : this->planners) {
-    std::thread t([this, &planner]() {
-      planner(this->cluster_ranks, this->transaction_states, Executor::messages,
-              this->stop_planning_needed);
-    });
-    this->running_planners.push_back(std::move(t));
+PlannerManager::PlannerManager(
+    std::vector<Rank> cluster_ranks,
+    std::unique_ptr<IncrementalRankPlanner> incremental_planner)
+    : cluster_ranks(cluster_ranks), rank_count(count_ranks(cluster_ranks)),
+      transaction_states(), domain_count(0), domain_states(), domains(0),
+      planners(),
+      snapshot(nullptr), snapshot_version(0), planners_stopped(false),
+      incremental_planner(std::move(incremental_planner)) {}
+
+PlannerManager::~PlannerManager() {}
+
+void PlannerManager::launch_planners() {
+  {
+    std::lock_guard<std::mutex> lock(this->snapshot_mtx);
+    this->planners_stopped = false;
+  }
+  for (size_t i = 0; i < this->planners.size(); ++i) {
+    this->planner_threads.push_back(
+        std::thread([this, i]() { this->planner_loop(i); }));
   }
 }
 
-void PlannerManager::stop_planning() {
-  this->stop_planning_needed.store(true);
-  for (auto &planner : this->running_planners) {
-    planner.join();
+void PlannerManager::shutdown_planners() {
+  {
+    std::lock_guard<std::mutex> lock(this->snapshot_mtx);
+    this->planners_stopped = true;
+    for (auto &flag : this->cancel_flags) {
+      flag->store(true);
+    }
+    this->snapshot_cond.notify_all();
+  }
+  for (auto &thread : this->planner_threads) {
+    thread.join();
   }
-  this->running_planners.clear();
-  this->stop_planning_needed.store(false);
+  this->planner_threads.clear();
+}
+
+void PlannerManager::planner_loop(size_t index) {
+  std::atomic_bool &cancel = *this->cancel_flags[index];
+  u64 seen_version = 0;
+  while (true) {
+    std::shared_ptr<const PlanningSnapshot> current;
+    {
+      std::unique_lock<std::mutex> lock(this->snapshot_mtx);
+      this->snapshot_cond.wait(lock, [this, seen_version] {
+        return this->planners_stopped or
+               this->snapshot_version != seen_version;
+      });
+      if (this->planners_stopped) {
+        break;
+      }
+      current = this->snapshot;
+      seen_version = current->version;
+      // 中断要求はロック下で公開と同時に立てられるので、ここで下ろしても取りこぼさない
+      cancel.store(false);
+    }
+    // 順序の単位同士は互いを待たないので、それぞれ独立に計画を建てる
+    for (const std::deque<TransactionState> &states : current->domain_states) {
+      if (cancel.load()) {
+        break;
+      }
+      this->planners[index](this->cluster_ranks, states, Executor::messages,
+                            cancel);
+    }
+  }
+}
+
+void PlannerManager::start_planning() {
+  if (this->incremental_planner) {
+    std::vector<ExecutorMessage> decisions;
+    this->incremental_planner->plan(decisions);
+    for (ExecutorMessage &msg : decisions) {
+      Executor::messages.push(std::move(msg));
+    }
+    return;
+  }
+  std::vector<std::deque<TransactionState>> domain_states;
+  if (this->domain_count == 0) {
+    domain_states.push_back(this->transaction_states);
+  } else {
+    for (const std::deque<TransactionState> &states : this->domain_states) {
+      if (not states.empty()) {
+        domain_states.push_back(states);
+      }
+    }
+  }
+  std::lock_guard<std::mutex> lock(this->snapshot_mtx);
+  ++this->snapshot_version;
+  this->snapshot = std::make_shared<const PlanningSnapshot>(
+      this->snapshot_version, std::move(domain_states));
+  for (auto &flag : this->cancel_flags) {
+    flag->store(true);
+  }
+  this->snapshot_cond.notify_all();
 }
 
 void PlannerManager::start_loop() {
+  this->launch_planners();
+  std::vector<PlannerMessage> batch;
   while (true) {
-    std::optional<PlannerMessage> omsg = PlannerManager::messages.pop();
-    if (not omsg) {
+    batch.clear();
+    // 溜まっているメッセージはまとめて反映し、再計画は一度だけにする
+    if (not PlannerManager::messages.drain(batch)) {
       break;
     }
-    bool need_refresh = need_refresh_message(*omsg);
-    if (need_refresh) {
-      this->stop_planning();
+    bool need_refresh = false;
+    for (PlannerMessage &msg : batch) {
+      if (need_refresh_message(msg)) {
+        need_refresh = true;
+      }
+      this->handleMessage(std::move(msg));
     }
-    this->handleMessage(*omsg);
     if (need_refresh) {
       this->start_planning();
     }
   }
-  this->stop_planning();
+  this->shutdown_planners();
   info_log("PlannerManagerの実行を停止します");
 }
 
-void PlannerManager::initialize(std::vector<Rank> ranks) {
+void PlannerManager::initialize(NodeManager &node_manager) {
+  std::vector<Rank> ranks = node_manager.get_cluster_ranks();
   std::vector<Planner> planners({simple_planner});
   if (use_parallel_execution) {
     // デバッグをやりやすくするため、一旦Plannerは同時に一つまでにしておく
     planners.clear();
-    planners.push_back(rank_based_planner);
+    if (parallel_planner == ParallelPlanner::Reachability) {
+      planners.push_back(
+          make_reachability_planner(node_manager.get_cluster_descendants()));
+    } else if (parallel_planner == ParallelPlanner::CriticalPath) {
+      planners.push_back(make_critical_path_planner(
+          node_manager.get_cluster_successors(),
+          node_manager.get_cluster_order(),
+          node_manager.get_cluster_cost_hints()));
+    } else {
+      planners.push_back(rank_based_planner);
+    }
+  }
+  if (use_parallel_execution and
+      parallel_planner == ParallelPlanner::IncrementalRank) {
+    if (use_ordering_domains) {
+      warn_log("IncrementalRankでは順序の単位を分けられません");
+    }
+    globalPlannerManager = new PlannerManager(
+        ranks, std::make_unique<IncrementalRankPlanner>(ranks));
+  } else {
+    size_t domain_count =
+        use_ordering_domains ? node_manager.get_domain_count() : 0;
+    globalPlannerManager = new PlannerManager(
+        ranks, std::vector<Planner>(planners), domain_count);
   }
-  globalPlannerManager =
-      new PlannerManager(ranks, std::vector<Planner>(planners));
   PlannerManager *ptr = globalPlannerManager;
+  running_threads.fetch_add(1);
   std::thread t([ptr]() -> void {
     ptr->start_loop();
     wait_threads.fetch_sub(1);
@@ -220,9 +476,9 @@ void PlannerManager::initialize(std::vector<Rank> ranks) {
   t.detach();
 }
 
-void simple_planner(std::vector<Rank> &cluster_ranks,
-                    std::deque<TransactionState> &transaction_states,
-                    ConcurrentQueue<ExecutorMessage> &executor_message_queue,
+void simple_planner(const std::vector<Rank> &cluster_ranks,
+                    const std::deque<TransactionState> &transaction_states,
+                    MpscRingQueue<ExecutorMessage> &executor_message_queue,
                     std::atomic_bool &stop) {
   (void)stop;
   // シンプルな実行計画
@@ -230,29 +486,31 @@ void simple_planner(std::vector<Rank> &cluster_ranks,
   if (transaction_states.empty()) {
     return;
   }
-  TransactionState &state = transaction_states.front();
+  const TransactionState &state = transaction_states.front();
   // 初期化されていないなら割り当てをしてはいけない
   if (not state.initialized) {
     return;
   }
-  if (state.now.empty() and state.future.empty()) {
+  if (state.now.none() and state.future.none()) {
     // 更新できるクラスタがもう無い場合は終了する
     FinalizeTransactionMessage msg;
     msg.transaction_id = state.transaction_id;
-    executor_message_queue.push(msg);
+    executor_message_queue.push(std::move(msg));
     return;
   }
-  if (state.now.empty()) {
+  if (state.now.none()) {
     // 何も実行していないなら新しく割り当てる
     // 一番ランクの値が少ないクラスタを割り当てる
-    u64 target_rank = state.target_ranks.begin()->first;
+    u64 target_rank = state.lowest_rank();
 
-    for (auto cluster_id : state.future) {
+    for (ID cluster_id = state.future.find_first();
+         cluster_id < state.future.size();
+         cluster_id = state.future.find_next(cluster_id)) {
       if (cluster_ranks[cluster_id] == target_rank) {
         StartUpdateClusterMessage msg;
         msg.transaction_id = state.transaction_id;
         msg.cluster_id = cluster_id;
-        executor_message_queue.push(msg);
+        executor_message_queue.push(std::move(msg));
         return;
       }
     }
@@ -261,18 +519,21 @@ void simple_planner(std::vector<Rank> &cluster_ranks,
   }
 }
 
-void rank_based_planner(
-    std::vector<Rank> &cluster_ranks,
-    std::deque<TransactionState> &transaction_states,
-    ConcurrentQueue<ExecutorMessage> &executor_message_queue,
-    std::atomic_bool &stop) {
-  info_log("rank_based_plannerの作業を開始します");
-
+namespace {
+/**
+ * ランクの情報から、今割り当てられるクラスタと終了できるトランザクションを集める
+ * startsには古いトランザクションから順に、クラスタIDの昇順で積まれる
+ */
+void collect_rank_based(const std::vector<Rank> &cluster_ranks,
+                        const std::deque<TransactionState> &transaction_states,
+                        std::atomic_bool &stop,
+                        std::vector<StartUpdateClusterMessage> &starts,
+                        std::vector<FinalizeTransactionMessage> &finalizes) {
   // 自分より先のトランザクションが使用しているクラスターの仲で一番低いランク
   ID target_rank = std::numeric_limits<ID>::max();
   // target_rank
   // のクラスターの中で自分より先のトランザクションが使用する可能性のあるクラスター
-  std::set<ID> used_clusters;
+  Bitset used_clusters(cluster_ranks.size());
   // 今見ているトランザクションがキューの中で一番若いか
   bool is_head = true;
 
@@ -283,24 +544,26 @@ void rank_based_planner(
 
     // 終了命令が来ていたら終了する
     if (stop.load()) {
-      info_log("rank_based_plannerの作業を外部の信号により終了します");
+      info_log("Plannerの作業を外部の信号により終了します");
       break;
     }
-    TransactionState &state = transaction_states[i];
+    const TransactionState &state = transaction_states[i];
     // トランザクションの初期化が未だである場合はそれ以降の作業を終了する
     if (not state.initialized) {
       break;
     }
 
-    for (ID now : state.now) {
+    for (ID now = state.now.find_first(); now < state.now.size();
+         now = state.now.find_next(now)) {
       u64 rank = cluster_ranks[now].value;
       if (rank < target_rank) {
         target_rank = rank;
         used_clusters.clear();
       }
-      used_clusters.insert(now);
+      used_clusters.set(now);
     }
-    for (ID future : state.future) {
+    for (ID future = state.future.find_first(); future < state.future.size();
+         future = state.future.find_next(future)) {
       u64 rank = cluster_ranks[future].value;
       if (target_rank < rank) {
         // 他のトランザクションが触るかもしれないので考えない
@@ -310,27 +573,200 @@ void rank_based_planner(
         target_rank = rank;
         used_clusters.clear();
       }
-      if (used_clusters.count(future)) {
+      if (used_clusters.test(future)) {
         // 他のトランザクションが既に触っているなら割り当てない
         continue;
       }
-      used_clusters.insert(future);
+      used_clusters.set(future);
       StartUpdateClusterMessage msg;
       msg.transaction_id = state.transaction_id;
       msg.cluster_id = future;
-      executor_message_queue.push(msg);
+      starts.push_back(msg);
     }
-    if (can_finish and state.future.empty() and state.now.empty()) {
+    if (can_finish and state.future.none() and state.now.none()) {
       FinalizeTransactionMessage msg;
       msg.transaction_id = state.transaction_id;
-      executor_message_queue.push(msg);
+      finalizes.push_back(msg);
     }
   }
+}
+} // namespace
+
+void rank_based_planner(
+    const std::vector<Rank> &cluster_ranks,
+    const std::deque<TransactionState> &transaction_states,
+    MpscRingQueue<ExecutorMessage> &executor_message_queue,
+    std::atomic_bool &stop) {
+  info_log("rank_based_plannerの作業を開始します");
+
+  std::vector<StartUpdateClusterMessage> starts;
+  std::vector<FinalizeTransactionMessage> finalizes;
+  collect_rank_based(cluster_ranks, transaction_states, stop, starts,
+                     finalizes);
+  for (StartUpdateClusterMessage &msg : starts) {
+    executor_message_queue.push(std::move(msg));
+  }
+  for (FinalizeTransactionMessage &msg : finalizes) {
+    executor_message_queue.push(std::move(msg));
+  }
 
   info_log("rank_based_plannerの作業が無くなったため終了します");
 }
 
-ConcurrentQueue<PlannerMessage> PlannerManager::messages;
+std::vector<double>
+critical_path_lengths(const std::vector<std::vector<ID>> &cluster_successors,
+                      const std::vector<ID> &cluster_order,
+                      const std::vector<double> &cluster_costs) {
+  std::vector<double> res(cluster_successors.size(), 0);
+  // 葉から順に見るので、後続の値は既に求まっている
+  for (const ID id : cluster_order) {
+    double longest = 0;
+    for (const ID succ : cluster_successors[id]) {
+      longest = std::max(longest, res[succ]);
+    }
+    res[id] = cluster_costs[id] + longest;
+  }
+  return res;
+}
+
+Planner make_critical_path_planner(
+    std::vector<std::vector<ID>> cluster_successors,
+    std::vector<ID> cluster_order, std::map<ID, u64> cluster_cost_hints) {
+  return [cluster_successors = std::move(cluster_successors),
+          cluster_order = std::move(cluster_order),
+          cluster_cost_hints = std::move(cluster_cost_hints)](
+             const std::vector<Rank> &cluster_ranks,
+             const std::deque<TransactionState> &transaction_states,
+             MpscRingQueue<ExecutorMessage> &executor_message_queue,
+             std::atomic_bool &stop) -> void {
+    info_log("critical_path_plannerの作業を開始します");
+
+    std::vector<StartUpdateClusterMessage> starts;
+    std::vector<FinalizeTransactionMessage> finalizes;
+    collect_rank_based(cluster_ranks, transaction_states, stop, starts,
+                       finalizes);
+
+    if (starts.size() >= 2) {
+      size_t size = cluster_successors.size();
+      // 計測値があればそれを、無ければ利用者の見積もりを重みにする
+      std::vector<double> costs(size, 0);
+      std::vector<bool> known(size, false);
+      double known_sum = 0;
+      u64 known_count = 0;
+      for (ID id = 0; id < size; ++id) {
+        std::optional<double> measured;
+        if (Executor::global_executor != nullptr) {
+          measured = Executor::global_executor->get_profiler().ewma_wall_ns(id);
+        }
+        auto hint = cluster_cost_hints.find(id);
+        if (measured.has_value()) {
+          costs[id] = *measured;
+        } else if (hint != cluster_cost_hints.end()) {
+          costs[id] = hint->second;
+        } else {
+          continue;
+        }
+        known[id] = true;
+        known_sum += costs[id];
+        ++known_count;
+      }
+      // どちらも無いクラスタは平均的な重さと見做す
+      double fallback = known_count == 0 ? 1 : known_sum / known_count;
+      for (ID id = 0; id < size; ++id) {
+        if (not known[id]) {
+          costs[id] = fallback;
+        }
+      }
+
+      std::vector<double> lengths =
+          critical_path_lengths(cluster_successors, cluster_order, costs);
+      // 残りの経路が長いクラスタから依頼する
+      // 同じ長さなら古いトランザクションを優先する
+      std::stable_sort(starts.begin(), starts.end(),
+                       [&lengths](const StartUpdateClusterMessage &a,
+                                  const StartUpdateClusterMessage &b) -> bool {
+                         return lengths[a.cluster_id] > lengths[b.cluster_id];
+                       });
+    }
+
+    for (StartUpdateClusterMessage &msg : starts) {
+      executor_message_queue.push(std::move(msg));
+    }
+    for (FinalizeTransactionMessage &msg : finalizes) {
+      executor_message_queue.push(std::move(msg));
+    }
+
+    info_log("critical_path_plannerの作業が無くなったため終了します");
+  };
+}
+
+Planner make_reachability_planner(std::vector<Bitset> cluster_descendants) {
+  return [cluster_descendants = std::move(cluster_descendants)](
+             const std::vector<Rank> &cluster_ranks,
+             const std::deque<TransactionState> &transaction_states,
+             MpscRingQueue<ExecutorMessage> &executor_message_queue,
+             std::atomic_bool &stop) -> void {
+    (void)cluster_ranks;
+    info_log("reachability_plannerの作業を開始します");
+
+    size_t size = cluster_descendants.size();
+    // 先のトランザクションが保持している、またはそこから到達できるクラスタ
+    Bitset blocked(size);
+    // 今見ているトランザクション自身が保持しているクラスタから到達できるクラスタ
+    Bitset reachable(size);
+    // 今見ているトランザクションに割り当てられるクラスタ
+    Bitset assignable(size);
+    bool is_head = true;
+
+    for (const TransactionState &state : transaction_states) {
+      bool can_finish = is_head;
+      is_head = false;
+
+      if (stop.load()) {
+        info_log("reachability_plannerの作業を外部の信号により終了します");
+        break;
+      }
+      if (not state.initialized) {
+        break;
+      }
+
+      reachable.clear();
+      for (ID now = state.now.find_first(); now < size;
+           now = state.now.find_next(now)) {
+        reachable |= cluster_descendants[now];
+      }
+      for (ID future = state.future.find_first(); future < size;
+           future = state.future.find_next(future)) {
+        reachable |= cluster_descendants[future];
+      }
+
+      // 自分の他のクラスタの更新を待つ必要があるか、先のトランザクションが触るかもしれないものは除く
+      assignable = state.future;
+      assignable.and_not(blocked);
+      assignable.and_not(reachable);
+      for (ID future = assignable.find_first(); future < size;
+           future = assignable.find_next(future)) {
+        StartUpdateClusterMessage msg;
+        msg.transaction_id = state.transaction_id;
+        msg.cluster_id = future;
+        executor_message_queue.push(std::move(msg));
+      }
+      if (can_finish and state.future.none() and state.now.none()) {
+        FinalizeTransactionMessage msg;
+        msg.transaction_id = state.transaction_id;
+        executor_message_queue.push(std::move(msg));
+      }
+
+      blocked |= state.now;
+      blocked |= state.future;
+      blocked |= reachable;
+    }
+
+    info_log("reachability_plannerの作業が無くなったため終了します");
+  };
+}
+
+MpscRingQueue<PlannerMessage> PlannerManager::messages;
 PlannerManager *PlannerManager::globalPlannerManager = nullptr;
 
 } // namespace prf
@@ -1,11 +1,17 @@
 #pragma once
+#include "prf/bitset.hpp"
 #include "prf/concurrent_queue.hpp"
 #include "prf/executor.hpp"
+#include "prf/planner_message.hpp"
 #include "prf/rank.hpp"
 #include "prf/types.hpp"
+#include "prf/union_find.hpp"
 #include <atomic>
+#include <condition_variable>
 #include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <thread>
 #include <variant>
@@ -30,78 +36,70 @@ public:
   bool initialized;
   /**
    * 将来更新する予定のクラスタ
+   * クラスタIDを添字にしたビット集合
    */
-  std::set<ID> future;
+  Bitset future;
   /**
    * 更新中のクラスタ
+   * クラスタIDを添字にしたビット集合
    */
-  std::set<ID> now;
+  Bitset now;
 
   /**
-   * クラスターのランクからfutureとnowに含まれている個数を引ける辞書
+   * クラスターのランクを添字にして、futureとnowに含まれている個数を引ける表
    */
-  std::map<u64, u64> target_ranks;
+  std::vector<u64> target_ranks;
 
-  TransactionState(ID transaction_id);
-};
-
-/**
- * トランザクションの状態が変わったことを報せる
- */
-class UpdateTransactionMessage {
-public:
-  ID transaction_id;
   /**
-   * 更新を開始した
+   * cluster_countはクラスタの数、rank_countはランクの値の上限+1
    */
-  std::vector<ID> now;
-  /**
-   * 将来的に更新するものの追加
-   */
-  std::vector<ID> future;
+  TransactionState(ID transaction_id, size_t cluster_count, size_t rank_count);
+
   /**
-   * 更新が終了した
+   * futureとnowに含まれるクラスタの中で一番低いランクの値を返す
+   * 一つも無ければtarget_ranks.size()を返す
    */
-  std::vector<ID> finish;
+  u64 lowest_rank() const;
 };
 
 /**
- * トランザクションの更新が終了した
+ * メッセージがPlannerの再実行を必要とするものかを判定する
  */
-class FinishTransactionMessage {
-public:
-  /**
-   * 更新が終了したトランザクションのID
-   */
-  ID transaction_id;
-};
+bool need_refresh_message(const PlannerMessage &message);
 
 /**
- * 新しくトランザクションが発生した
+ * 実行計画を建てる関数
+ * 渡される状態はある時点での複製であり、Planner同士やPlannerManagerとは共有されない
+ * 最後の引数がtrueになった場合、より新しい状態が用意されているので早めに作業を打ち切るべきである
  */
-class StartTransactionMessage {
+using Planner = std::function<void(
+    const std::vector<Rank> &, const std::deque<TransactionState> &,
+    MpscRingQueue<ExecutorMessage> &, std::atomic_bool &)>;
+
+/**
+ * Plannerに渡すトランザクションの状態の複製
+ * 一度公開されたら書き換えられないので、Plannerはロックを取らずに読むことができる
+ */
+class PlanningSnapshot {
 public:
   /**
-   * 新しいトランザクションのID
+   * 公開される度に増える番号
    */
-  ID transaction_id;
-};
+  u64 version;
 
-using PlannerMessage =
-    std::variant<StartTransactionMessage, UpdateTransactionMessage,
-                 FinishTransactionMessage>;
+  /**
+   * 順序の単位毎のトランザクションの状態
+   * Plannerはそれぞれについて独立に計画を建てる
+   * 順序の単位を分けない場合は一つだけになる
+   */
+  std::vector<std::deque<TransactionState>> domain_states;
 
-/**
- * メッセージがPlannerの再実行を必要とするものかを判定する
- */
-bool need_refresh_message(const PlannerMessage &message);
+  PlanningSnapshot(u64 version,
+                   std::vector<std::deque<TransactionState>> domain_states);
+};
 
-/**
- * 実行計画を建てる関数
- */
-using Planner =
-    std::function<void(std::vector<Rank> &, std::deque<TransactionState> &,
-                       ConcurrentQueue<ExecutorMessage> &, std::atomic_bool &)>;
+class IncrementalRankPlanner;
+class NodeManager;
 
 /**
  * 実行計画を建てるPlannerを管理するクラス
@@ -118,18 +116,45 @@ private:
    */
   std::vector<Rank> cluster_ranks;
 
+  /**
+   * ランクの値の上限+1
+   * TransactionStateのtarget_ranksの大きさになる
+   */
+  size_t rank_count;
+
   /**
    * 更新中のトランザクションの状態を保持する
    * dequeのfrontから順に古いトランザクションの状態が格納されている。
+   * 順序の単位を分ける場合は、触る単位がまだ確定していないトランザクションだけが残る
    */
   std::deque<TransactionState> transaction_states;
 
   /**
-   * 現在バックグラウンドで稼動しているPlanner
+   * 順序の単位の数
+   * 0なら順序の単位を分けず、transaction_statesだけで計画を建てる
+   */
+  size_t domain_count;
+
+  /**
+   * 順序の単位毎の、触る単位が確定したトランザクションの状態
+   * 纏められた単位の状態は、代表の単位に集められる
+   */
+  std::vector<std::deque<TransactionState>> domain_states;
+
+  /**
+   * 纏められた順序の単位
+   */
+  UnionFind domains;
+
+  /**
+   * 触る単位が確定したトランザクションが置かれた単位
    */
-  std::vector<std::thread> running_planners;
+  std::map<ID, ID> transaction_domains;
 
-  std::atomic_bool stop_planning_needed;
+  /**
+   * 触る単位がまだ確定していないトランザクションについて、通知された単位
+   */
+  std::map<ID, std::vector<ID>> pending_domains;
 
   /**
    * 実行計画を建てる関数の列
@@ -137,6 +162,34 @@ private:
    */
   std::vector<Planner> planners;
 
+  /**
+   * Plannerそれぞれを動かし続けるスレッド
+   * PlannerManagerが動いている間は生存し、新しい状態が公開される度に計画を建て直す
+   */
+  std::vector<std::thread> planner_threads;
+
+  /**
+   * Plannerそれぞれの作業の中断要求
+   * 新しい状態が公開されたときに立てられる
+   */
+  std::vector<std::unique_ptr<std::atomic_bool>> cancel_flags;
+
+  /**
+   * 最後に公開された状態
+   * snapshot_mtxで保護する
+   */
+  std::shared_ptr<const PlanningSnapshot> snapshot;
+  u64 snapshot_version;
+  bool planners_stopped;
+  std::mutex snapshot_mtx;
+  std::condition_variable snapshot_cond;
+
+  /**
+   * 差分で状態を更新するPlanner
+   * これが設定されている場合はスナップショットを作らず、このスレッドで直接計画を建てる
+   */
+  std::unique_ptr<IncrementalRankPlanner> incremental_planner;
+
   /**
    * メッセージそれぞれをハンドリングするメソッド
    */
@@ -145,13 +198,52 @@ private:
   void handleFinishMessage(const FinishTransactionMessage &);
 
   /**
-   * Plannerの実行を止める
+   * 通知された状態の変化をトランザクションの状態に反映する
+   */
+  void apply_update(TransactionState &, const UpdateTransactionMessage &);
+
+  /**
+   * 触る単位が確定したトランザクションを、古いものから順に単位毎の状態へ移す
+   * 前のトランザクションが確定するまでは、後のトランザクションも移さない
+   */
+  void assign_domains();
+
+  /**
+   * 二つの順序の単位を纏め、代表の単位を返す
+   * それぞれのトランザクションはIDの順に並べ直される
+   */
+  ID merge_domains(ID, ID);
+
+  /**
+   * 空のトランザクションの状態を作る
+   */
+  TransactionState make_state(ID transaction_id) const;
+
+  /**
+   * Plannerのスレッドを起動する
    */
-  void stop_planning();
+  void launch_planners();
+
+  /**
+   * Plannerのスレッドを停止して合流する
+   */
+  void shutdown_planners();
+
+  /**
+   * Plannerのスレッドで動かし続けるループ
+   * 新しい状態が公開されるのを待ち、公開されたらそれを元に計画を建てる
+   */
+  void planner_loop(size_t index);
 
 public:
+  /**
+   * domain_countが0でなければ、順序の単位毎にトランザクションの順序を分ける
+   */
+  PlannerManager(std::vector<Rank> cluster_ranks,
+                 std::vector<Planner> planners, size_t domain_count = 0);
   PlannerManager(std::vector<Rank> cluster_ranks,
-                 std::vector<Planner> planners);
+                 std::unique_ptr<IncrementalRankPlanner> incremental_planner);
+  ~PlannerManager();
 
   /**
    * メッセージキューへ来たメッセージを処理する
@@ -159,7 +251,8 @@ public:
   void handleMessage(PlannerMessage);
 
   /**
-   * 現在の状態から実行計画を建て初める
+   * 現在の状態の複製を公開してPlannerに計画を建て直させる
+   * 古い状態で作業中のPlannerには中断を要求する
    */
   void start_planning();
 
@@ -170,10 +263,11 @@ public:
 
   /**
    * globalPlannerManagerを初期化する
+   * Plannerが使うクラスタ間の依存関係はビルド済みのnode_managerから取り出す
    */
-  static void initialize(std::vector<Rank> ranks);
+  static void initialize(NodeManager &node_manager);
 
-  static ConcurrentQueue<PlannerMessage> messages;
+  static MpscRingQueue<PlannerMessage> messages;
 
   static PlannerManager *globalPlannerManager;
 };
@@ -181,17 +275,43 @@ public:
 /**
  * 逐次実行だけできるPlanner
  */
-void simple_planner(std::vector<Rank> &cluster_ranks,
-                    std::deque<TransactionState> &transaction_states,
-                    ConcurrentQueue<ExecutorMessage> &executor_message_queue,
+void simple_planner(const std::vector<Rank> &cluster_ranks,
+                    const std::deque<TransactionState> &transaction_states,
+                    MpscRingQueue<ExecutorMessage> &executor_message_queue,
                     std::atomic_bool &stop);
 
 /**
  * ランクの情報から並列に動作するよう更新依頼を作るPlanner
  */
 void rank_based_planner(
-    std::vector<Rank> &cluster_ranks,
-    std::deque<TransactionState> &transaction_states,
-    ConcurrentQueue<ExecutorMessage> &executor_message_queue,
+    const std::vector<Rank> &cluster_ranks,
+    const std::deque<TransactionState> &transaction_states,
+    MpscRingQueue<ExecutorMessage> &executor_message_queue,
     std::atomic_bool &stop);
+
+/**
+ * クラスタ間の到達可能性から更新依頼を作るPlannerを生成する
+ * 先のトランザクションが保持しているクラスタから到達できないクラスタであれば、
+ * ランクに関わらず後のトランザクションに割り当てる
+ */
+Planner make_reachability_planner(std::vector<Bitset> cluster_descendants);
+
+/**
+ * クラスタから葉までの経路のうち、重みの和が最大のものの長さをクラスタ毎に求める
+ * cluster_orderは後続より後に現れないようにクラスタを並べたもの
+ */
+std::vector<double>
+critical_path_lengths(const std::vector<std::vector<ID>> &cluster_successors,
+                      const std::vector<ID> &cluster_order,
+                      const std::vector<double> &cluster_costs);
+
+/**
+ * 残りの仕事が多いクラスタから更新を依頼するPlannerを生成する
+ * 割り当てるクラスタはrank_based_plannerと同じだが、
+ * 葉までの重み付きの最長経路が長いクラスタから順に依頼する。
+ * 重みにはクラスタの更新時間の計測値を使い、計測が無ければcluster_cost_hintsの見積もりを使う
+ */
+Planner make_critical_path_planner(
+    std::vector<std::vector<ID>> cluster_successors,
+    std::vector<ID> cluster_order, std::map<ID, u64> cluster_cost_hints);
 } // namespace prf
@@ -0,0 +1,57 @@
+#pragma once
+#include "prf/types.hpp"
+#include <variant>
+#include <vector>
+
+namespace prf {
+/**
+ * トランザクションの状態が変わったことを報せる
+ */
+class UpdateTransactionMessage {
+public:
+  ID transaction_id;
+  /**
+   * 更新を開始した
+   */
+  std::vector<ID> now;
+  /**
+   * 将来的に更新するものの追加
+   */
+  std::vector<ID> future;
+  /**
+   * 更新が終了した
+   */
+  std::vector<ID> finish;
+  /**
+   * トランザクションが触る順序の単位
+   * 順序の単位を分ける場合に、トランザクションの更新の開始時にのみ設定する
+   */
+  std::vector<ID> domains;
+};
+
+/**
+ * トランザクションの更新が終了した
+ */
+class FinishTransactionMessage {
+public:
+  /**
+   * 更新が終了したトランザクションのID
+   */
+  ID transaction_id;
+};
+
+/**
+ * 新しくトランザクションが発生した
+ */
+class StartTransactionMessage {
+public:
+  /**
+   * 新しいトランザクションのID
+   */
+  ID transaction_id;
+};
+
+using PlannerMessage =
+    std::variant<StartTransactionMessage, UpdateTransactionMessage,
+                 FinishTransactionMessage>;
+} // namespace prf
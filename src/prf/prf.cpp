@@ -1,17 +1,31 @@
 #include "prf/prf.hpp"
 
 #include "prf/executor.hpp"
+#include "prf/incremental_planner.hpp"
 #include "prf/node.hpp"
 #include "prf/planner.hpp"
 #include "prf/rank.hpp"
+#include "prf/transaction.hpp"
 
 namespace prf {
 void build() {
   NodeManager::globalNodeManager->build();
   std::vector<Rank> ranks = NodeManager::globalNodeManager->get_cluster_ranks();
 
-  PlannerManager::initialize(ranks);
-  Executor::initialize(NodeManager::globalNodeManager->get_cluster_names());
+  if (use_parallel_execution and use_dataflow_scheduler) {
+    // クラスタ間の依存関係から直接更新を進めるので、Plannerは使わない
+    Executor::initialize(NodeManager::globalNodeManager->get_cluster_names(),
+                         nullptr, true);
+  } else if (use_parallel_execution and use_unified_scheduler) {
+    // ExecutorがPlannerを兼ねるので、PlannerManagerは起動しない
+    Executor::initialize(NodeManager::globalNodeManager->get_cluster_names(),
+                         std::make_unique<IncrementalRankPlanner>(ranks),
+                         false);
+  } else {
+    PlannerManager::initialize(*NodeManager::globalNodeManager);
+    Executor::initialize(NodeManager::globalNodeManager->get_cluster_names(),
+                         nullptr, false);
+  }
 }
 
 /**
@@ -28,8 +42,21 @@ void initialize() {
   }
   while (Executor::messages.try_pop()) {
   }
+  transaction_window.reset();
 }
 
 volatile bool use_parallel_execution = false;
 
+volatile ParallelPlanner parallel_planner = ParallelPlanner::RankBased;
+
+volatile bool use_unified_scheduler = false;
+
+volatile bool use_dataflow_scheduler = false;
+
+volatile u64 max_inflight_transactions = 0;
+
+volatile bool use_pipelined_listeners = false;
+
+volatile bool use_ordering_domains = false;
+
 } // namespace prf
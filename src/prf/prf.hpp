@@ -1,5 +1,8 @@
 #pragma once
 
+#include "prf/thread.hpp"
+#include "prf/types.hpp"
+
 namespace prf {
 /**
  * FRPの実行の準備を終える
@@ -17,4 +20,79 @@ void initialize();
  */
 extern volatile bool use_parallel_execution;
 
+/**
+ * 並列動作するときに実行計画を建てるPlannerの種類
+ */
+enum class ParallelPlanner {
+  /**
+   * 状態が変わる度に全てのトランザクションを走査するPlanner
+   */
+  RankBased,
+  /**
+   * 変化したクラスタの分だけ状態を更新するPlanner
+   * 多くのトランザクションが同時に存在する場合に向いている
+   */
+  IncrementalRank,
+  /**
+   * クラスタ間の到達可能性を元に、ランクが同じでも独立な枝は並列に更新するPlanner
+   */
+  Reachability,
+  /**
+   * RankBasedと同じクラスタを割り当てるが、葉までの重み付きの最長経路が長いクラスタから順に依頼するPlanner
+   * 重みには計測したクラスタの更新時間か、Clusterに渡した見積もりを使う
+   */
+  CriticalPath,
+};
+
+/**
+ * 並列動作するときに使うPlanner
+ * build関数の実行前にセットしてください
+ */
+extern volatile ParallelPlanner parallel_planner;
+
+/**
+ * 並列動作するときに、ExecutorがPlannerを兼ねるか否か
+ * スレッド間のメッセージの往復が減るので、更新が短いクラスタが多い場合に向いている
+ * 有効な場合、parallel_plannerに関わらずIncrementalRankを使う
+ * build関数の実行前にセットしてください
+ */
+extern volatile bool use_unified_scheduler;
+
+/**
+ * 並列動作するときに、Plannerを使わずクラスタ間の依存関係から直接更新を進めるか否か
+ * クラスタの更新を終えたスレッドが後続のクラスタを解決するので、Plannerが律速にならない
+ * use_unified_schedulerより優先される
+ * build関数の実行前にセットしてください
+ */
+extern volatile bool use_dataflow_scheduler;
+
+/**
+ * 同時に存在できるトランザクションの数の上限
+ * 上限に達している間は、新しくトランザクションを作ろうとしたスレッドがブロッキングされる
+ * ブロッキングしたくない場合はTransaction(std::try_to_lock)やtry_sendを使う
+ * 0なら制限しない
+ */
+extern volatile u64 max_inflight_transactions;
+
+/**
+ * FRPの外でlistenしている関数を、Executorのスレッドではなくスレッドプールで呼び出すか否か
+ * 一つのlistenerはトランザクションの順に呼び出されるが、異なるlistenerは並列に呼び出されるので、
+ * 複数のlistenerで同じ変数を書き換える場合は排他制御が必要になる
+ * 遅いlistenerがあってもExecutorは次のトランザクションの処理を進められる
+ * トランザクションの終了を待つ処理は、そのトランザクションのlistenerの呼び出しが全て終わるまで待つ
+ * build関数の実行前にセットしてください
+ */
+extern volatile bool use_pipelined_listeners;
+
+/**
+ * 依存グラフの弱連結成分毎に、トランザクションの順序を分けるか否か
+ * 有効な場合、無関係な部分グラフを触るトランザクション同士は互いの終了を待たない
+ * listenerが呼び出される順序は、同じ連結成分を触るトランザクションの間でのみ保証される
+ * 一つのトランザクションが複数の連結成分を触った場合、それ以降それらの連結成分は同じ順序に纏められる
+ * PlannerManagerが計画を建てる場合にのみ有効で、
+ * parallel_plannerがIncrementalRankの場合やuse_unified_scheduler、use_dataflow_schedulerとは併用できない
+ * build関数の実行前にセットしてください
+ */
+extern volatile bool use_ordering_domains;
+
 } // namespace prf
@@ -0,0 +1,160 @@
+#include "prf/profiler.hpp"
+#include "prf/executor.hpp"
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+
+namespace prf {
+
+namespace {
+u64 thread_cpu_now_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (u64)ts.tv_sec * 1000000000 + (u64)ts.tv_nsec;
+}
+
+u64 wall_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * 昇順に並んだ列から百分位を取り出す
+ */
+u64 percentile(const std::vector<u64> &sorted, u64 percent) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t idx = (sorted.size() - 1) * percent / 100;
+  return sorted[idx];
+}
+} // namespace
+
+ClusterProfile::ClusterProfile()
+    : count(0), ewma_wall_ns(0), ewma_cpu_ns(0), p50_wall_ns(0),
+      p90_wall_ns(0), p99_wall_ns(0), max_wall_ns(0) {}
+
+ClusterProfiler::Stats::Stats()
+    : count(0), ewma_wall_ns(0), ewma_cpu_ns(0), max_wall_ns(0),
+      recent_wall_ns(), next_slot(0) {}
+
+ClusterProfiler::ClusterProfiler(size_t cluster_count,
+                                 std::map<ID, std::string> cluster_names)
+    : stats(), cluster_names(cluster_names) {
+  for (size_t i = 0; i < cluster_count; ++i) {
+    this->stats.push_back(std::make_unique<Stats>());
+  }
+}
+
+void ClusterProfiler::record(ID cluster_id, u64 wall_ns, u64 cpu_ns) {
+  if (cluster_id >= this->stats.size()) {
+    return;
+  }
+  Stats &s = *this->stats[cluster_id];
+  std::lock_guard<std::mutex> lock(s.mtx);
+  if (s.count == 0) {
+    // 最初の計測はそのまま平均とする
+    s.ewma_wall_ns = wall_ns;
+    s.ewma_cpu_ns = cpu_ns;
+  } else {
+    s.ewma_wall_ns += EWMA_ALPHA * ((double)wall_ns - s.ewma_wall_ns);
+    s.ewma_cpu_ns += EWMA_ALPHA * ((double)cpu_ns - s.ewma_cpu_ns);
+  }
+  ++s.count;
+  s.max_wall_ns = std::max(s.max_wall_ns, wall_ns);
+
+  if (s.recent_wall_ns.size() < WINDOW) {
+    s.recent_wall_ns.push_back(wall_ns);
+  } else {
+    s.recent_wall_ns[s.next_slot] = wall_ns;
+    s.next_slot = (s.next_slot + 1) % WINDOW;
+  }
+}
+
+ClusterProfile ClusterProfiler::profile(ID cluster_id) {
+  ClusterProfile res;
+  if (cluster_id >= this->stats.size()) {
+    return res;
+  }
+  std::vector<u64> sorted;
+  {
+    Stats &s = *this->stats[cluster_id];
+    std::lock_guard<std::mutex> lock(s.mtx);
+    res.count = s.count;
+    res.ewma_wall_ns = s.ewma_wall_ns;
+    res.ewma_cpu_ns = s.ewma_cpu_ns;
+    res.max_wall_ns = s.max_wall_ns;
+    sorted = s.recent_wall_ns;
+  }
+  // ソートはロックの外で行なう
+  std::sort(sorted.begin(), sorted.end());
+  res.p50_wall_ns = percentile(sorted, 50);
+  res.p90_wall_ns = percentile(sorted, 90);
+  res.p99_wall_ns = percentile(sorted, 99);
+  return res;
+}
+
+std::optional<double> ClusterProfiler::ewma_wall_ns(ID cluster_id) {
+  if (cluster_id >= this->stats.size()) {
+    return std::nullopt;
+  }
+  Stats &s = *this->stats[cluster_id];
+  std::lock_guard<std::mutex> lock(s.mtx);
+  if (s.count == 0) {
+    return std::nullopt;
+  }
+  return s.ewma_wall_ns;
+}
+
+std::optional<ClusterProfile>
+ClusterProfiler::profile(const std::string &name) {
+  for (const auto &[id, cluster_name] : this->cluster_names) {
+    if (cluster_name == name) {
+      return this->profile(id);
+    }
+  }
+  return std::nullopt;
+}
+
+std::map<std::string, ClusterProfile> ClusterProfiler::profiles() {
+  std::map<std::string, ClusterProfile> res;
+  for (const auto &[id, name] : this->cluster_names) {
+    // 名前の無いクラスタは全て同じ名前になり区別できないので含めない
+    if (name == "NO_NAME") {
+      continue;
+    }
+    // IDの昇順に見るので、同じ名前なら先に入れたものを残す
+    if (res.count(name) == 0) {
+      res.emplace(name, this->profile(id));
+    }
+  }
+  return res;
+}
+
+ProfileTimer::ProfileTimer()
+    : wall_start(wall_now_ns()), cpu_start(thread_cpu_now_ns()) {}
+
+u64 ProfileTimer::elapsed_wall_ns() const {
+  return wall_now_ns() - this->wall_start;
+}
+
+u64 ProfileTimer::elapsed_cpu_ns() const {
+  return thread_cpu_now_ns() - this->cpu_start;
+}
+
+std::optional<ClusterProfile> get_cluster_profile(const std::string &name) {
+  if (Executor::global_executor == nullptr) {
+    return std::nullopt;
+  }
+  return Executor::global_executor->get_profiler().profile(name);
+}
+
+std::map<std::string, ClusterProfile> get_cluster_profiles() {
+  if (Executor::global_executor == nullptr) {
+    return std::map<std::string, ClusterProfile>();
+  }
+  return Executor::global_executor->get_profiler().profiles();
+}
+
+} // namespace prf
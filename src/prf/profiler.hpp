@@ -0,0 +1,155 @@
+#pragma once
+#include "prf/types.hpp"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace prf {
+
+/**
+ * クラスタ一つ分の更新にかかった時間の統計
+ * 時間の単位は全てナノ秒
+ */
+class ClusterProfile {
+public:
+  /**
+   * 計測した更新の回数
+   */
+  u64 count;
+
+  /**
+   * 経過時間の指数移動平均
+   */
+  double ewma_wall_ns;
+  /**
+   * 更新したスレッドが消費したCPU時間の指数移動平均
+   * 経過時間より大きく下回る場合、更新中にブロッキングしている
+   */
+  double ewma_cpu_ns;
+
+  /**
+   * 直近の更新の経過時間の百分位
+   */
+  u64 p50_wall_ns;
+  u64 p90_wall_ns;
+  u64 p99_wall_ns;
+
+  /**
+   * これまでで一番長かった経過時間
+   */
+  u64 max_wall_ns;
+
+  ClusterProfile();
+};
+
+/**
+ * クラスタの更新時間を計測した結果を集めるクラス
+ * 計測はワーカーのスレッドから並行して記録される
+ */
+class ClusterProfiler {
+private:
+  /**
+   * クラスタ毎の計測結果
+   */
+  class Stats {
+  public:
+    u64 count;
+    double ewma_wall_ns;
+    double ewma_cpu_ns;
+    u64 max_wall_ns;
+
+    /**
+     * 百分位を求めるための直近の経過時間
+     * WINDOW個を超えたら古いものから上書きする
+     */
+    std::vector<u64> recent_wall_ns;
+    size_t next_slot;
+
+    std::mutex mtx;
+
+    Stats();
+  };
+
+  std::vector<std::unique_ptr<Stats>> stats;
+
+  /**
+   * Cluster(std::string)で登録されたクラスタの名前
+   */
+  std::map<ID, std::string> cluster_names;
+
+public:
+  /**
+   * 指数移動平均で新しい計測に掛ける重み
+   */
+  static constexpr double EWMA_ALPHA = 0.2;
+
+  /**
+   * 百分位の計算に使う直近の計測の数
+   */
+  static constexpr size_t WINDOW = 256;
+
+  ClusterProfiler(size_t cluster_count, std::map<ID, std::string> cluster_names);
+
+  /**
+   * クラスタの更新一回分の計測を記録する
+   */
+  void record(ID cluster_id, u64 wall_ns, u64 cpu_ns);
+
+  /**
+   * クラスタの統計を返す
+   */
+  ClusterProfile profile(ID cluster_id);
+
+  /**
+   * クラスタの経過時間の指数移動平均だけを返す
+   * 一度も計測していなければstd::nulloptを返す
+   */
+  std::optional<double> ewma_wall_ns(ID cluster_id);
+
+  /**
+   * 名前の付いたクラスタの統計を返す
+   * 同じ名前のクラスタが複数ある場合はIDが小さいものを返す
+   */
+  std::optional<ClusterProfile> profile(const std::string &name);
+
+  /**
+   * 名前の付いた全てのクラスタの統計を返す
+   * 名前を付けずに作ったクラスタ(NO_NAME)は含めない
+   */
+  std::map<std::string, ClusterProfile> profiles();
+};
+
+/**
+ * 区間の経過時間とスレッドのCPU時間を計測するタイマー
+ * 経過時間は単調増加する時計で測る
+ */
+class ProfileTimer {
+private:
+  u64 wall_start;
+  u64 cpu_start;
+
+public:
+  /**
+   * 生成した時点から計測を始める
+   */
+  ProfileTimer();
+
+  u64 elapsed_wall_ns() const;
+  u64 elapsed_cpu_ns() const;
+};
+
+/**
+ * 名前を付けたクラスタの更新時間の統計を返す
+ * build前や、その名前のクラスタが無い場合はstd::nulloptを返す
+ */
+std::optional<ClusterProfile> get_cluster_profile(const std::string &name);
+
+/**
+ * 名前を付けた全てのクラスタの更新時間の統計を返す
+ */
+std::map<std::string, ClusterProfile> get_cluster_profiles();
+
+} // namespace prf
@@ -0,0 +1,130 @@
+#pragma once
+#include "prf/types.hpp"
+#include "prf/value_pool.hpp"
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+namespace prf {
+
+/**
+ * トランザクションIDをキーに値を保持する入れ物
+ *
+ * 同時に存在するトランザクションのIDは連続した狭い範囲に収まるので、
+ * transaction_id % CAPACITY 番目の枠に値を置き、ロックを取らずに読み書きする。
+ * 枠が別のトランザクションに使われていた場合だけ、ロックで保護したmapに置く。
+ * max_inflight_transactionsがCAPACITY以下なら、mapが使われることは無い。
+ * 値はValueRefで持つので、小さな型は枠の中にそのまま置かれる。
+ *
+ * 一つのキーへの書き込みと読み込み、破棄は、トランザクションの流れによって前後関係が付いていることを前提とする
+ * 書き込み同士、書き込みと破棄が別々のキーで同時に起きることは構わない
+ */
+template <class T> class SlotRing {
+public:
+  static constexpr u64 CAPACITY = 64;
+
+private:
+  /**
+   * 枠を使っているトランザクションのID+1
+   * 空なら0、書き込み中ならBUSY
+   */
+  static constexpr u64 EMPTY = 0;
+  static constexpr u64 BUSY = ~(u64)0;
+
+  struct Slot {
+    std::atomic<u64> tag;
+    ValueRef<T> value;
+
+    Slot() : tag(EMPTY), value(nullptr) {}
+  };
+
+  std::array<Slot, CAPACITY> slots;
+
+  /**
+   * 枠に置けなかった値
+   */
+  std::map<ID, ValueRef<T>> overflow;
+  std::atomic<u64> overflow_count;
+  std::mutex overflow_mtx;
+
+  /**
+   * 枠に置いた値と同じトランザクションの値がmapに残っていれば消す
+   * 前のsendで枠が塞がっていて、その後に空いた枠へ上書きした場合に起きる
+   */
+  void drop_overflow(ID transaction_id) {
+    if (this->overflow_count.load() == 0) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(this->overflow_mtx);
+    if (this->overflow.erase(transaction_id) != 0) {
+      this->overflow_count.fetch_sub(1);
+    }
+  }
+
+public:
+  SlotRing(const SlotRing &) = delete;
+  SlotRing &operator=(const SlotRing &) = delete;
+
+  SlotRing() : overflow_count(0) {}
+
+  void set(ID transaction_id, ValueRef<T> value) {
+    Slot &slot = this->slots[transaction_id % CAPACITY];
+    u64 tag = transaction_id + 1;
+    u64 current = slot.tag.load(std::memory_order_acquire);
+    if (current == tag) {
+      // 同じトランザクションでの上書きは、まだ誰も読んでいない
+      slot.value = std::move(value);
+      this->drop_overflow(transaction_id);
+      return;
+    }
+    if (current == EMPTY and
+        slot.tag.compare_exchange_strong(current, BUSY,
+                                         std::memory_order_acquire)) {
+      slot.value = std::move(value);
+      slot.tag.store(tag, std::memory_order_release);
+      this->drop_overflow(transaction_id);
+      return;
+    }
+    std::lock_guard<std::mutex> lock(this->overflow_mtx);
+    if (this->overflow.count(transaction_id) == 0) {
+      this->overflow_count.fetch_add(1);
+    }
+    this->overflow[transaction_id] = std::move(value);
+  }
+
+  std::optional<ValueRef<T>> get(ID transaction_id) {
+    Slot &slot = this->slots[transaction_id % CAPACITY];
+    if (slot.tag.load(std::memory_order_acquire) == transaction_id + 1) {
+      return slot.value;
+    }
+    if (this->overflow_count.load() == 0) {
+      return std::nullopt;
+    }
+    std::lock_guard<std::mutex> lock(this->overflow_mtx);
+    auto itr = this->overflow.find(transaction_id);
+    if (itr == this->overflow.end()) {
+      return std::nullopt;
+    }
+    return itr->second;
+  }
+
+  void erase(ID transaction_id) {
+    Slot &slot = this->slots[transaction_id % CAPACITY];
+    if (slot.tag.load(std::memory_order_acquire) == transaction_id + 1) {
+      slot.value.reset();
+      slot.tag.store(EMPTY, std::memory_order_release);
+      return;
+    }
+    if (this->overflow_count.load() == 0) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(this->overflow_mtx);
+    if (this->overflow.erase(transaction_id) != 0) {
+      this->overflow_count.fetch_sub(1);
+    }
+  }
+};
+} // namespace prf
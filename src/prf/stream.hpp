@@ -3,9 +3,12 @@
 #include "prf/cell.hpp"
 #include "prf/cluster.hpp"
 #include "prf/logger.hpp"
+#include "prf/slot_ring.hpp"
 #include "prf/time_invariant_values.hpp"
 #include "prf/transaction.hpp"
+#include "prf/value_pool.hpp"
 #include <functional>
+#include <future>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -17,54 +20,99 @@ namespace prf {
 // Stream系列が内部で保持する
 template <class T> class StreamInternal : public TimeInvariantValues {
 private:
-  // トランザクションIDに対応する値を保存する
-  std::map<ID, std::shared_ptr<T>> values;
+  // valuesに置く値の確保に使う
+  // そのまま持てる型(is_inline_value_v)では使わない
+  // valuesより後に破棄されるよう先に宣言する
+  ValuePool value_pool;
 
-  // values自体の排他ロックのためにある
-  // values[x]
-  // が返す個々の参照自体には排他ロックが存在しないので、それを前提とした設計をする必要がある
-  std::mutex mtx;
+  // トランザクションIDに対応する値を保存する
+  // 個々の値の読み書きの順序はトランザクションの流れが保証する
+  SlotRing<T> values;
 
   std::function<std::optional<T>(ID transaction_id)> updater;
 
+  /**
+   * 上流の値をコピーせずにそのまま自分の値とする場合にupdaterの代わりに使う
+   * 値が無い場合はnullptrを返す
+   */
+  std::function<ValueRef<T>(ID transaction_id)> forwarder;
+
   /**
    * 時変値の変化をFRPの外でlistenしている関数のリスト
    */
-  std::vector<std::function<void(std::shared_ptr<T>)>> listeners;
+  std::vector<std::function<void(ValueRef<T>)>> listeners;
+
+  /**
+   * listenersと同じ順に並べた、listener毎の呼び出しのキュー
+   */
+  std::vector<std::unique_ptr<ListenerQueue>> listener_queues;
+
+  /**
+   * FRPの外でlistenしている関数のうち、トランザクションの順序を問わないもののリスト
+   */
+  std::vector<std::function<void(ValueRef<T>)>> unordered_listeners;
+
+  // transactionに対応する時刻に既にある値を登録する
+  void send_shared(ValueRef<T> value, InnerTransaction *transaction);
 
 public:
-  StreamInternal<T>(ID cluster_id,
-                    std::function<std::optional<T>(ID transaction_id)> updater);
+  StreamInternal(ID cluster_id,
+                 std::function<std::optional<T>(ID transaction_id)> updater);
+
+  StreamInternal(ID cluster_id);
+
+  /**
+   * updaterの代わりにforwarderで値を決めるようにする
+   * filterのように上流の値をそのまま流すStreamで、値のコピーを避けるために使う
+   */
+  void forward(std::function<ValueRef<T>(ID transaction_id)> forwarder);
 
-  StreamInternal<T>(ID cluster_id);
   /**
    * トランザクションに対応する値を取得する
    * 存在しなかった場合は std::nullopt を返す
    */
-  std::optional<std::shared_ptr<T>> sample(ID transaction_id);
+  std::optional<ValueRef<T>> sample(ID transaction_id);
 
   /**
    * sample() と違いその論理時刻に値が存在することが保証される場合に呼び出す
    * 無い時はエラーで終了する
    */
-  std::shared_ptr<T> unsafeSample(ID transaction_id);
+  ValueRef<T> unsafeSample(ID transaction_id);
 
   /**
    * FRPの外からlistenする
    */
-  void listenFromOuter(std::function<void(std::shared_ptr<T>)>);
+  void listenFromOuter(std::function<void(ValueRef<T>)>);
+
+  /**
+   * FRPの外から、トランザクションの順序を問わずにlistenする
+   */
+  void listenUnorderedFromOuter(std::function<void(ValueRef<T>)>);
 
   // transactionに対応する時刻にvalueを登録する
   void send(T value, InnerTransaction *transaction);
 
   void send(T value);
 
+  /**
+   * 新しくトランザクションを作る必要があり、その数が上限に達している場合は送らずにfalseを返す
+   */
+  bool try_send(T value);
+
+  /**
+   * 新しいトランザクションで値を送り、更新の終了を待たずに戻る
+   * トランザクションの中で呼び出すことはできない
+   */
+  std::future<void> send_async(T value, std::function<void()> on_complete);
+
   void update(InnerTransaction *transaction) override;
 
   void refresh(ID transaction_id) override;
 
   void finalize(InnerTransaction *transaction) override;
 
+  void deliver_unordered(ID transaction_id) override;
+
   template <class U> friend class StreamLoop;
 };
 
@@ -85,7 +133,7 @@ public:
     ID cluster_id = clusterManager.current_id();
     std::function<std::optional<U>(ID)> updater =
         [internal = this->internal, f](ID transaction_id) -> std::optional<U> {
-      std::optional<std::shared_ptr<T>> value =
+      std::optional<ValueRef<T>> value =
           internal->sample(transaction_id);
       if (not value.has_value()) {
         failure_log(
@@ -100,6 +148,13 @@ public:
 
   template <class F> void listen(F f) const;
 
+  /**
+   * 値が確定した時点で、前のトランザクションの終了を待たずにfを呼び出す
+   * 呼び出しはスレッドプールで行なわれ、トランザクションの順序も呼び出し同士の順序も保証されない
+   * 集計のような順序に依らない処理に使う
+   */
+  template <class F> void listen_unordered(F f) const;
+
   template <class F> Stream<T> merge(Stream<T> s2, F f) const;
 
   Stream<T> or_else(Stream<T> s2) const;
@@ -128,9 +183,9 @@ public:
     std::function<std::optional<V>(ID)> updater =
         [internal = this->internal, c1,
          f](ID transaction_id) -> std::optional<V> {
-      std::shared_ptr<T> v = internal->unsafeSample(transaction_id);
+      ValueRef<T> v = internal->unsafeSample(transaction_id);
 
-      std::optional<std::shared_ptr<U1>> v1 =
+      std::optional<ValueRef<U1>> v1 =
           c1.internal->sample(transaction_id);
       if (not v1.has_value()) {
         return std::nullopt;
@@ -154,15 +209,15 @@ public:
     std::function<std::optional<V>(ID)> updater =
         [internal = this->internal, c1, c2,
          f](ID transaction_id) -> std::optional<V> {
-      std::shared_ptr<T> v = internal->unsafeSample(transaction_id);
+      ValueRef<T> v = internal->unsafeSample(transaction_id);
 
-      std::optional<std::shared_ptr<U1>> v1 =
+      std::optional<ValueRef<U1>> v1 =
           c1.internal->sample(transaction_id);
       if (not v1.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U2>> v2 =
+      std::optional<ValueRef<U2>> v2 =
           c2.internal->sample(transaction_id);
       if (not v2.has_value()) {
         return std::nullopt;
@@ -187,21 +242,21 @@ public:
     std::function<std::optional<V>(ID)> updater =
         [internal = this->internal, c1, c2, c3,
          f](ID transaction_id) -> std::optional<V> {
-      std::shared_ptr<T> v = internal->unsafeSample(transaction_id);
+      ValueRef<T> v = internal->unsafeSample(transaction_id);
 
-      std::optional<std::shared_ptr<U1>> v1 =
+      std::optional<ValueRef<U1>> v1 =
           c1.internal->sample(transaction_id);
       if (not v1.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U2>> v2 =
+      std::optional<ValueRef<U2>> v2 =
           c2.internal->sample(transaction_id);
       if (not v2.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U3>> v3 =
+      std::optional<ValueRef<U3>> v3 =
           c3.internal->sample(transaction_id);
       if (not v3.has_value()) {
         return std::nullopt;
@@ -227,27 +282,27 @@ public:
     std::function<std::optional<V>(ID)> updater =
         [internal = this->internal, c1, c2, c3, c4,
          f](ID transaction_id) -> std::optional<V> {
-      std::shared_ptr<T> v = internal->unsafeSample(transaction_id);
+      ValueRef<T> v = internal->unsafeSample(transaction_id);
 
-      std::optional<std::shared_ptr<U1>> v1 =
+      std::optional<ValueRef<U1>> v1 =
           c1.internal->sample(transaction_id);
       if (not v1.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U2>> v2 =
+      std::optional<ValueRef<U2>> v2 =
           c2.internal->sample(transaction_id);
       if (not v2.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U3>> v3 =
+      std::optional<ValueRef<U3>> v3 =
           c3.internal->sample(transaction_id);
       if (not v3.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U4>> v4 =
+      std::optional<ValueRef<U4>> v4 =
           c4.internal->sample(transaction_id);
       if (not v4.has_value()) {
         return std::nullopt;
@@ -277,33 +332,33 @@ public:
     std::function<std::optional<V>(ID)> updater =
         [internal = this->internal, c1, c2, c3, c4, c5,
          f](ID transaction_id) -> std::optional<V> {
-      std::shared_ptr<T> v = internal->unsafeSample(transaction_id);
+      ValueRef<T> v = internal->unsafeSample(transaction_id);
 
-      std::optional<std::shared_ptr<U1>> v1 =
+      std::optional<ValueRef<U1>> v1 =
           c1.internal->sample(transaction_id);
       if (not v1.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U2>> v2 =
+      std::optional<ValueRef<U2>> v2 =
           c2.internal->sample(transaction_id);
       if (not v2.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U3>> v3 =
+      std::optional<ValueRef<U3>> v3 =
           c3.internal->sample(transaction_id);
       if (not v3.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U4>> v4 =
+      std::optional<ValueRef<U4>> v4 =
           c4.internal->sample(transaction_id);
       if (not v4.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U5>> v5 =
+      std::optional<ValueRef<U5>> v5 =
           c5.internal->sample(transaction_id);
       if (not v5.has_value()) {
         return std::nullopt;
@@ -334,39 +389,39 @@ public:
     std::function<std::optional<V>(ID)> updater =
         [internal = this->internal, c1, c2, c3, c4, c5, c6,
          f](ID transaction_id) -> std::optional<V> {
-      std::shared_ptr<T> v = internal->unsafeSample(transaction_id);
+      ValueRef<T> v = internal->unsafeSample(transaction_id);
 
-      std::optional<std::shared_ptr<U1>> v1 =
+      std::optional<ValueRef<U1>> v1 =
           c1.internal->sample(transaction_id);
       if (not v1.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U2>> v2 =
+      std::optional<ValueRef<U2>> v2 =
           c2.internal->sample(transaction_id);
       if (not v2.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U3>> v3 =
+      std::optional<ValueRef<U3>> v3 =
           c3.internal->sample(transaction_id);
       if (not v3.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U4>> v4 =
+      std::optional<ValueRef<U4>> v4 =
           c4.internal->sample(transaction_id);
       if (not v4.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U5>> v5 =
+      std::optional<ValueRef<U5>> v5 =
           c5.internal->sample(transaction_id);
       if (not v5.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U6>> v6 =
+      std::optional<ValueRef<U6>> v6 =
           c6.internal->sample(transaction_id);
       if (not v6.has_value()) {
         return std::nullopt;
@@ -399,45 +454,45 @@ public:
     std::function<std::optional<V>(ID)> updater =
         [internal = this->internal, c1, c2, c3, c4, c5, c6, c7,
          f](ID transaction_id) -> std::optional<V> {
-      std::shared_ptr<T> v = internal->unsafeSample(transaction_id);
+      ValueRef<T> v = internal->unsafeSample(transaction_id);
 
-      std::optional<std::shared_ptr<U1>> v1 =
+      std::optional<ValueRef<U1>> v1 =
           c1.internal->sample(transaction_id);
       if (not v1.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U2>> v2 =
+      std::optional<ValueRef<U2>> v2 =
           c2.internal->sample(transaction_id);
       if (not v2.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U3>> v3 =
+      std::optional<ValueRef<U3>> v3 =
           c3.internal->sample(transaction_id);
       if (not v3.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U4>> v4 =
+      std::optional<ValueRef<U4>> v4 =
           c4.internal->sample(transaction_id);
       if (not v4.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U5>> v5 =
+      std::optional<ValueRef<U5>> v5 =
           c5.internal->sample(transaction_id);
       if (not v5.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U6>> v6 =
+      std::optional<ValueRef<U6>> v6 =
           c6.internal->sample(transaction_id);
       if (not v6.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U7>> v7 =
+      std::optional<ValueRef<U7>> v7 =
           c7.internal->sample(transaction_id);
       if (not v7.has_value()) {
         return std::nullopt;
@@ -471,51 +526,51 @@ public:
     std::function<std::optional<V>(ID)> updater =
         [internal = this->internal, c1, c2, c3, c4, c5, c6, c7, c8,
          f](ID transaction_id) -> std::optional<V> {
-      std::shared_ptr<T> v = internal->unsafeSample(transaction_id);
+      ValueRef<T> v = internal->unsafeSample(transaction_id);
 
-      std::optional<std::shared_ptr<U1>> v1 =
+      std::optional<ValueRef<U1>> v1 =
           c1.internal->sample(transaction_id);
       if (not v1.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U2>> v2 =
+      std::optional<ValueRef<U2>> v2 =
           c2.internal->sample(transaction_id);
       if (not v2.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U3>> v3 =
+      std::optional<ValueRef<U3>> v3 =
           c3.internal->sample(transaction_id);
       if (not v3.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U4>> v4 =
+      std::optional<ValueRef<U4>> v4 =
           c4.internal->sample(transaction_id);
       if (not v4.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U5>> v5 =
+      std::optional<ValueRef<U5>> v5 =
           c5.internal->sample(transaction_id);
       if (not v5.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U6>> v6 =
+      std::optional<ValueRef<U6>> v6 =
           c6.internal->sample(transaction_id);
       if (not v6.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U7>> v7 =
+      std::optional<ValueRef<U7>> v7 =
           c7.internal->sample(transaction_id);
       if (not v7.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U8>> v8 =
+      std::optional<ValueRef<U8>> v8 =
           c8.internal->sample(transaction_id);
       if (not v8.has_value()) {
         return std::nullopt;
@@ -550,57 +605,57 @@ public:
     std::function<std::optional<V>(ID)> updater =
         [internal = this->internal, c1, c2, c3, c4, c5, c6, c7, c8, c9,
          f](ID transaction_id) -> std::optional<V> {
-      std::shared_ptr<T> v = internal->unsafeSample(transaction_id);
+      ValueRef<T> v = internal->unsafeSample(transaction_id);
 
-      std::optional<std::shared_ptr<U1>> v1 =
+      std::optional<ValueRef<U1>> v1 =
           c1.internal->sample(transaction_id);
       if (not v1.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U2>> v2 =
+      std::optional<ValueRef<U2>> v2 =
           c2.internal->sample(transaction_id);
       if (not v2.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U3>> v3 =
+      std::optional<ValueRef<U3>> v3 =
           c3.internal->sample(transaction_id);
       if (not v3.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U4>> v4 =
+      std::optional<ValueRef<U4>> v4 =
           c4.internal->sample(transaction_id);
       if (not v4.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U5>> v5 =
+      std::optional<ValueRef<U5>> v5 =
           c5.internal->sample(transaction_id);
       if (not v5.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U6>> v6 =
+      std::optional<ValueRef<U6>> v6 =
           c6.internal->sample(transaction_id);
       if (not v6.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U7>> v7 =
+      std::optional<ValueRef<U7>> v7 =
           c7.internal->sample(transaction_id);
       if (not v7.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U8>> v8 =
+      std::optional<ValueRef<U8>> v8 =
           c8.internal->sample(transaction_id);
       if (not v8.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U9>> v9 =
+      std::optional<ValueRef<U9>> v9 =
           c9.internal->sample(transaction_id);
       if (not v9.has_value()) {
         return std::nullopt;
@@ -637,63 +692,63 @@ public:
     std::function<std::optional<V>(ID)> updater =
         [internal = this->internal, c1, c2, c3, c4, c5, c6, c7, c8, c9, c10,
          f](ID transaction_id) -> std::optional<V> {
-      std::shared_ptr<T> v = internal->unsafeSample(transaction_id);
+      ValueRef<T> v = internal->unsafeSample(transaction_id);
 
-      std::optional<std::shared_ptr<U1>> v1 =
+      std::optional<ValueRef<U1>> v1 =
           c1.internal->sample(transaction_id);
       if (not v1.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U2>> v2 =
+      std::optional<ValueRef<U2>> v2 =
           c2.internal->sample(transaction_id);
       if (not v2.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U3>> v3 =
+      std::optional<ValueRef<U3>> v3 =
           c3.internal->sample(transaction_id);
       if (not v3.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U4>> v4 =
+      std::optional<ValueRef<U4>> v4 =
           c4.internal->sample(transaction_id);
       if (not v4.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U5>> v5 =
+      std::optional<ValueRef<U5>> v5 =
           c5.internal->sample(transaction_id);
       if (not v5.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U6>> v6 =
+      std::optional<ValueRef<U6>> v6 =
           c6.internal->sample(transaction_id);
       if (not v6.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U7>> v7 =
+      std::optional<ValueRef<U7>> v7 =
           c7.internal->sample(transaction_id);
       if (not v7.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U8>> v8 =
+      std::optional<ValueRef<U8>> v8 =
           c8.internal->sample(transaction_id);
       if (not v8.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U9>> v9 =
+      std::optional<ValueRef<U9>> v9 =
           c9.internal->sample(transaction_id);
       if (not v9.has_value()) {
         return std::nullopt;
       }
 
-      std::optional<std::shared_ptr<U10>> v10 =
+      std::optional<ValueRef<U10>> v10 =
           c10.internal->sample(transaction_id);
       if (not v10.has_value()) {
         return std::nullopt;
@@ -734,6 +789,19 @@ public:
   StreamSink();
 
   void send(T value) const;
+
+  /**
+   * 同時に存在できるトランザクションの数が上限に達していれば、待たずにfalseを返す
+   */
+  bool try_send(T value) const;
+
+  /**
+   * 更新の終了を待たずに戻る
+   * on_completeは更新が終了した後にワーカーのスレッドで呼び出される
+   * 同時に存在できるトランザクションの数が上限に達していれば、空くまでは待たされる
+   */
+  std::future<void> send_async(T value,
+                               std::function<void()> on_complete = nullptr) const;
 };
 
 template <class T> class StreamLoop : public Stream<T> {
@@ -765,40 +833,66 @@ StreamInternal<T>::StreamInternal(ID cluster_id)
                             failure_log("無効なupdaterが登録されています");
                           }) {}
 
+template <class T>
+void StreamInternal<T>::forward(
+    std::function<ValueRef<T>(ID transaction_id)> forwarder) {
+  this->forwarder = forwarder;
+}
+
 template <class T> void StreamInternal<T>::send(T value) {
   if (current_transaction == nullptr) {
     Transaction trans;
-    send(value, current_transaction);
+    send(std::move(value), current_transaction);
   } else {
-    send(value, current_transaction);
+    send(std::move(value), current_transaction);
   }
 }
 
 template <class T>
-void StreamInternal<T>::send(T value, InnerTransaction *transaction) {
-  {
-    {
-      std::lock_guard<std::mutex> lock(mtx);
-      values[transaction->get_id()] = std::make_shared<T>(value);
-    }
-    this->register_listeners_update(transaction);
-    this->register_cleanup(transaction);
+std::future<void> StreamInternal<T>::send_async(T value,
+                                    std::function<void()> on_complete) {
+  if (current_transaction != nullptr) {
+    failure_log("トランザクションの中ではsend_asyncを使えません");
   }
+  Transaction trans;
+  send(std::move(value), current_transaction);
+  return trans.commit_async(on_complete);
 }
 
-template <class T>
-std::optional<std::shared_ptr<T>> StreamInternal<T>::sample(ID transaction_id) {
-  std::lock_guard<std::mutex> lock(mtx);
-  auto itr = values.find(transaction_id);
-  if (itr == values.end()) {
-    return std::nullopt;
+template <class T> bool StreamInternal<T>::try_send(T value) {
+  if (current_transaction != nullptr) {
+    send(std::move(value), current_transaction);
+    return true;
+  }
+  Transaction trans(std::try_to_lock);
+  if (not trans.is_open()) {
+    return false;
   }
-  return itr->second;
+  send(std::move(value), current_transaction);
+  return true;
+}
+
+template <class T>
+void StreamInternal<T>::send(T value, InnerTransaction *transaction) {
+  this->send_shared(make_value<T>(value_pool, std::move(value)), transaction);
+}
+
+template <class T>
+void StreamInternal<T>::send_shared(ValueRef<T> value,
+                                    InnerTransaction *transaction) {
+  values.set(transaction->get_id(), std::move(value));
+  this->register_listeners_update(transaction);
+  this->register_cleanup(transaction);
 }
 
 template <class T>
-std::shared_ptr<T> StreamInternal<T>::unsafeSample(ID transaction_id) {
-  std::optional<std ::shared_ptr<T>> res = this->sample(transaction_id);
+std::optional<ValueRef<T>> StreamInternal<T>::sample(ID transaction_id) {
+  return values.get(transaction_id);
+}
+
+template <class T>
+ValueRef<T> StreamInternal<T>::unsafeSample(ID transaction_id) {
+  std::optional<ValueRef<T>> res = this->sample(transaction_id);
   if (not res.has_value()) {
     failure_log("論理時刻に対応する値がStreamに存在しませんでした");
   }
@@ -807,32 +901,57 @@ std::shared_ptr<T> StreamInternal<T>::unsafeSample(ID transaction_id) {
 
 template <class T>
 void StreamInternal<T>::listenFromOuter(
-    std::function<void(std::shared_ptr<T>)> f) {
+    std::function<void(ValueRef<T>)> f) {
   listeners.push_back(f);
+  listener_queues.push_back(std::make_unique<ListenerQueue>());
+}
+
+template <class T>
+void StreamInternal<T>::listenUnorderedFromOuter(
+    std::function<void(ValueRef<T>)> f) {
+  unordered_listeners.push_back(f);
+}
+
+template <class T>
+void StreamInternal<T>::deliver_unordered(ID transaction_id) {
+  if (unordered_listeners.empty()) {
+    return;
+  }
+  ValueRef<T> value = this->unsafeSample(transaction_id);
+  for (std::function<void(ValueRef<T>)> &listener :
+       unordered_listeners) {
+    Executor::global_executor->post(
+        [&listener, value]() -> void { listener(value); });
+  }
 }
 
 template <class T>
 void StreamInternal<T>::update(InnerTransaction *transaction) {
   ID transaction_id = transaction->get_id();
+  if (forwarder) {
+    ValueRef<T> res = forwarder(transaction_id);
+    if (res) {
+      this->send_shared(std::move(res), transaction);
+    }
+    return;
+  }
   std::optional<T> res = updater(transaction_id);
   if (res) {
-    this->send(*res, transaction);
+    this->send(std::move(*res), transaction);
   }
 }
 
 template <class T> void StreamInternal<T>::refresh(ID transaction_id) {
-  std::lock_guard<std::mutex> lock(mtx);
-  auto itr = values.find(transaction_id);
-  if (itr != values.end()) {
-    values.erase(itr);
-  }
+  values.erase(transaction_id);
 }
 
 template <class T>
 void StreamInternal<T>::finalize(InnerTransaction *transaction) {
-  std::shared_ptr<T> value = this->unsafeSample(transaction->get_id());
-  for (std::function<void(std::shared_ptr<T>)> &listener : listeners) {
-    listener(value);
+  ValueRef<T> value = this->unsafeSample(transaction->get_id());
+  for (size_t i = 0; i < listeners.size(); ++i) {
+    std::function<void(ValueRef<T>)> &listener = listeners[i];
+    transaction->deliver(*listener_queues[i],
+                         [&listener, value]() -> void { listener(value); });
   }
 }
 
@@ -844,7 +963,14 @@ Stream<T>::Stream()
     : internal(new StreamInternal<T>(clusterManager.current_id())) {}
 
 template <class T> template <class F> void Stream<T>::listen(F f) const {
-  this->internal->listenFromOuter([f](std::shared_ptr<T> v) -> void { f(*v); });
+  this->internal->listenFromOuter([f](ValueRef<T> v) -> void { f(*v); });
+}
+
+template <class T>
+template <class F>
+void Stream<T>::listen_unordered(F f) const {
+  this->internal->listenUnorderedFromOuter(
+      [f](ValueRef<T> v) -> void { f(*v); });
 }
 
 template <class T>
@@ -853,8 +979,8 @@ Stream<T> Stream<T>::merge(Stream<T> s2, F f) const {
   ID cluster_id = clusterManager.current_id();
   std::function<std::optional<T>(ID)> updater = [internal = this->internal, s2,
                                                  f](ID id) -> std::optional<T> {
-    std::optional<std::shared_ptr<T>> v1 = internal->sample(id);
-    std::optional<std::shared_ptr<T>> v2 = s2.internal->sample(id);
+    std::optional<ValueRef<T>> v1 = internal->sample(id);
+    std::optional<ValueRef<T>> v2 = s2.internal->sample(id);
     if (v1 and v2) {
       return f(**v1, **v2);
     }
@@ -880,7 +1006,7 @@ template <class T> Cell<T> Stream<T>::hold(T initial_value) const {
   ID cluster_id = clusterManager.current_id();
   std::function<std::optional<T>(ID)> updater =
       [internal = this->internal](ID id) -> T {
-    std::shared_ptr<T> res = internal->unsafeSample(id);
+    ValueRef<T> res = internal->unsafeSample(id);
     return *res;
   };
   CellInternal<T> *inter =
@@ -891,15 +1017,17 @@ template <class T> Cell<T> Stream<T>::hold(T initial_value) const {
 
 template <class T> template <class F> Stream<T> Stream<T>::filter(F f) const {
   ID cluster_id = clusterManager.current_id();
-  std::function<std::optional<T>(ID)> updater = [internal = this->internal,
-                                                 f](ID id) -> std::optional<T> {
-    std::shared_ptr<T> res = internal->unsafeSample(id);
+  // 通した値はコピーせずに上流と共有する
+  std::function<ValueRef<T>(ID)> forwarder =
+      [internal = this->internal, f](ID id) -> ValueRef<T> {
+    ValueRef<T> res = internal->unsafeSample(id);
     if (f(*res)) {
-      return *res;
+      return res;
     }
-    return std::nullopt;
+    return nullptr;
   };
-  StreamInternal<T> *inter = new StreamInternal<T>(cluster_id, updater);
+  StreamInternal<T> *inter = new StreamInternal<T>(cluster_id);
+  inter->forward(forwarder);
   inter->listen(this->internal);
   return Stream<T>(inter);
 }
@@ -911,18 +1039,20 @@ template <class T> Stream<T> filterOptional(Stream<std::optional<T>> s) {
 
 template <class T> Stream<T> Stream<T>::gate(Cell<bool> c) const {
   ID cluster_id = clusterManager.current_id();
-  std::function<std::optional<T>(ID)> updater = [internal = this->internal,
-                                                 c](ID id) -> std::optional<T> {
-    std::optional<std::shared_ptr<bool>> value = c.internal->sample(id);
+  // 通した値はコピーせずに上流と共有する
+  std::function<ValueRef<T>(ID)> forwarder =
+      [internal = this->internal, c](ID id) -> ValueRef<T> {
+    std::optional<ValueRef<bool>> value = c.internal->sample(id);
     if (not value) {
-      return std::nullopt;
+      return nullptr;
     }
     if (not **value) {
-      return std::nullopt;
+      return nullptr;
     }
-    return *internal->unsafeSample(id);
+    return internal->unsafeSample(id);
   };
-  StreamInternal<T> *inter = new StreamInternal<T>(cluster_id, updater);
+  StreamInternal<T> *inter = new StreamInternal<T>(cluster_id);
+  inter->forward(forwarder);
   inter->listen(this->internal);
   // gateはCellの値が変化したときに動くものでは無いので child_to()
   // を呼び出す
@@ -936,7 +1066,17 @@ StreamSink<T>::StreamSink()
           new StreamInternal<T>(ClusterManager::UNMANAGED_CLUSTER_ID)) {}
 
 template <class T> void StreamSink<T>::send(T value) const {
-  this->internal->send(value);
+  this->internal->send(std::move(value));
+}
+
+template <class T>
+std::future<void>
+StreamSink<T>::send_async(T value, std::function<void()> on_complete) const {
+  return this->internal->send_async(std::move(value), on_complete);
+}
+
+template <class T> bool StreamSink<T>::try_send(T value) const {
+  return this->internal->try_send(std::move(value));
 }
 
 template <class T> StreamLoop<T>::StreamLoop() : Stream<T>(), looped(false) {}
@@ -947,13 +1087,12 @@ template <class T> void StreamLoop<T>::loop(Stream<T> s) {
   }
   this->looped = true;
 
-  std::function<std::optional<T>(ID)> updater =
-      [s](ID transaction_id) -> std::optional<T> {
-    std::shared_ptr<T> res = s.internal->unsafeSample(transaction_id);
-    return *res;
+  std::function<ValueRef<T>(ID)> forwarder =
+      [s](ID transaction_id) -> ValueRef<T> {
+    return s.internal->unsafeSample(transaction_id);
   };
   // 強引にupdaterを置き変えているがC++で綺麗なコードを書くことは諦める
-  this->internal->updater = updater;
+  this->internal->forward(forwarder);
   this->internal->listen_over_loop(s.internal);
 }
 
@@ -6,18 +6,18 @@
 #include <thread>
 
 namespace prf {
-std::atomic_bool stop_the_threads(false);
 std::atomic_int8_t wait_threads(0);
+std::atomic_int8_t running_threads(0);
 
 void stop_execution() {
-  wait_threads.store(2);
-  stop_the_threads.store(true);
+  wait_threads.store(running_threads.exchange(0));
   PlannerManager::messages.notify_stop();
   Executor::messages.notify_stop();
   while (wait_threads.load() != 0) {
     // この関数自体常用することを想定していないので雑に待つ実装にしておく
     std::this_thread::sleep_for(std::chrono::milliseconds(1));
   }
-  stop_the_threads.store(false);
+  PlannerManager::messages.clear_stop();
+  Executor::messages.clear_stop();
 }
 } // namespace prf
@@ -6,18 +6,19 @@ namespace prf {
 // バックグラウンドにあるスレッドを停止するための機能を列挙する場所
 
 /**
- * バックグラウンドで動いているスレッドを停止するか否か
+ * 停止待ちしているスレッドの数
  */
-extern std::atomic_bool stop_the_threads;
+extern std::atomic_int8_t wait_threads;
 
 /**
- * 停止待ちしているスレッドの数
+ * バックグラウンドで起動しているスレッドの数
+ * 実行モードによってPlannerのスレッドを起動しない場合があるので、起動した側で数える
  */
-extern std::atomic_int8_t wait_threads;
+extern std::atomic_int8_t running_threads;
 
 /**
- * stop_the_threadsの値をtrueに変えてPlannerとExecutorを停止させる
- * PlannerとExecutorが既に停止しているときに呼び出すと、この関数は永久にブロックするので注意
+ * PlannerとExecutorのメッセージキューに停止を通知してそれらを停止させる
+ * 起動しているスレッドが全て停止するまでブロッキングする
  */
 void stop_execution();
 } // namespace prf
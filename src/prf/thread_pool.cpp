@@ -1,45 +1,125 @@
 #include "prf/thread_pool.hpp"
-#include "prf/stream.hpp"
+#include "prf/logger.hpp"
 #include <algorithm>
 #include <optional>
 
 namespace prf {
+
+/**
+ * 現在のスレッドがワーカーとして所属しているプールとその番号
+ */
+thread_local ThreadPool *current_pool = nullptr;
+thread_local size_t current_worker = 0;
+
 size_t ThreadPool::get_nubmer_of_threads() { return this->number_of_threads; }
 
 ThreadPool::ThreadPool(size_t number_of_threads)
-    : number_of_threads(number_of_threads) {
+    : number_of_threads(number_of_threads), next_inbox(0), pending(0),
+      sleeping(0), stopped(false) {
   for (size_t id = 0; id < number_of_threads; ++id) {
-    this->threads.push_back(std::thread([&queue = this->queue, id]() {
-      while (true) {
-        std::optional<Task> otask = queue.pop();
-        if (otask.has_value()) {
-          (*otask)();
-        } else {
-          break;
-        }
-      }
-      info_log("ThreadPool: id: %ld 停止します", id);
-    }));
+    this->workers.push_back(std::make_unique<Worker>());
+  }
+  for (size_t id = 0; id < number_of_threads; ++id) {
+    this->threads.push_back(
+        std::thread([this, id]() { this->worker_loop(id); }));
   }
 }
 
 ThreadPool::~ThreadPool() { this->stop(); }
 
+void ThreadPool::worker_loop(size_t id) {
+  current_pool = this;
+  current_worker = id;
+  while (not this->stopped.load()) {
+    Task *task = this->find_task(id);
+    if (task != nullptr) {
+      this->pending.fetch_sub(1);
+      (*task)();
+      delete task;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(this->sleep_mtx);
+    this->sleeping.fetch_add(1);
+    this->sleep_cond.wait(lock, [this] {
+      return this->pending.load() > 0 or this->stopped.load();
+    });
+    this->sleeping.fetch_sub(1);
+  }
+  current_pool = nullptr;
+  info_log("ThreadPool: id: %ld 停止します", id);
+}
+
+ThreadPool::Task *ThreadPool::find_task(size_t id) {
+  {
+    std::optional<Task *> task = this->workers[id]->local.take();
+    if (task) {
+      return *task;
+    }
+  }
+  for (size_t i = 0; i < this->number_of_threads; ++i) {
+    Worker &victim = *this->workers[(id + i) % this->number_of_threads];
+    if (i != 0) {
+      std::optional<Task *> task = victim.local.steal();
+      if (task) {
+        return *task;
+      }
+    }
+    std::lock_guard<std::mutex> lock(victim.inbox_mtx);
+    if (not victim.inbox.empty()) {
+      Task *task = victim.inbox.front();
+      victim.inbox.pop_front();
+      return task;
+    }
+  }
+  return nullptr;
+}
+
+void ThreadPool::push_task(Task *task) {
+  // 取り出されるより先に数えておかないと pending が一時的に負になる
+  this->pending.fetch_add(1);
+  if (current_pool == this) {
+    this->workers[current_worker]->local.push(task);
+  } else {
+    size_t id = this->next_inbox.fetch_add(1) % this->number_of_threads;
+    Worker &worker = *this->workers[id];
+    std::lock_guard<std::mutex> lock(worker.inbox_mtx);
+    worker.inbox.push_back(task);
+  }
+  if (this->sleeping.load() > 0) {
+    std::lock_guard<std::mutex> lock(this->sleep_mtx);
+    this->sleep_cond.notify_one();
+  }
+}
+
 std::shared_ptr<utils::Waiter> ThreadPool::request(Task task) {
   auto res = std::make_shared<utils::Waiter>();
-  this->queue.push([res, task]() -> void {
+  this->push_task(new Task([res, task = std::move(task)]() -> void {
     task();
     res->done();
-  });
+  }));
   return res;
 }
 
 void ThreadPool::stop() {
-  // TODO ConcurrentQueueの停止条件をもっと柔軟に変えられるように後でしておく
-  // グローバル変数に直接依存は不便...
-  this->queue.notify_stop();
+  {
+    std::lock_guard<std::mutex> lock(this->sleep_mtx);
+    this->stopped.store(true);
+    this->sleep_cond.notify_all();
+  }
   for (auto &thread : this->threads) {
-    thread.join();
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+  // 実行されずに残った仕事を破棄する
+  for (auto &worker : this->workers) {
+    while (std::optional<Task *> task = worker->local.take()) {
+      delete *task;
+    }
+    for (Task *task : worker->inbox) {
+      delete task;
+    }
+    worker->inbox.clear();
   }
 
   info_log("ThreadPoolは停止しました");
@@ -1,8 +1,13 @@
 #pragma once
 
-#include "prf/concurrent_queue.hpp"
 #include "prf/utils.hpp"
+#include "prf/work_stealing_deque.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
 
@@ -13,15 +18,66 @@ namespace prf {
  * 1コア環境だとしても複数スレッドあると都合が良い場合もあるので余裕を持っておく
  */
 const size_t MINIMUM_NUMBER_OF_THREADS_ON_AUTOMATIC = 4;
+
+/**
+ * ワークスティーリングをするスレッドプール
+ * ワーカー毎に仕事の両端キューを持ち、手の空いたワーカーは他のワーカーから仕事を奪う
+ */
 class ThreadPool {
 private:
   using Task = std::function<void()>;
-  ConcurrentQueue<Task> queue;
+
+  /**
+   * ワーカー毎に持つ仕事の置き場
+   */
+  struct Worker {
+    /**
+     * ワーカー自身が依頼した仕事
+     */
+    WorkStealingDeque<Task *> local;
+
+    /**
+     * プールの外のスレッドから依頼された仕事
+     * 依頼元は複数あり得るのでロックで保護する
+     */
+    std::deque<Task *> inbox;
+    std::mutex inbox_mtx;
+  };
 
   size_t number_of_threads;
 
+  std::vector<std::unique_ptr<Worker>> workers;
+
   std::vector<std::thread> threads;
 
+  /**
+   * 外部からの依頼を振り分ける先のワーカー
+   */
+  std::atomic<size_t> next_inbox;
+
+  /**
+   * まだ誰も取り出していない仕事の数
+   */
+  std::atomic<size_t> pending;
+
+  /**
+   * 仕事が無くて眠っているワーカーの数
+   */
+  std::atomic<size_t> sleeping;
+
+  std::atomic_bool stopped;
+  std::mutex sleep_mtx;
+  std::condition_variable sleep_cond;
+
+  void push_task(Task *);
+
+  /**
+   * 自分の両端キュー、自分宛ての依頼、他のワーカーの順に仕事を探す
+   */
+  Task *find_task(size_t id);
+
+  void worker_loop(size_t id);
+
 public:
   size_t get_nubmer_of_threads();
 
@@ -33,6 +89,7 @@ public:
 
   /**
    * スレッドプールに仕事を依頼する
+   * ワーカーのスレッドから依頼された場合はそのワーカーの両端キューに積まれる
    * 返されるWaiterクラスを使って仕事が終了した通知を受けとることができる
    */
   std::shared_ptr<utils::Waiter> request(Task);
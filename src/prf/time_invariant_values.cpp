@@ -44,10 +44,15 @@ void TimeInvariantValues::child_to(TimeInvariantValues *to) {
 }
 
 void TimeInvariantValues::global_listen(TimeInvariantValues *to) {
+  to->node->global_link_to(this->node);
   to->listners.push_back(this);
 }
 
 void TimeInvariantValues::finalize(InnerTransaction *transaction) {
   (void)transaction;
 }
+
+void TimeInvariantValues::deliver_unordered(ID transaction_id) {
+  (void)transaction_id;
+}
 } // namespace prf
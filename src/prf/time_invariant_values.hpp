@@ -41,6 +41,12 @@ public:
    */
   virtual void finalize(InnerTransaction *transaction);
 
+  /**
+   * transaction_idに対応するトランザクションでの値が確定したときに呼び出される
+   * 順序を問わないlistenerをこの時点で呼び出す
+   */
+  virtual void deliver_unordered(ID transaction_id);
+
   ID get_cluster_id();
 
   // 引数の時変値に更新があったときに連動して更新されるようにする
@@ -2,9 +2,11 @@
 #include "prf/cluster.hpp"
 #include "prf/executor.hpp"
 #include "prf/logger.hpp"
+#include "prf/prf.hpp"
 #include "prf/time_invariant_values.hpp"
 #include <atomic>
 #include <mutex>
+#include <thread>
 
 namespace prf {
 
@@ -26,7 +28,8 @@ InnerTransaction::InnerTransaction(ID id, ID updating_cluster)
     : id(id), updating_cluster(updating_cluster),
       inside_transaction(updating_cluster !=
                          ClusterManager::UNMANAGED_CLUSTER_ID),
-      updating(false) {}
+      // 更新処理の中で作られるので、破棄しても更新処理は開始しない
+      updating(true), delivery(nullptr) {}
 
 std::mutex InnerTransaction::new_transaction_mutex;
 
@@ -41,6 +44,19 @@ InnerTransaction::InnerTransaction() {
     id = current_transaction->get_id();
     return;
   }
+  // 同時に存在できるトランザクションの数を超えないように、IDを取る前に枠を確保する
+  transaction_window.acquire();
+  this->open();
+}
+
+InnerTransaction::InnerTransaction(std::adopt_lock_t) {
+  if (current_transaction != nullptr) {
+    failure_log("既にトランザクションが存在します");
+  }
+  this->open();
+}
+
+void InnerTransaction::open() {
   // Executor::messagesにトランザクションが生成された順番でRegisterTransactionMessageが来ることを想定しているのでロックを取る
   std::lock_guard<std::mutex> lock(InnerTransaction::new_transaction_mutex);
   updating_cluster = ClusterManager::UNMANAGED_CLUSTER_ID;
@@ -49,7 +65,7 @@ InnerTransaction::InnerTransaction() {
   id = next_transaction_id.fetch_add(1);
   current_transaction = this;
   RegisterTransactionMessage message(id);
-  Executor::messages.push(message);
+  Executor::messages.push(std::move(message));
 }
 
 InnerTransaction::~InnerTransaction() {
@@ -61,10 +77,16 @@ InnerTransaction::~InnerTransaction() {
   if (updating) {
     return;
   }
+  // Executorに引き渡したものは終了処理を終えてから破棄される
+  if (handed_over) {
+    return;
+  }
   start_updating();
   current_transaction = nullptr;
 }
 
+void InnerTransaction::hand_over() { this->handed_over = true; }
+
 void InnerTransaction::register_update(TimeInvariantValues *tiv) {
   ID id = tiv->get_cluster_id();
   if (updating_cluster == id) {
@@ -97,9 +119,13 @@ ExecuteResult InnerTransaction::execute() {
     targets_inside_current_cluster.erase(tiv);
     tiv->update(this);
   }
+  // 結果はこのインスタンスより長く使われるので、領域の外にコピーする
   ExecuteResult result;
-  result.cleanups = this->cleanups;
-  result.targets = targets_outside_current_cluster;
+  result.cleanups.insert(this->cleanups.begin(), this->cleanups.end());
+  for (auto &clustered_tivs : targets_outside_current_cluster) {
+    result.targets[clustered_tivs.first].insert(clustered_tivs.second.begin(),
+                                                clustered_tivs.second.end());
+  }
   result.before_update_hooks = this->before_update_hooks;
   return result;
 }
@@ -144,13 +170,63 @@ std::set<ID> InnerTransaction::target_clusters() {
   return res;
 }
 
-void InnerTransaction::finalize() {
+std::set<ID> InnerTransaction::target_domains() {
+  std::lock_guard<std::mutex> lock(this->mtx);
+  std::set<ID> res;
+  for (auto cleanup : this->cleanups) {
+    res.insert(cleanup->node->get_domain_id());
+  }
+  for (auto tiv : this->targets_inside_current_cluster) {
+    res.insert(tiv->node->get_domain_id());
+  }
+  for (auto &clustered_tivs : this->targets_outside_current_cluster) {
+    for (auto tiv : clustered_tivs.second) {
+      res.insert(tiv->node->get_domain_id());
+    }
+  }
+  return res;
+}
+
+bool InnerTransaction::is_target_cluster(ID cluster_id) {
+  if (this->is_in_updating()) {
+    failure_log("更新用のトランザクションで呼び出すことを想定していません");
+  }
+  std::lock_guard<std::mutex> lock(this->mtx);
+  return this->targets_outside_current_cluster.count(cluster_id) != 0;
+}
+
+void InnerTransaction::deliver(ListenerQueue &queue,
+                               std::function<void()> call) {
+  if (this->delivery == nullptr) {
+    call();
+    return;
+  }
+  this->delivery->post(queue, call);
+}
+
+void InnerTransaction::deliver_unordered() {
+  for (auto cleanup : this->cleanups) {
+    cleanup->deliver_unordered(this->id);
+  }
+}
+
+void InnerTransaction::finalize(std::function<void()> on_delivered) {
+  this->delivery =
+      on_delivered ? new ListenerDelivery(on_delivered) : nullptr;
   for (auto cleanup : this->cleanups) {
     cleanup->finalize(this);
   }
+  // listenerには値の共有ポインタを渡しているので、呼び出しを待たずに破棄してよい
   for (auto cleanup : this->cleanups) {
     cleanup->refresh(this->get_id());
   }
+  if (this->delivery != nullptr) {
+    ListenerDelivery *delivery = this->delivery;
+    this->delivery = nullptr;
+    // 積み終えたので、積んでいた側の分を減らす
+    // 完了が通知されるとこのインスタンスは破棄されうるので、以降thisに触れない
+    delivery->finish();
+  }
 }
 
 ID InnerTransaction::get_id() { return id; }
@@ -168,6 +244,9 @@ JoinHandler::JoinHandler(JoinHandler &&other) {
 
 JoinHandler::~JoinHandler() {
   this->join();
+  if (this->message != nullptr) {
+    delete this->message->transaction;
+  }
   delete this->message;
 }
 
@@ -178,7 +257,7 @@ void JoinHandler::join() {
   this->message->wait();
 }
 
-Transaction::Transaction() {
+Transaction::Transaction() : opened(true) {
   if (current_transaction == nullptr) {
     current_transaction = new InnerTransaction;
     this->inner = current_transaction;
@@ -187,6 +266,21 @@ Transaction::Transaction() {
   }
 }
 
+Transaction::Transaction(std::try_to_lock_t) : inner(nullptr), opened(true) {
+  if (current_transaction != nullptr) {
+    // 外のトランザクションに含まれるので枠は要らない
+    return;
+  }
+  if (not transaction_window.try_acquire()) {
+    this->opened = false;
+    return;
+  }
+  current_transaction = new InnerTransaction(std::adopt_lock);
+  this->inner = current_transaction;
+}
+
+bool Transaction::is_open() const { return this->opened; }
+
 Transaction::~Transaction() {
   if (this->inner != nullptr) {
     delete this->inner;
@@ -195,12 +289,17 @@ Transaction::~Transaction() {
 }
 
 JoinHandler Transaction::get_join_handler() {
+  if (not this->opened) {
+    failure_log("開始できなかったトランザクションからJoinHandlerは取得できません");
+  }
   if (this->inner == nullptr) {
     failure_log(
         "既にハンドラを取得しているか、このオブジェクトからJoinHandlerを取得す"
         "ることはできません");
   }
 
+  // 終了処理の後にJoinHandlerが破棄する
+  this->inner->hand_over();
   TransactionExecuteMessage *msg = new TransactionExecuteMessage(this->inner);
   ExecutorMessage emsg = msg;
   Executor::messages.push(emsg);
@@ -215,4 +314,89 @@ JoinHandler Transaction::get_join_handler() {
 
 bool JoinHandler::finished() { return this->message->finished(); }
 
+void JoinHandler::then(std::function<void()> f) {
+  if (this->message == nullptr) {
+    f();
+    return;
+  }
+  this->message->then(f);
+}
+
+std::future<void>
+Transaction::commit_async(std::function<void()> on_complete) {
+  if (not this->opened) {
+    failure_log("開始できなかったトランザクションは終了できません");
+  }
+  if (this->inner == nullptr) {
+    failure_log("既にハンドラを取得しているか、このオブジェクトからトランザクシ"
+                "ョンを終了することはできません");
+  }
+
+  // メッセージとトランザクションはExecutorが終了処理の後に破棄する
+  this->inner->hand_over();
+  TransactionExecuteMessage *msg =
+      new TransactionExecuteMessage(this->inner, on_complete);
+  std::future<void> res = msg->get_future();
+
+  // グローバルのトランザクションを消す
+  // on_completeの中でこのオブジェクトが破棄されることがあるので、送る前に済ませておく
+  current_transaction = nullptr;
+  this->inner = nullptr;
+
+  ExecutorMessage emsg = msg;
+  Executor::messages.push(emsg);
+
+  return res;
+}
+
+TransactionWindow::TransactionWindow() : inflight(0), waiters(0) {}
+
+bool TransactionWindow::try_acquire(u64 n) {
+  u64 limit = max_inflight_transactions;
+  if (limit == 0) {
+    this->inflight.fetch_add(n);
+    return true;
+  }
+  u64 current = this->inflight.load();
+  while (current + n <= limit) {
+    if (this->inflight.compare_exchange_weak(current, current + n)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void TransactionWindow::acquire(u64 n) {
+  for (u64 i = 0; i < SPIN_COUNT; ++i) {
+    if (this->try_acquire(n)) {
+      return;
+    }
+    std::this_thread::yield();
+  }
+  std::unique_lock<std::mutex> lock(this->mtx);
+  this->waiters.fetch_add(1);
+  this->cond.wait(lock, [this, n]() -> bool { return this->try_acquire(n); });
+  this->waiters.fetch_sub(1);
+}
+
+void TransactionWindow::release() {
+  this->inflight.fetch_sub(1);
+  // 待っているスレッドがいる場合だけ起こす
+  // 必要な枠の数が違うスレッドが待っていることがあるので、全員に確認させる
+  if (this->waiters.load() != 0) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->cond.notify_all();
+  }
+}
+
+u64 TransactionWindow::size() { return this->inflight.load(); }
+
+void TransactionWindow::reset() {
+  std::lock_guard<std::mutex> lock(this->mtx);
+  this->inflight.store(0);
+  this->cond.notify_all();
+}
+
+TransactionWindow transaction_window;
+
 } // namespace prf
@@ -1,11 +1,16 @@
 #pragma once
 
 #include "prf/executor.hpp"
+#include "prf/listener.hpp"
 #include "prf/time_invariant_values.hpp"
 #include "prf/types.hpp"
 #include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <future>
 #include <map>
+#include <memory_resource>
+#include <mutex>
 #include <queue>
 #include <set>
 #include <vector>
@@ -13,6 +18,7 @@
 namespace prf {
 
 class TransactionExecuteMessage;
+class TransactionBatch;
 class TimeInvariantValues;
 class InnerTransaction;
 
@@ -61,6 +67,13 @@ public:
    * 更新処理が終了しているかをブロッキングせず返す
    */
   bool finished();
+
+  /**
+   * 更新処理が終了したときにfを呼び出すよう登録する
+   * fはExecutorのスレッドで呼び出されるので、重い処理は別のスレッドに移すこと
+   * 既に終了していれば、この場で呼び出す
+   */
+  void then(std::function<void()> f);
 };
 
 /**
@@ -90,31 +103,58 @@ private:
    */
   bool updating;
 
+  /**
+   * Executorに引き渡されたか
+   * 引き渡した後はExecutorが終了処理の後に破棄するので、破棄しても更新処理は開始しない
+   */
+  bool handed_over = false;
+
+  static constexpr size_t ARENA_BUFFER_SIZE = 1024;
+
+  /**
+   * 以下の管理用のコンテナが使う領域
+   * 解放は行なわず、このインスタンスの破棄でまとめて解放する
+   * 足りなくなった分だけnewで確保する
+   * 全てのコンストラクタで同じように初期化するので、宣言で初期化しておく
+   */
+  alignas(std::max_align_t) std::byte arena_buffer[ARENA_BUFFER_SIZE];
+  std::pmr::monotonic_buffer_resource arena{arena_buffer, ARENA_BUFFER_SIZE};
+
   /**
    * 更新中のクラスターで更新が必要な時変値の一覧
    */
-  std::set<TimeInvariantValues *> targets_inside_current_cluster;
+  std::pmr::set<TimeInvariantValues *> targets_inside_current_cluster{&arena};
 
   /**
    * クラスター内の実行をするための優先度付きキュー
    */
   std::priority_queue<std::pair<u64, TimeInvariantValues *>,
-                      std::vector<std::pair<u64, TimeInvariantValues *>>,
+                      std::pmr::vector<std::pair<u64, TimeInvariantValues *>>,
                       std::greater<std::pair<u64, TimeInvariantValues *>>>
-      executor;
+      executor{std::greater<std::pair<u64, TimeInvariantValues *>>(),
+               std::pmr::vector<std::pair<u64, TimeInvariantValues *>>(
+                   &arena)};
 
   /**
    * 更新中のクラスター以外で更新が必要な時変値の一覧
    */
-  std::map<ID, std::set<TimeInvariantValues *>> targets_outside_current_cluster;
+  std::pmr::map<ID, std::pmr::set<TimeInvariantValues *>>
+      targets_outside_current_cluster{&arena};
 
   /**
    * トランザクションが終了時に不要な値の破棄が必要な時変値の集合
    */
-  std::set<TimeInvariantValues *> cleanups;
+  std::pmr::set<TimeInvariantValues *> cleanups{&arena};
 
   std::vector<std::function<void(ID)>> before_update_hooks;
 
+  /**
+   * 終了処理中に積んだlistenerの呼び出しを数えるもの
+   * listenerをその場で呼び出す場合はnullptr
+   * finalizeの中でのみ有効
+   */
+  ListenerDelivery *delivery;
+
   /**
    * 更新処理を開始する
    */
@@ -127,16 +167,37 @@ private:
 
   InnerTransaction(ID id, ID updating_cluster);
 
+  /**
+   * IDを割り当ててExecutorに登録する
+   */
+  void open();
+
   /**
    * 新しくトランザクションを作るときのロック
    */
   static std::mutex new_transaction_mutex;
 
+  friend class TransactionBatch;
+
 public:
+  /**
+   * 外にトランザクションが無ければ、transaction_windowに空きができるまで待ってから新しく開始する
+   */
   InnerTransaction();
 
+  /**
+   * transaction_windowの枠を既に確保した状態で新しく開始する
+   */
+  InnerTransaction(std::adopt_lock_t);
+
   ~InnerTransaction();
 
+  /**
+   * 終了を待たずにExecutorへ引き渡す
+   * 以降の破棄はExecutorまたはJoinHandlerが終了処理の後に行なう
+   */
+  void hand_over();
+
   /**
    * このトランザクションが更新処理を実行中であるか
    */
@@ -173,6 +234,17 @@ public:
    */
   std::set<ID> target_clusters();
 
+  /**
+   * 値を設定した時変値と更新予定の時変値が属する順序の単位の一覧を返す
+   */
+  std::set<ID> target_domains();
+
+  /**
+   * クラスターが更新予定(+ 済み)であるかを返す
+   * 更新処理中の他のスレッドから結果が登録されていても呼び出せる
+   */
+  bool is_target_cluster(ID cluster_id);
+
   /**
    * このインスタンスの担当範囲について更新する
    */
@@ -183,14 +255,84 @@ public:
    */
   InnerTransaction *generate_sub_transaction(ID updating_cluster);
 
+  /**
+   * FRPの外でlistenしている関数を呼び出す
+   * finalizeにon_deliveredが渡されていればlistener毎のキューに積み、そうでなければその場で呼び出す
+   */
+  void deliver(ListenerQueue &queue, std::function<void()> call);
+
+  /**
+   * このインスタンスで値を設定した時変値について、順序を問わないlistenerを呼び出す
+   */
+  void deliver_unordered();
+
   /**
    * トランザクションの終了処理をする
+   * on_deliveredを渡すと、listenerの呼び出しを待たずに戻り、全ての呼び出しが終わった後にon_deliveredを呼び出す
    */
-  void finalize();
+  void finalize(std::function<void()> on_delivered = nullptr);
 };
 
 extern std::atomic_ulong next_transaction_id;
 
+/**
+ * 同時に存在できるトランザクションの数を制限する窓
+ * トランザクションが生成されてからExecutorで終了処理を終えるまで枠を一つ占有する
+ * 上限はmax_inflight_transactionsで与え、0なら制限しない
+ */
+class TransactionWindow {
+private:
+  std::atomic<u64> inflight;
+  /**
+   * 枠が空くのを待っているスレッドの数
+   */
+  std::atomic<u64> waiters;
+  std::mutex mtx;
+  std::condition_variable cond;
+
+public:
+  /**
+   * 眠る前に空きを確認し直す回数
+   */
+  static constexpr u64 SPIN_COUNT = 64;
+
+  TransactionWindow(const TransactionWindow &) = delete;
+  TransactionWindow &operator=(const TransactionWindow &) = delete;
+
+  TransactionWindow();
+
+  /**
+   * 枠をn個まとめて確保する
+   * 空きが無ければ暫く確認し直し、それでも空かなければ空くまでブロッキングする
+   * 一部だけを確保して待つことはしないので、複数の枠を確保するスレッド同士が互いを待ち続けることは無い
+   */
+  void acquire(u64 n = 1);
+
+  /**
+   * n個の空きがあれば枠をまとめて確保してtrueを返す
+   * 空きが足りなければ何もせずfalseを返す
+   */
+  bool try_acquire(u64 n = 1);
+
+  /**
+   * 枠を一つ返す
+   */
+  void release();
+
+  /**
+   * 占有されている枠の数
+   */
+  u64 size();
+
+  /**
+   * 占有されている枠を全て返す
+   * テストで実行途中のトランザクションを破棄するときを想定している
+   */
+  void reset();
+};
+
+extern TransactionWindow transaction_window;
+
 // 現在のスレッドで動作しているトランザクション
 // 存在しなければnullptrになる
 thread_local extern InnerTransaction *current_transaction;
@@ -201,14 +343,28 @@ thread_local extern InnerTransaction *current_transaction;
 class Transaction {
 private:
   InnerTransaction *inner;
+  bool opened;
 
 public:
   Transaction(const Transaction &) = delete;
   Transaction &operator=(const Transaction &) = delete;
 
   Transaction();
+
+  /**
+   * 同時に存在できるトランザクションの数が上限に達していれば、待たずにトランザクションを開始しないまま作る
+   * 開始できたかはis_open()で確認する
+   */
+  Transaction(std::try_to_lock_t);
+
   ~Transaction();
 
+  /**
+   * このオブジェクトがトランザクションの中にあるか
+   * Transaction(std::try_to_lock)で枠を確保できなかった場合にfalseになる
+   */
+  bool is_open() const;
+
   /**
    * トランザクションの終了処理をJoinHandlerに移譲する
    * これを呼び出すと ~Transaction()
@@ -217,6 +373,14 @@ public:
    * また、このメソッドを呼び出すことでトランザクションがそこで終了するので、それ以降はsend等をした際は他のトランザションの管轄となる
    */
   JoinHandler get_join_handler();
+
+  /**
+   * トランザクションを終了し、更新の終了を待たずに戻る
+   * on_completeを渡すと、Executorが終了処理をした後にワーカーのスレッドで呼び出される
+   * 返されるfutureはon_completeの呼び出しが終わった時点で完了する
+   * get_join_handlerと同じく、これを呼び出した後のsend等は他のトランザクションの管轄となる
+   */
+  std::future<void> commit_async(std::function<void()> on_complete = nullptr);
 };
 
 } // namespace prf
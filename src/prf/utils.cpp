@@ -9,9 +9,28 @@ Waiter::Waiter() : already_done(false) {}
 Waiter::~Waiter() {}
 
 void Waiter::done() {
-  std::lock_guard<std::mutex> lock(this->mtx);
-  this->already_done.store(true);
-  this->cond.notify_all();
+  std::vector<std::function<void()>> callbacks;
+  {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->already_done.store(true);
+    this->cond.notify_all();
+    callbacks.swap(this->callbacks);
+  }
+  // 呼び出した先でこのオブジェクトが破棄されることがあるので、ロックの外で呼ぶ
+  for (auto &f : callbacks) {
+    f();
+  }
+}
+
+void Waiter::then(std::function<void()> f) {
+  {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    if (not this->already_done.load()) {
+      this->callbacks.push_back(f);
+      return;
+    }
+  }
+  f();
 }
 
 void Waiter::wait() {
@@ -1,9 +1,16 @@
+#pragma once
 #include "prf/types.hpp"
 #include <atomic>
 #include <condition_variable>
+#include <cstddef>
+#include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace prf {
 // 値の列に対して0を含む異なる自然数を適当に振り分ける
@@ -46,6 +53,11 @@ private:
   std::mutex mtx;
   std::condition_variable cond;
 
+  /**
+   * 終了したときに呼び出す関数
+   */
+  std::vector<std::function<void()>> callbacks;
+
 public:
   Waiter(const Waiter &) = delete;
   Waiter &operator=(const Waiter &) = delete;
@@ -67,6 +79,66 @@ public:
    * 終了しているかを確認する
    */
   bool sample();
+
+  /**
+   * 終了したときにfを呼び出すよう登録する
+   * fはdone()を呼び出したスレッドで呼び出される
+   * 既に終了していれば、この場で呼び出す
+   */
+  void then(std::function<void()> f);
+};
+
+/**
+ * 生成時に容量が決まり、移動できない型も並べられる配列
+ * 要素は一度に確保した領域に並べて置かれる
+ */
+template <class T> class FixedArray {
+private:
+  using Storage = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+  size_t capacity;
+  size_t count;
+  std::unique_ptr<Storage[]> storage;
+
+public:
+  FixedArray(const FixedArray &) = delete;
+  FixedArray &operator=(const FixedArray &) = delete;
+
+  FixedArray(size_t capacity)
+      : capacity(capacity), count(0), storage(new Storage[capacity]) {}
+
+  ~FixedArray() {
+    while (this->count != 0) {
+      --this->count;
+      (*this)[this->count].~T();
+    }
+  }
+
+  /**
+   * 末尾に要素を作る
+   * 容量を超えてはいけない
+   */
+  template <class... Args> T &emplace_back(Args &&...args) {
+    T *res = new (&this->storage[this->count]) T(std::forward<Args>(args)...);
+    ++this->count;
+    return *res;
+  }
+
+  /**
+   * 末尾の領域を渡してconstructに要素を作らせる
+   * 呼び出し側からしか見えないコンストラクタを使う場合に用いる
+   */
+  template <class F> T &construct_back(F construct) {
+    T *res = construct(static_cast<void *>(&this->storage[this->count]));
+    ++this->count;
+    return *res;
+  }
+
+  T &operator[](size_t index) {
+    return *std::launder(reinterpret_cast<T *>(&this->storage[index]));
+  }
+
+  size_t size() const { return this->count; }
 };
 } // namespace utils
 } // namespace prf
@@ -0,0 +1,214 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace prf {
+
+/**
+ * 時変値の値を置く、同じ大きさのブロックの使い回し
+ *
+ * 最初に確保した大きさのブロックだけを使い回し、それ以外の大きさはそのままnewする。
+ * 返却はどのスレッドからでもロックを取らずにreturnedへ積む。
+ * 確保する側はreturnedをまとめて引き取り、手元のfreeから取り出す。
+ * 確保した値より長く生存させること。
+ */
+class ValuePool {
+private:
+  struct Block {
+    Block *next;
+  };
+
+  std::atomic<size_t> block_size;
+
+  /**
+   * 確保する側だけが触るブロックの列
+   * acquiringで保護する
+   */
+  Block *free;
+  std::atomic_flag acquiring = ATOMIC_FLAG_INIT;
+
+  /**
+   * 返却されたブロックの列
+   */
+  std::atomic<Block *> returned;
+
+  static void release_all(Block *block) {
+    while (block != nullptr) {
+      Block *next = block->next;
+      ::operator delete(block);
+      block = next;
+    }
+  }
+
+public:
+  ValuePool(const ValuePool &) = delete;
+  ValuePool &operator=(const ValuePool &) = delete;
+
+  ValuePool() : block_size(0), free(nullptr), returned(nullptr) {}
+
+  ~ValuePool() {
+    release_all(this->free);
+    release_all(this->returned.load());
+  }
+
+  void *allocate(size_t size) {
+    if (size < sizeof(Block)) {
+      size = sizeof(Block);
+    }
+    size_t expected = 0;
+    if (not this->block_size.compare_exchange_strong(expected, size) and
+        expected != size) {
+      return ::operator new(size);
+    }
+
+    Block *block = nullptr;
+    while (this->acquiring.test_and_set(std::memory_order_acquire)) {
+    }
+    if (this->free == nullptr) {
+      this->free = this->returned.exchange(nullptr, std::memory_order_acquire);
+    }
+    if (this->free != nullptr) {
+      block = this->free;
+      this->free = block->next;
+    }
+    this->acquiring.clear(std::memory_order_release);
+
+    if (block == nullptr) {
+      return ::operator new(size);
+    }
+    return block;
+  }
+
+  void deallocate(void *ptr, size_t size) {
+    if (size < sizeof(Block)) {
+      size = sizeof(Block);
+    }
+    if (size != this->block_size.load()) {
+      ::operator delete(ptr);
+      return;
+    }
+    Block *block = static_cast<Block *>(ptr);
+    block->next = this->returned.load(std::memory_order_relaxed);
+    while (not this->returned.compare_exchange_weak(
+        block->next, block, std::memory_order_release,
+        std::memory_order_relaxed)) {
+    }
+  }
+};
+
+/**
+ * ValuePoolから確保するアロケータ
+ * std::allocate_sharedに渡し、制御ブロックと値を一つのブロックに置く
+ */
+template <class T> class PoolAllocator {
+private:
+  template <class U> friend class PoolAllocator;
+
+  ValuePool *pool;
+
+public:
+  using value_type = T;
+
+  PoolAllocator(ValuePool *pool) : pool(pool) {}
+
+  template <class U>
+  PoolAllocator(const PoolAllocator<U> &other) : pool(other.pool) {}
+
+  T *allocate(size_t n) {
+    if (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+      return static_cast<T *>(
+          ::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+    }
+    return static_cast<T *>(this->pool->allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T *ptr, size_t n) {
+    if (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+      ::operator delete(ptr, std::align_val_t(alignof(T)));
+      return;
+    }
+    this->pool->deallocate(ptr, n * sizeof(T));
+  }
+
+  template <class U> bool operator==(const PoolAllocator<U> &other) const {
+    return this->pool == other.pool;
+  }
+
+  template <class U> bool operator!=(const PoolAllocator<U> &other) const {
+    return this->pool != other.pool;
+  }
+};
+
+/**
+ * poolから確保した値をshared_ptrで返す
+ */
+template <class T, class... Args>
+std::shared_ptr<T> make_pooled(ValuePool &pool, Args &&...args) {
+  return std::allocate_shared<T>(PoolAllocator<T>(&pool),
+                                 std::forward<Args>(args)...);
+}
+
+/**
+ * 値を確保せずにそのまま持つ入れ物
+ * shared_ptrと同じく*と->で値を読み、nullptrで空を表す
+ * コピーすると値ごと複製されるので、参照カウントも持たない
+ */
+template <class T> class InlineValue {
+private:
+  std::optional<T> value;
+
+public:
+  InlineValue() : value(std::nullopt) {}
+  InlineValue(std::nullptr_t) : value(std::nullopt) {}
+  explicit InlineValue(T value) : value(value) {}
+
+  T &operator*() { return *this->value; }
+  const T &operator*() const { return *this->value; }
+  T *operator->() { return &*this->value; }
+  const T *operator->() const { return &*this->value; }
+
+  explicit operator bool() const { return this->value.has_value(); }
+
+  void reset() { this->value.reset(); }
+};
+
+/**
+ * 時変値の値を確保せずにそのまま持つ型の大きさの上限
+ */
+constexpr size_t INLINE_VALUE_MAX_SIZE = 64;
+
+/**
+ * 時変値の値を確保せずにそのまま持つか
+ * キャッシュラインに収まり、コピーがただの複写で済む型はそのまま持つ
+ */
+template <class T>
+constexpr bool is_inline_value_v =
+    std::is_trivially_copyable_v<T> and sizeof(T) <= INLINE_VALUE_MAX_SIZE;
+
+/**
+ * 時変値が値を保持し、listener等へ受け渡すときの型
+ * is_inline_value_vならInlineValue、そうでなければValuePoolから確保したshared_ptr
+ */
+template <class T>
+using ValueRef = std::conditional_t<is_inline_value_v<T>, InlineValue<T>,
+                                    std::shared_ptr<T>>;
+
+/**
+ * 時変値の値を作る
+ * そのまま持てる型はpoolを使わない
+ */
+template <class T, class... Args>
+ValueRef<T> make_value(ValuePool &pool, Args &&...args) {
+  if constexpr (is_inline_value_v<T>) {
+    (void)pool;
+    return InlineValue<T>(T(std::forward<Args>(args)...));
+  } else {
+    return make_pooled<T>(pool, std::forward<Args>(args)...);
+  }
+}
+} // namespace prf
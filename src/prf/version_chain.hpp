@@ -0,0 +1,184 @@
+#pragma once
+#include "prf/types.hpp"
+#include "prf/value_pool.hpp"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace prf {
+
+/**
+ * トランザクションIDを版とする値の列
+ * Cellのように、ある論理時刻での値としてそれ以前で最新の値を読むものに使う
+ *
+ * 版は新しい順に単方向リストで繋がっていて、読み込みはロックを取らずにリストを辿る。
+ * 書き込みと破棄は呼び出し側で排他すること。
+ * 値はValueRefで持つので、小さな型は版の中にそのまま置かれる。
+ *
+ * 外した版はエポックが二つ進むまで解放しない。
+ * 読み込みは開始時のエポックで読み込み中の数を数え、
+ * 前のエポックで読み込みを始めたものが居なくなった時点でエポックを進めて、その前に外した版を解放する。
+ */
+template <class T> class VersionChain {
+public:
+  class Version {
+  public:
+    ID id;
+    ValueRef<T> value;
+
+    /**
+     * 読み込む前に呼び出し側の排他を取る必要がある版か
+     * CellSink::send_coalescedのように、公開した後で値を置き換えうる版に使う
+     */
+    std::atomic<bool> guarded;
+
+    /**
+     * 一つ古い版
+     */
+    std::atomic<Version *> older;
+
+    Version(ID id, ValueRef<T> value, bool guarded)
+        : id(id), value(std::move(value)), guarded(guarded),
+          older(nullptr) {}
+  };
+
+  /**
+   * 読み込みの間、外された版が解放されないようにする
+   */
+  class ReadGuard {
+  private:
+    VersionChain &chain;
+    u64 slot;
+
+  public:
+    ReadGuard(const ReadGuard &) = delete;
+    ReadGuard &operator=(const ReadGuard &) = delete;
+
+    ReadGuard(VersionChain &chain) : chain(chain) {
+      while (true) {
+        u64 epoch = chain.epoch.load();
+        chain.readers[epoch & 1].fetch_add(1);
+        if (chain.epoch.load() == epoch) {
+          slot = epoch & 1;
+          return;
+        }
+        // 数え始める前にエポックが進んだので数え直す
+        chain.readers[epoch & 1].fetch_sub(1);
+      }
+    }
+
+    ~ReadGuard() { chain.readers[slot].fetch_sub(1); }
+  };
+
+private:
+  std::atomic<Version *> newest;
+
+  std::atomic<u64> epoch;
+  std::atomic<u64> readers[2];
+
+  /**
+   * エポックの偶奇毎の、外したがまだ解放していない版
+   */
+  std::vector<Version *> retired[2];
+
+  void retire(Version *version) {
+    this->retired[this->epoch.load() & 1].push_back(version);
+  }
+
+  /**
+   * 前のエポックで読み込みを始めたものが居なければエポックを進める
+   */
+  void try_advance() {
+    u64 current = this->epoch.load();
+    u64 previous = (current + 1) & 1;
+    if (this->readers[previous].load() != 0) {
+      return;
+    }
+    for (Version *version : this->retired[previous]) {
+      delete version;
+    }
+    this->retired[previous].clear();
+    this->epoch.store(current + 1);
+  }
+
+public:
+  VersionChain(const VersionChain &) = delete;
+  VersionChain &operator=(const VersionChain &) = delete;
+
+  VersionChain() : newest(nullptr), epoch(0), readers{0, 0} {}
+
+  ~VersionChain() {
+    Version *version = this->newest.load();
+    while (version != nullptr) {
+      Version *older = version->older.load();
+      delete version;
+      version = older;
+    }
+    for (std::vector<Version *> &versions : this->retired) {
+      for (Version *version : versions) {
+        delete version;
+      }
+    }
+  }
+
+  /**
+   * transaction_id以前で最新の版を返す
+   * 無ければnullptrを返す
+   * ReadGuardを持っている間だけ使える
+   */
+  Version *find(ID transaction_id) const {
+    Version *version = this->newest.load(std::memory_order_acquire);
+    while (version != nullptr and version->id > transaction_id) {
+      version = version->older.load(std::memory_order_acquire);
+    }
+    return version;
+  }
+
+  /**
+   * transaction_idの版を追加する
+   * 既にあれば新しい版で置き換える
+   * guardedを立てる版は、繋ぐ前に立てておかないと排他を取らずに読まれることがある
+   */
+  Version *put(ID transaction_id, ValueRef<T> value,
+               bool guarded = false) {
+    Version *version =
+        new Version(transaction_id, std::move(value), guarded);
+    std::atomic<Version *> *link = &this->newest;
+    Version *current = link->load();
+    while (current != nullptr and current->id > transaction_id) {
+      link = &current->older;
+      current = link->load();
+    }
+    if (current != nullptr and current->id == transaction_id) {
+      version->older.store(current->older.load());
+      link->store(version, std::memory_order_release);
+      this->retire(current);
+    } else {
+      version->older.store(current);
+      link->store(version, std::memory_order_release);
+    }
+    return version;
+  }
+
+  bool contains(ID transaction_id) const {
+    Version *version = this->find(transaction_id);
+    return version != nullptr and version->id == transaction_id;
+  }
+
+  /**
+   * transaction_id以前で最新の版より古い版を外す
+   */
+  void truncate(ID transaction_id) {
+    Version *version = this->find(transaction_id);
+    if (version == nullptr) {
+      return;
+    }
+    Version *older = version->older.exchange(nullptr);
+    while (older != nullptr) {
+      this->retire(older);
+      older = older->older.load();
+    }
+    this->try_advance();
+  }
+};
+} // namespace prf
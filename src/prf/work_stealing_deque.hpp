@@ -0,0 +1,133 @@
+#pragma once
+#include "prf/types.hpp"
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace prf {
+/**
+ * Chase-Levの両端キュー
+ * 所有者のスレッドだけが push/take で末尾を操作し、他のスレッドは steal で先頭から奪う
+ * 要素はatomicに読み書きされるのでポインタなどの小さな型を入れることを想定している
+ */
+template <class T> class WorkStealingDeque {
+private:
+  /**
+   * 循環バッファ
+   * 大きさは常に2のべき乗である
+   */
+  class Buffer {
+    const i64 capacity;
+    std::unique_ptr<std::atomic<T>[]> data;
+
+  public:
+    Buffer(i64 capacity)
+        : capacity(capacity), data(new std::atomic<T>[capacity]) {}
+
+    i64 size() const { return capacity; }
+
+    T get(i64 index) const {
+      return data[index & (capacity - 1)].load(std::memory_order_relaxed);
+    }
+
+    void put(i64 index, T value) {
+      data[index & (capacity - 1)].store(value, std::memory_order_relaxed);
+    }
+
+    Buffer *grow(i64 bottom, i64 top) const {
+      Buffer *res = new Buffer(capacity * 2);
+      for (i64 i = top; i < bottom; ++i) {
+        res->put(i, get(i));
+      }
+      return res;
+    }
+  };
+
+  alignas(64) std::atomic<i64> top;
+  alignas(64) std::atomic<i64> bottom;
+  std::atomic<Buffer *> buffer;
+
+  /**
+   * 拡張前のバッファ
+   * stealしているスレッドが参照している可能性があるので破棄まで残しておく
+   */
+  std::vector<std::unique_ptr<Buffer>> old_buffers;
+
+public:
+  WorkStealingDeque(const WorkStealingDeque &) = delete;
+  WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+  WorkStealingDeque(i64 capacity = 256)
+      : top(0), bottom(0), buffer(new Buffer(capacity)) {}
+  ~WorkStealingDeque() { delete buffer.load(); }
+
+  /**
+   * 末尾に追加する
+   * 所有者のスレッドからのみ呼び出すこと
+   */
+  void push(T value) {
+    i64 b = bottom.load(std::memory_order_relaxed);
+    i64 t = top.load(std::memory_order_acquire);
+    Buffer *buf = buffer.load(std::memory_order_relaxed);
+    if (b - t > buf->size() - 1) {
+      Buffer *grown = buf->grow(b, t);
+      old_buffers.emplace_back(buf);
+      buffer.store(grown, std::memory_order_release);
+      buf = grown;
+    }
+    buf->put(b, value);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  /**
+   * 末尾から取り出す
+   * 所有者のスレッドからのみ呼び出すこと
+   */
+  std::optional<T> take() {
+    i64 b = bottom.load(std::memory_order_relaxed) - 1;
+    Buffer *buf = buffer.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    i64 t = top.load(std::memory_order_relaxed);
+    if (t > b) {
+      // 空だった
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return std::nullopt;
+    }
+    T value = buf->get(b);
+    if (t == b) {
+      // 最後の一つはstealと競合するのでCASで決着をつける
+      bool won = top.compare_exchange_strong(
+          t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      bottom.store(b + 1, std::memory_order_relaxed);
+      if (not won) {
+        return std::nullopt;
+      }
+    }
+    return value;
+  }
+
+  /**
+   * 先頭から奪う
+   * どのスレッドからでも呼び出せる
+   * 他のスレッドと競合して失敗した場合もnulloptを返す
+   */
+  std::optional<T> steal() {
+    i64 t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    i64 b = bottom.load(std::memory_order_acquire);
+    if (t >= b) {
+      return std::nullopt;
+    }
+    Buffer *buf = buffer.load(std::memory_order_acquire);
+    T value = buf->get(t);
+    if (not top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                        std::memory_order_relaxed)) {
+      return std::nullopt;
+    }
+    return value;
+  }
+};
+} // namespace prf
@@ -0,0 +1,153 @@
+#include "prf/batch.hpp"
+#include "prf/cluster.hpp"
+#include "prf/prf.hpp"
+#include "prf/stream.hpp"
+#include "test_utils.hpp"
+#include <atomic>
+#include <cassert>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+void test_1() {
+  prf::StreamSink<int> s;
+  std::vector<int> results;
+  {
+    prf::Cluster cluster;
+    s.map([](int x) -> int { return x * 2; }).listen([&results](int x) -> void {
+      results.push_back(x);
+    });
+  }
+
+  prf::build();
+
+  std::vector<std::function<void()>> sends;
+  for (int i = 0; i < 100; ++i) {
+    sends.push_back([&s, i]() -> void { s.send(i); });
+  }
+  prf::BatchJoinHandler handler = prf::submit_batch(sends);
+  handler.join();
+
+  assert(handler.finished() && "全てのトランザクションが終了している");
+  assert(results.size() == 100 && "トランザクション毎に更新されている");
+  for (int i = 0; i < 100; ++i) {
+    assert(results[i] == i * 2 && "投入した順にトランザクションが処理されている");
+  }
+}
+
+void test_2() {
+  prf::StreamSink<int> s1, s2;
+  prf::Stream<int> merged;
+  {
+    prf::Cluster cluster;
+    merged = s1.merge(s2, [](int a, int b) -> int { return a + b; });
+  }
+  std::vector<int> results;
+  merged.listen([&results](int x) -> void { results.push_back(x); });
+
+  prf::use_parallel_execution = true;
+  prf::build();
+
+  // 一つのトランザクションの中での複数のsendは同時に起きたものとして扱われる
+  std::vector<std::function<void()>> sends;
+  for (int i = 0; i < 50; ++i) {
+    sends.push_back([&s1, &s2, i]() -> void {
+      s1.send(i);
+      if (i % 2 == 0) {
+        s2.send(1000);
+      }
+    });
+  }
+  {
+    prf::BatchJoinHandler handler = prf::submit_batch(sends);
+  }
+  s1.send(-1);
+
+  assert(results.size() == 51 && "全てのトランザクションが終了している");
+  for (int i = 0; i < 50; ++i) {
+    assert(results[i] == (i % 2 == 0 ? i + 1000 : i) &&
+           "それぞれのトランザクションが独立に更新されている");
+  }
+  assert(results[50] == -1 && "後から作ったトランザクションも更新されている");
+}
+
+void test_3() {
+  // 上限の小さい窓で複数のスレッドから同時に投入しても、枠を取り合って止まらない
+  prf::StreamSink<int> s;
+  std::atomic_int sum(0);
+  {
+    prf::Cluster cluster;
+    s.map([](int x) -> int { return x; }).listen([&sum](int x) -> void {
+      sum.fetch_add(x);
+    });
+  }
+
+  prf::max_inflight_transactions = 8;
+  prf::use_parallel_execution = true;
+  prf::build();
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&s]() -> void {
+      for (int round = 0; round < 10; ++round) {
+        std::vector<std::function<void()>> sends;
+        for (int i = 0; i < 6; ++i) {
+          sends.push_back([&s]() -> void { s.send(1); });
+        }
+        prf::BatchJoinHandler handler = prf::submit_batch(sends);
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  assert(sum.load() == 4 * 10 * 6 && "全てのバッチが終了している");
+}
+
+void test_4() {
+  // 途中で例外が投げられても、確保したIDと枠は全て片付けられる
+  prf::StreamSink<int> s;
+  std::atomic_int sum(0);
+  {
+    prf::Cluster cluster;
+    s.map([](int x) -> int { return x; }).listen([&sum](int x) -> void {
+      sum.fetch_add(x);
+    });
+  }
+
+  prf::max_inflight_transactions = 4;
+  prf::use_parallel_execution = true;
+  prf::build();
+
+  std::vector<std::function<void()>> sends;
+  sends.push_back([&s]() -> void { s.send(1); });
+  sends.push_back([]() -> void { throw std::runtime_error("送信に失敗"); });
+  sends.push_back([&s]() -> void { s.send(100); });
+  sends.push_back([&s]() -> void { s.send(100); });
+
+  bool thrown = false;
+  try {
+    prf::BatchJoinHandler handler = prf::submit_batch(sends);
+  } catch (const std::runtime_error &) {
+    thrown = true;
+  }
+  assert(thrown && "例外は呼び出し元に伝わる");
+  assert(prf::current_transaction == nullptr &&
+         "例外が投げられてもトランザクションは残らない");
+  assert(sum.load() == 1 && "例外より前に送った値は更新されている");
+
+  // 枠が返っていて、IDも欠けていなければ後のトランザクションも終わる
+  for (int i = 0; i < 10; ++i) {
+    s.send(10);
+  }
+  assert(sum.load() == 101 && "例外の後のトランザクションも更新されている");
+}
+
+int main() {
+  run_test(test_1);
+  run_test(test_2);
+  run_test(test_3);
+  run_test(test_4);
+}
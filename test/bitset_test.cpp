@@ -0,0 +1,64 @@
+#include "prf/bitset.hpp"
+#include <cassert>
+#include <vector>
+
+std::vector<size_t> collect(const prf::Bitset &s) {
+  std::vector<size_t> res;
+  for (size_t i = s.find_first(); i < s.size(); i = s.find_next(i)) {
+    res.push_back(i);
+  }
+  return res;
+}
+
+void test_1() {
+  // 語の境界を跨ぐ大きさで確認する
+  prf::Bitset s(300);
+  assert(s.none() && "作った直後は空である");
+  assert(s.find_first() == 300 && "空ならsize()が返る");
+
+  s.set(0);
+  s.set(63);
+  s.set(64);
+  s.set(255);
+  s.set(299);
+  assert(collect(s) == (std::vector<size_t>{0, 63, 64, 255, 299}) &&
+         "立っているビットを昇順に走査できる");
+  assert(s.count() == 5 && "立っているビットの数が正しい");
+
+  s.reset(0);
+  s.reset(299);
+  assert(collect(s) == (std::vector<size_t>{63, 64, 255}) &&
+         "落としたビットは走査されない");
+}
+
+void test_2() {
+  prf::Bitset a(300), b(300);
+  for (size_t i = 0; i < 300; i += 3) {
+    a.set(i);
+  }
+  for (size_t i = 0; i < 300; i += 5) {
+    b.set(i);
+  }
+
+  prf::Bitset u = a;
+  u |= b;
+  prf::Bitset d = a;
+  d.and_not(b);
+  prf::Bitset x = a;
+  x &= b;
+  for (size_t i = 0; i < 300; ++i) {
+    bool in_a = i % 3 == 0, in_b = i % 5 == 0;
+    assert(u.test(i) == (in_a or in_b) && "和集合が正しい");
+    assert(d.test(i) == (in_a and not in_b) && "差集合が正しい");
+    assert(x.test(i) == (in_a and in_b) && "積集合が正しい");
+  }
+
+  d.and_not(a);
+  assert(d.none() && "自分を含む集合を引くと空になる");
+  assert(a.intersects(b) && "共通するビットがある");
+}
+
+int main() {
+  test_1();
+  test_2();
+}
@@ -6,6 +6,9 @@
 #include "string"
 #include "test_utils.hpp"
 #include <cassert>
+#include <chrono>
+#include <thread>
+#include <vector>
 
 void test_1() {
   prf::CellSink<int> c1(3);
@@ -105,9 +108,41 @@ void test_4() {
   assert(sum == 10 && "GlobalCellLoopが正しく動作している");
 }
 
+void test_5() {
+  prf::CellSink<int> c1(0);
+
+  // 下流の更新を遅くして、送った値が溜まるようにする
+  prf::Cluster cluster;
+  prf::Cell<int> c2 = c1.map([](int n) -> int {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return n * 2;
+  });
+  cluster.close();
+
+  std::vector<int> results;
+  c2.listen([&results](int n) -> void { results.push_back(n); });
+
+  prf::build();
+
+  for (int i = 1; i <= 100; ++i) {
+    c1.send_coalesced(i);
+  }
+  // 通常のsendは前のトランザクションが全て終わってから戻る
+  c1.send(1000);
+
+  assert(results.back() == 2000 && "最後の値が反映されている");
+  assert(results[results.size() - 2] == 200 &&
+         "send_coalescedで最後に送った値は捨てられていない");
+  assert(results.size() < 50 && "読まれる前の値はまとめられている");
+  for (size_t i = 1; i < results.size(); ++i) {
+    assert(results[i - 1] < results[i] && "値は送った順に反映されている");
+  }
+}
+
 int main() {
   run_test(test_1);
   run_test(test_2);
   run_test(test_3);
   run_test(test_4);
+  run_test(test_5);
 }
@@ -1,6 +1,9 @@
 #include "prf/concurrent_queue.hpp"
 #include <cassert>
+#include <memory>
+#include <optional>
 #include <thread>
+#include <vector>
 
 void test_1() {
   prf::ConcurrentQueue<int> vs;
@@ -25,4 +28,107 @@ void test_1() {
   assert(sum == 6 && "ConcurrentQueueで適切にデータの輸送ができてきる");
 }
 
-int main() { test_1(); }
+void test_2() {
+  // 容量が小さくても満杯の間は溢れた分に積むので値が失われない
+  prf::MpscRingQueue<std::unique_ptr<int>> vs(4);
+
+  const int PRODUCERS = 4;
+  const int COUNT = 1000;
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < PRODUCERS; ++p) {
+    producers.push_back(std::thread([&vs]() {
+      for (int i = 1; i <= COUNT; ++i) {
+        vs.push(std::make_unique<int>(i));
+      }
+    }));
+  }
+
+  long long sum = 0;
+  for (int i = 0; i < PRODUCERS * COUNT; ++i) {
+    std::optional<std::unique_ptr<int>> v = vs.pop();
+    assert(v.has_value() && "停止前は値が返る");
+    sum += **v;
+  }
+
+  for (auto &producer : producers) {
+    producer.join();
+  }
+
+  assert(sum == (long long)PRODUCERS * COUNT * (COUNT + 1) / 2 &&
+         "MpscRingQueueで複数のスレッドから適切にデータの輸送ができている");
+  assert(not vs.try_pop().has_value() && "全て取り出した後は空になる");
+}
+
+void test_3() {
+  prf::MpscRingQueue<int> vs;
+
+  std::thread t([&vs]() {
+    std::optional<int> v = vs.pop();
+    assert(not v.has_value() && "停止の通知でnulloptが返る");
+  });
+
+  vs.notify_stop();
+  t.join();
+
+  vs.clear_stop();
+  vs.push(1);
+  assert(*vs.pop() == 1 && "停止を取り消した後は再度利用できる");
+}
+
+void test_4() {
+  prf::MpscRingQueue<int> vs;
+  prf::ConcurrentQueue<int> cs;
+  for (int i = 1; i <= 10; ++i) {
+    vs.push(i);
+    cs.push(i);
+  }
+
+  std::vector<int> batch;
+  assert(vs.drain(batch) && "停止前はtrueが返る");
+  assert(batch.size() == 10 && "溜まっている値が全て取り出される");
+  for (int i = 0; i < 10; ++i) {
+    assert(batch[i] == i + 1 && "取り出した順序が保たれている");
+  }
+  assert(not vs.try_pop().has_value() && "drainの後は空になる");
+
+  batch.clear();
+  assert(cs.drain(batch) && batch.size() == 10 &&
+         "ConcurrentQueueでも溜まっている値が全て取り出される");
+
+  vs.notify_stop();
+  batch.clear();
+  assert(not vs.drain(batch) && "停止の通知でfalseが返る");
+}
+
+void test_5() {
+  prf::MpscRingQueue<int> vs(4);
+
+  // 消費者と同じスレッドから容量を越えてpushしても待たずに戻る
+  for (int i = 0; i < 100; ++i) {
+    vs.push(i);
+  }
+  for (int i = 0; i < 50; ++i) {
+    assert(*vs.try_pop() == i && "溢れた値も積んだ順に取り出される");
+  }
+  // 溢れた値が残っている間に積んだ値は、それより後に取り出される
+  for (int i = 100; i < 110; ++i) {
+    vs.push(i);
+  }
+  for (int i = 50; i < 110; ++i) {
+    std::optional<int> v = vs.try_pop();
+    assert(v.has_value() && *v == i && "取り出した順序が保たれている");
+  }
+  assert(not vs.try_pop().has_value() && "全て取り出した後は空になる");
+
+  vs.push(200);
+  assert(*vs.pop() == 200 && "溢れた値を取り出した後はリングに積まれる");
+}
+
+int main() {
+  test_1();
+  test_2();
+  test_3();
+  test_4();
+  test_5();
+}
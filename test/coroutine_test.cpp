@@ -0,0 +1,176 @@
+#include "prf/cluster.hpp"
+#include "prf/coroutine.hpp"
+#include "prf/prf.hpp"
+#include "prf/stream.hpp"
+#include "prf/transaction.hpp"
+#include "test_utils.hpp"
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * 戻り値を持たず、最後まで走ったら自分で片付くコルーチン
+ */
+class Task {
+public:
+  class promise_type {
+  public:
+    Task get_return_object() { return Task(); }
+    std::suspend_never initial_suspend() { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+/**
+ * 利用者側で用意するスレッド一つの実行環境
+ */
+class SingleThreadExecutor {
+  std::deque<std::function<void()>> tasks;
+  std::mutex mtx;
+
+public:
+  std::thread::id owner;
+
+  void post(std::function<void()> f) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->tasks.push_back(std::move(f));
+  }
+
+  /**
+   * 溜まった仕事をこのスレッドで実行する
+   */
+  void run_until(std::atomic_int &done, int expected) {
+    this->owner = std::this_thread::get_id();
+    while (done.load() != expected) {
+      std::function<void()> f;
+      {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        if (not this->tasks.empty()) {
+          f = std::move(this->tasks.front());
+          this->tasks.pop_front();
+        }
+      }
+      if (f) {
+        f();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  }
+};
+
+Task produce(prf::StreamSink<int> &s, int value, std::atomic_int &done) {
+  prf::Transaction trans;
+  s.send(value);
+  co_await prf::commit(trans);
+  done.fetch_add(1);
+}
+
+Task join_on(prf::StreamSink<int> &s, int value, SingleThreadExecutor &executor,
+             std::atomic_int &done, std::atomic_bool &wrong_thread) {
+  prf::JoinHandler handler = [&s, value]() {
+    prf::Transaction trans;
+    s.send(value);
+    return trans.get_join_handler();
+  }();
+  co_await prf::resume_on(handler, [&executor](std::function<void()> f) {
+    executor.post(std::move(f));
+  });
+  if (std::this_thread::get_id() != executor.owner) {
+    wrong_thread.store(true);
+  }
+  done.fetch_add(1);
+}
+
+Task commit_on(prf::StreamSink<int> &s, int value,
+               SingleThreadExecutor &executor, std::atomic_int &done,
+               std::atomic_bool &wrong_thread) {
+  prf::Transaction trans;
+  s.send(value);
+  co_await prf::commit(trans, [&executor](std::function<void()> f) {
+    executor.post(std::move(f));
+  });
+  if (std::this_thread::get_id() != executor.owner) {
+    wrong_thread.store(true);
+  }
+  done.fetch_add(1);
+}
+
+void test_1() {
+  prf::StreamSink<int> s;
+  std::atomic_int sum(0);
+  {
+    prf::Cluster cluster;
+    s.map([](int x) -> int { return x; }).listen([&sum](int x) -> void {
+      sum.fetch_add(x);
+    });
+  }
+
+  prf::use_parallel_execution = true;
+  prf::build();
+
+  // 一つのスレッドから多数のコルーチンを走らせても、それぞれがブロッキングしない
+  std::atomic_int done(0);
+  for (int i = 1; i <= 100; ++i) {
+    produce(s, i, done);
+  }
+  while (done.load() != 100) {
+    std::this_thread::yield();
+  }
+  assert(sum.load() == 5050 && "コルーチンから終了したトランザクションが更新されている");
+}
+
+void test_2() {
+  prf::StreamSink<int> s;
+  std::atomic_int sum(0);
+  s.listen([&sum](int x) -> void { sum.fetch_add(x); });
+
+  prf::use_parallel_execution = true;
+  prf::build();
+
+  SingleThreadExecutor executor;
+  std::atomic_int done(0);
+  std::atomic_bool wrong_thread(false);
+  executor.owner = std::this_thread::get_id();
+  for (int i = 1; i <= 10; ++i) {
+    join_on(s, i, executor, done, wrong_thread);
+  }
+  executor.run_until(done, 10);
+
+  assert(sum.load() == 55 && "JoinHandlerを待ったトランザクションが更新されている");
+  assert(not wrong_thread.load() && "指定した実行環境でコルーチンが再開されている");
+}
+
+void test_3() {
+  prf::StreamSink<int> s;
+  std::atomic_int sum(0);
+  s.listen([&sum](int x) -> void { sum.fetch_add(x); });
+
+  prf::use_parallel_execution = true;
+  prf::build();
+
+  SingleThreadExecutor executor;
+  std::atomic_int done(0);
+  std::atomic_bool wrong_thread(false);
+  executor.owner = std::this_thread::get_id();
+  for (int i = 1; i <= 10; ++i) {
+    commit_on(s, i, executor, done, wrong_thread);
+  }
+  executor.run_until(done, 10);
+
+  assert(sum.load() == 55 && "コルーチンから終了したトランザクションが更新されている");
+  assert(not wrong_thread.load() && "指定した実行環境でコルーチンが再開されている");
+}
+
+int main() {
+  run_test(test_1);
+  run_test(test_2);
+  run_test(test_3);
+}
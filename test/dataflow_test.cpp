@@ -0,0 +1,120 @@
+#include "prf/cell.hpp"
+#include "prf/cluster.hpp"
+#include "prf/prf.hpp"
+#include "prf/stream.hpp"
+#include "prf/transaction.hpp"
+#include "test_utils.hpp"
+#include <atomic>
+#include <cassert>
+#include <vector>
+
+void test_1() {
+  std::atomic_int n(0);
+
+  prf::StreamSink<int> s;
+  int sum = 0;
+
+  for (int i = 1; i <= 3; ++i) {
+    prf::Cluster cluster;
+    s.map([&n, i](int x) -> int {
+       if (x == i) {
+         n.fetch_add(1);
+         while (n.load() != 3) {
+         }
+       }
+       return x;
+     }).listen([&sum](int x) -> void { sum += x; });
+  }
+
+  prf::use_parallel_execution = true;
+  prf::use_dataflow_scheduler = true;
+  prf::build();
+
+  std::vector<prf::JoinHandler> handlers;
+  for (int i = 1; i <= 3; ++i) {
+    prf::Transaction trans;
+    s.send(i);
+    handlers.push_back(trans.get_join_handler());
+  }
+
+  for (auto &handler : handlers) {
+    handler.join();
+  }
+
+  assert(sum == 18 && "依存関係から直接更新を進めても並列に更新されている");
+}
+
+void test_2() {
+  // 菱形の依存関係でも同じクラスタはトランザクションの順に更新される
+  prf::StreamSink<int> s;
+  prf::Stream<int> left, right, merged;
+  {
+    prf::Cluster cluster;
+    left = s.map([](int x) -> int { return x + 1; });
+  }
+  {
+    prf::Cluster cluster;
+    right = s.map([](int x) -> int { return x * 2; });
+  }
+  {
+    prf::Cluster cluster;
+    merged = left.merge(right, [](int l, int r) -> int { return l + r; });
+  }
+
+  std::vector<int> results;
+  merged.listen([&results](int x) -> void { results.push_back(x); });
+
+  prf::use_parallel_execution = true;
+  prf::use_dataflow_scheduler = true;
+  prf::build();
+
+  std::vector<prf::JoinHandler> handlers;
+  for (int i = 0; i < 100; ++i) {
+    prf::Transaction trans;
+    s.send(i);
+    handlers.push_back(trans.get_join_handler());
+  }
+  for (auto &handler : handlers) {
+    handler.join();
+  }
+
+  assert(results.size() == 100 && "全てのトランザクションが終了している");
+  for (int i = 0; i < 100; ++i) {
+    assert(results[i] == (i + 1) + i * 2 &&
+           "トランザクションの順番にlistenerが呼び出されている");
+  }
+}
+
+void test_3() {
+  prf::GlobalCellLoop<int> cg;
+
+  // 依存関係に現れないGlobalCellLoopへの更新も取りこぼさない
+  prf::Cluster cluster;
+  prf::StreamSink<int> s1;
+  prf::Stream<int> s2 =
+      s1.snapshot(cg, [](int n, int m) -> int { return n + m; });
+  cg.loop(s2.hold(0));
+  cluster.close();
+
+  prf::use_parallel_execution = true;
+  prf::use_dataflow_scheduler = true;
+  prf::build();
+
+  int sum = 0;
+  s2.listen([&sum](int n) -> void { sum += n; });
+
+  s1.send(1);
+  assert(sum == 1 && "GlobalCellLoopが正しく動作している");
+
+  s1.send(2);
+  assert(sum == 4 && "GlobalCellLoopが正しく動作している");
+
+  s1.send(3);
+  assert(sum == 10 && "GlobalCellLoopが正しく動作している");
+}
+
+int main() {
+  run_test(test_1);
+  run_test(test_2);
+  run_test(test_3);
+}
@@ -0,0 +1,188 @@
+#include "prf/cell.hpp"
+#include "prf/cluster.hpp"
+#include "prf/prf.hpp"
+#include "prf/stream.hpp"
+#include "prf/transaction.hpp"
+#include "test_utils.hpp"
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+
+void test_1() {
+  prf::StreamSink<int> s1;
+  prf::StreamSink<int> s2;
+
+  std::atomic_bool released(false);
+  std::atomic_int slow(0);
+  s1.listen([&released, &slow](int x) -> void {
+    // 遅いlistenerの代わりに、解放されるまで戻らない
+    while (not released.load()) {
+    }
+    slow.store(x);
+  });
+  int fast = 0;
+  s2.listen([&fast](int x) -> void { fast = x; });
+
+  prf::use_pipelined_listeners = true;
+  prf::build();
+
+  std::future<void> future = s1.send_async(1);
+  // s1のlistenerが戻らなくても後のトランザクションは終わる
+  s2.send(2);
+  assert(fast == 2 && "遅いlistenerに他のlistenerが待たされていない");
+  assert(slow.load() == 0 && "遅いlistenerはまだ戻っていない");
+
+  released.store(true);
+  future.wait();
+  assert(slow.load() == 1 &&
+         "トランザクションの完了はlistenerの呼び出しが終わるまで待つ");
+}
+
+void test_2() {
+  prf::StreamSink<int> s;
+  std::vector<int> left, right;
+  prf::Stream<int> doubled;
+  {
+    prf::Cluster cluster;
+    doubled = s.map([](int x) -> int { return x * 2; });
+  }
+  doubled.listen([&left](int x) -> void { left.push_back(x); });
+  doubled.listen([&right](int x) -> void { right.push_back(x); });
+
+  prf::use_parallel_execution = true;
+  prf::use_pipelined_listeners = true;
+  prf::build();
+
+  std::vector<std::future<void>> futures;
+  for (int i = 0; i < 100; ++i) {
+    futures.push_back(s.send_async(i));
+  }
+  for (auto &future : futures) {
+    future.wait();
+  }
+
+  assert(left.size() == 100 && right.size() == 100 &&
+         "全てのlistenerが呼び出されている");
+  for (int i = 0; i < 100; ++i) {
+    assert(left[i] == i * 2 && right[i] == i * 2 &&
+           "listener毎にトランザクションの順で呼び出されている");
+  }
+}
+
+void test_3() {
+  prf::CellSink<int> c(0);
+  int value = -1;
+  c.listen([&value](int x) -> void { value = x; });
+
+  prf::use_pipelined_listeners = true;
+  prf::build();
+
+  c.send(3);
+  assert(value == 3 && "sendはlistenerの呼び出しが終わってから戻る");
+  c.send(4);
+  assert(value == 4 && "sendはlistenerの呼び出しが終わってから戻る");
+}
+
+void test_4() {
+  prf::StreamSink<int> s1;
+  prf::StreamSink<int> s2;
+
+  std::atomic_bool released(false);
+  {
+    // 解放されるまで終わらないクラスタ
+    prf::Cluster cluster;
+    s1.map([&released](int x) -> int {
+      while (not released.load()) {
+      }
+      return x;
+    });
+  }
+  std::atomic_int mapped(0), sent(0);
+  {
+    prf::Cluster cluster;
+    s2.map([](int x) -> int { return x * 2; })
+        .listen_unordered([&mapped](int x) -> void { mapped.fetch_add(x); });
+  }
+  s2.listen_unordered([&sent](int x) -> void { sent.fetch_add(x); });
+
+  prf::use_parallel_execution = true;
+  prf::build();
+
+  std::future<void> blocked = s1.send_async(1);
+  std::future<void> future = s2.send_async(2);
+  // 先のトランザクションが終わらなくても、値が確定した時点で呼び出される
+  while (mapped.load() != 4 or sent.load() != 2) {
+  }
+  assert(not released.load() && "先のトランザクションを待たずに呼び出されている");
+
+  released.store(true);
+  blocked.wait();
+  future.wait();
+}
+
+void test_5() {
+  // listenerの無いトランザクションは積み終えた時点で完了する
+  prf::StreamSink<int> s;
+  prf::Stream<int> doubled;
+  {
+    prf::Cluster cluster;
+    doubled = s.map([](int x) -> int { return x * 2; });
+  }
+
+  prf::use_parallel_execution = true;
+  prf::use_pipelined_listeners = true;
+  prf::build();
+
+  for (int i = 0; i < 10000; ++i) {
+    s.send(i);
+  }
+  std::vector<std::future<void>> futures;
+  for (int i = 0; i < 10000; ++i) {
+    futures.push_back(s.send_async(i));
+  }
+  for (auto &future : futures) {
+    future.wait();
+  }
+}
+
+void test_6() {
+  // listenerの呼び出しが終わるまで、トランザクションの枠は空かない
+  prf::StreamSink<int> s;
+  std::atomic_bool started(false), released(false);
+  std::atomic_int value(0);
+  s.listen([&started, &released, &value](int x) -> void {
+    started.store(true);
+    while (not released.load()) {
+    }
+    value.store(x);
+  });
+
+  prf::max_inflight_transactions = 1;
+  prf::use_pipelined_listeners = true;
+  prf::build();
+
+  std::future<void> future = s.send_async(1);
+  // 終了処理を終えてlistenerの呼び出しに入るまで待つ
+  while (not started.load()) {
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  assert(not s.try_send(2) && "listenerの呼び出し中は枠が埋まっている");
+
+  released.store(true);
+  future.wait();
+  assert(value.load() == 1 && "listenerが呼び出されている");
+  assert(s.try_send(3) && "listenerの呼び出しが終われば枠が空く");
+  assert(value.load() == 3 && "次のトランザクションも更新されている");
+}
+
+int main() {
+  run_test(test_1);
+  run_test(test_2);
+  run_test(test_3);
+  run_test(test_4);
+  run_test(test_5);
+  run_test(test_6);
+}
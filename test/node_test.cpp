@@ -253,6 +253,110 @@ void build_test10() {
          "Loopを利用すると必ず同じクラスタに属する");
 }
 
+void build_test11() {
+  prf::NodeManager nodeManager;
+
+  prf::Node A(1);
+  prf::Node B(2);
+  prf::Node C(3);
+  prf::Node D(4);
+
+  // A -(cluster)-> B -(cluster)-> C
+  // D
+
+  A.link_to(&B);
+  B.link_to(&C);
+
+  nodeManager.register_node(&A);
+  nodeManager.register_node(&B);
+  nodeManager.register_node(&C);
+  nodeManager.register_node(&D);
+
+  nodeManager.build();
+
+  const auto &descendants = nodeManager.get_cluster_descendants();
+  const prf::Bitset &from_a = descendants[A.get_cluster_id()];
+
+  assert(from_a.test(B.get_cluster_id()) && from_a.test(C.get_cluster_id()) &&
+         "推移的に依存しているクラスタに到達できる");
+  assert(not from_a.test(A.get_cluster_id()) &&
+         "到達できるクラスタに自分自身は含まれない");
+  assert(not from_a.test(D.get_cluster_id()) &&
+         "依存関係の無いクラスタには到達できない");
+  assert(descendants[C.get_cluster_id()].none() &&
+         "末端のクラスタからはどこにも到達できない");
+}
+
+void build_test12() {
+  prf::NodeManager nodeManager;
+
+  prf::Node A(0);
+  prf::Node B(1);
+  prf::Node C(0);
+  prf::Node D(2);
+  prf::Node E(3);
+
+  // A(sink) -(cluster)-> B
+  // C(sink) -(cluster)-> D ~(global)~> E
+
+  A.link_to(&B);
+  C.link_to(&D);
+  D.global_link_to(&E);
+
+  nodeManager.register_node(&A);
+  nodeManager.register_node(&B);
+  nodeManager.register_node(&C);
+  nodeManager.register_node(&D);
+  nodeManager.register_node(&E);
+
+  nodeManager.build();
+
+  assert(nodeManager.get_domain_count() == 2 &&
+         "弱連結成分毎に順序の単位が割り当てられる");
+  assert(A.get_domain_id() == B.get_domain_id() &&
+         C.get_domain_id() == D.get_domain_id() &&
+         "依存関係の有るノードは同じ順序の単位に属する");
+  assert(A.get_domain_id() != C.get_domain_id() &&
+         "関係の無いSink系列は別の単位になる");
+  assert(D.get_domain_id() == E.get_domain_id() &&
+         "連動して更新されるノードは同じ順序の単位に属する");
+}
+
+void build_test13() {
+  prf::NodeManager nodeManager;
+
+  prf::Node A(0);
+  prf::Node B(0);
+  prf::Node C(0);
+  prf::Node D(1);
+
+  // A(sink) -> B(sink)
+  // C(sink) -(cluster)-> D
+
+  A.link_to(&B);
+  C.link_to(&D);
+
+  nodeManager.register_node(&A);
+  nodeManager.register_node(&B);
+  nodeManager.register_node(&C);
+  nodeManager.register_node(&D);
+
+  nodeManager.build();
+
+  assert(A.get_cluster_id() == B.get_cluster_id() &&
+         "繋がっているSink系列は同じクラスタに属する");
+  assert(A.get_cluster_id() != C.get_cluster_id() &&
+         "独立したSink系列は別々のクラスタに割り当てられる");
+  assert((A.get_cluster_id() == 0 or C.get_cluster_id() == 0) &&
+         "Sink系列のクラスタの一つはUNMANAGED_CLUSTER_IDを使う");
+  assert(D.get_cluster_id() != 0 &&
+         "Sink系列以外はUNMANAGED_CLUSTER_IDを使わない");
+
+  const auto ranks = nodeManager.get_cluster_ranks();
+  assert(ranks[C.get_cluster_id()] < ranks[D.get_cluster_id()] &&
+         "Sink系列のクラスタも後続よりランクの値が小さい");
+}
+
 int main() {
   build_test1();
   build_test2();
@@ -264,4 +368,7 @@ int main() {
   build_test8();
   build_test9();
   build_test10();
+  build_test11();
+  build_test12();
+  build_test13();
 }
@@ -0,0 +1,532 @@
+#include "prf/cluster.hpp"
+#include "prf/incremental_planner.hpp"
+#include "prf/node.hpp"
+#include "prf/prf.hpp"
+#include "prf/stream.hpp"
+#include "prf/transaction.hpp"
+#include "test_utils.hpp"
+#include <atomic>
+#include <cassert>
+#include <deque>
+#include <future>
+#include <set>
+#include <utility>
+#include <variant>
+#include <vector>
+
+/**
+ * Plannerが出した更新の依頼を(トランザクション, クラスタ)の組にする
+ */
+std::set<std::pair<prf::ID, prf::ID>>
+started(const std::vector<prf::ExecutorMessage> &msgs) {
+  std::set<std::pair<prf::ID, prf::ID>> res;
+  for (const auto &msg : msgs) {
+    if (std::holds_alternative<prf::StartUpdateClusterMessage>(msg)) {
+      const auto &start = std::get<prf::StartUpdateClusterMessage>(msg);
+      res.insert({start.transaction_id, start.cluster_id});
+    }
+  }
+  return res;
+}
+
+std::set<prf::ID> finalized(const std::vector<prf::ExecutorMessage> &msgs) {
+  std::set<prf::ID> res;
+  for (const auto &msg : msgs) {
+    if (std::holds_alternative<prf::FinalizeTransactionMessage>(msg)) {
+      res.insert(std::get<prf::FinalizeTransactionMessage>(msg).transaction_id);
+    }
+  }
+  return res;
+}
+
+prf::UpdateTransactionMessage update(prf::ID transaction_id,
+                                     std::vector<prf::ID> now,
+                                     std::vector<prf::ID> future,
+                                     std::vector<prf::ID> finish) {
+  prf::UpdateTransactionMessage msg;
+  msg.transaction_id = transaction_id;
+  msg.now = now;
+  msg.future = future;
+  msg.finish = finish;
+  return msg;
+}
+
+void test_1() {
+  // クラスタ1の後にクラスタ2と3が並列に更新される
+  prf::IncrementalRankPlanner planner(
+      {prf::Rank(3), prf::Rank(1), prf::Rank(2), prf::Rank(2)});
+  std::vector<prf::ExecutorMessage> out;
+
+  planner.handleStartMessage({1});
+  planner.handleUpdateMessage(update(1, {}, {1}, {}));
+  planner.plan(out);
+  assert(started(out) == (std::set<std::pair<prf::ID, prf::ID>>{{1, 1}}) &&
+         "一番低いランクのクラスタから更新が依頼される");
+
+  out.clear();
+  planner.handleStartMessage({2});
+  planner.plan(out);
+  assert(out.empty() && "初期化されていないトランザクションには割り当てない");
+
+  planner.handleUpdateMessage(update(2, {}, {1}, {}));
+  planner.plan(out);
+  assert(out.empty() && "先のトランザクションが保持するクラスタは割り当てない");
+
+  planner.handleUpdateMessage(update(1, {1}, {}, {}));
+  planner.handleUpdateMessage(update(1, {}, {2, 3}, {1}));
+  planner.plan(out);
+  assert(started(out) == (std::set<std::pair<prf::ID, prf::ID>>{
+                             {2, 1}, {1, 2}, {1, 3}}) &&
+         "空いたクラスタと後続のクラスタが並列に依頼される");
+
+  out.clear();
+  planner.plan(out);
+  assert(out.empty() && "一度依頼したものは再度依頼しない");
+
+  planner.handleUpdateMessage(update(1, {2, 3}, {}, {}));
+  planner.handleUpdateMessage(update(1, {}, {}, {2, 3}));
+  planner.plan(out);
+  assert(started(out).empty() && finalized(out) == std::set<prf::ID>{1} &&
+         "全て更新し終えた先頭のトランザクションは終了が依頼される");
+
+  out.clear();
+  planner.handleFinishMessage({1});
+  planner.handleUpdateMessage(update(2, {1}, {}, {}));
+  planner.handleUpdateMessage(update(2, {}, {2}, {1}));
+  planner.plan(out);
+  assert(started(out) == (std::set<std::pair<prf::ID, prf::ID>>{{2, 2}}) &&
+         "先のトランザクションが終了した後は後のトランザクションが進む");
+}
+
+void test_2() {
+  std::atomic_int n(0);
+
+  prf::StreamSink<int> s;
+  int sum = 0;
+
+  for (int i = 1; i <= 3; ++i) {
+    prf::Cluster cluster;
+    s.map([&n, i](int x) -> int {
+       if (x == i) {
+         n.fetch_add(1);
+         while (n.load() != 3) {
+         }
+       }
+       return x;
+     }).listen([&sum](int x) -> void { sum += x; });
+  }
+
+  prf::use_parallel_execution = true;
+  prf::parallel_planner = prf::ParallelPlanner::IncrementalRank;
+  prf::build();
+
+  std::vector<prf::JoinHandler> handlers;
+  for (int i = 1; i <= 3; ++i) {
+    prf::Transaction trans;
+    s.send(i);
+    handlers.push_back(trans.get_join_handler());
+  }
+
+  for (auto &handler : handlers) {
+    handler.join();
+  }
+
+  assert(sum == 18 && "IncrementalRankPlannerで並列に更新されている");
+}
+
+void test_3() {
+  std::atomic_int n(0);
+
+  prf::StreamSink<int> s;
+  int sum = 0;
+
+  for (int i = 1; i <= 3; ++i) {
+    prf::Cluster cluster;
+    s.map([&n, i](int x) -> int {
+       if (x == i) {
+         n.fetch_add(1);
+         while (n.load() != 3) {
+         }
+       }
+       return x;
+     }).listen([&sum](int x) -> void { sum += x; });
+  }
+
+  prf::use_parallel_execution = true;
+  prf::use_unified_scheduler = true;
+  prf::build();
+
+  std::vector<prf::JoinHandler> handlers;
+  for (int i = 1; i <= 3; ++i) {
+    prf::Transaction trans;
+    s.send(i);
+    handlers.push_back(trans.get_join_handler());
+  }
+
+  for (auto &handler : handlers) {
+    handler.join();
+  }
+
+  assert(sum == 18 && "ExecutorがPlannerを兼ねても並列に更新されている");
+}
+
+void test_4() {
+  prf::StreamSink<int> s;
+  prf::Stream<int> s1, s2;
+  {
+    prf::Cluster cluster;
+    s1 = s.map([](int x) -> int { return x + 1; });
+  }
+  {
+    prf::Cluster cluster;
+    s2 = s1.map([](int x) -> int { return x * 2; });
+  }
+
+  std::vector<int> results;
+  s2.listen([&results](int x) -> void { results.push_back(x); });
+
+  prf::use_parallel_execution = true;
+  prf::use_unified_scheduler = true;
+  prf::build();
+
+  for (int i = 0; i < 100; ++i) {
+    s.send(i);
+  }
+
+  assert(results.size() == 100 && "全てのトランザクションが終了している");
+  for (int i = 0; i < 100; ++i) {
+    assert(results[i] == (i + 1) * 2 &&
+           "後続のクラスタが順番を保って更新されている");
+  }
+}
+
+/**
+ * Plannerが出した更新の依頼をキューから取り出す
+ */
+std::vector<prf::ExecutorMessage>
+drain(prf::MpscRingQueue<prf::ExecutorMessage> &queue) {
+  std::vector<prf::ExecutorMessage> res;
+  while (auto msg = queue.try_pop()) {
+    res.push_back(std::move(*msg));
+  }
+  return res;
+}
+
+void test_5() {
+  // 1 -> 2 と 3 -> 4 の独立な二つの枝
+  std::vector<prf::Rank> ranks(
+      {prf::Rank(0), prf::Rank(1), prf::Rank(2), prf::Rank(1), prf::Rank(2)});
+  std::vector<prf::Bitset> descendants(5, prf::Bitset(5));
+  descendants[1].set(2);
+  descendants[3].set(4);
+
+  std::deque<prf::TransactionState> states;
+  states.push_back(prf::TransactionState(1, 5, 3));
+  states.back().initialized = true;
+  states.back().now.set(1);
+  states.push_back(prf::TransactionState(2, 5, 3));
+  states.back().initialized = true;
+  states.back().future.set(4);
+
+  prf::MpscRingQueue<prf::ExecutorMessage> queue;
+  std::atomic_bool stop(false);
+
+  prf::rank_based_planner(ranks, states, queue, stop);
+  assert(started(drain(queue)).empty() &&
+         "ランクでは先のトランザクションより高いランクのクラスタは割り当てられない");
+
+  prf::Planner planner = prf::make_reachability_planner(descendants);
+  planner(ranks, states, queue, stop);
+  assert(started(drain(queue)) ==
+             (std::set<std::pair<prf::ID, prf::ID>>{{2, 4}}) &&
+         "先のトランザクションから到達できないクラスタは割り当てられる");
+
+  states.back().future.set(2);
+  planner(ranks, states, queue, stop);
+  assert(started(drain(queue)) ==
+             (std::set<std::pair<prf::ID, prf::ID>>{{2, 4}}) &&
+         "先のトランザクションから到達できるクラスタは割り当てられない");
+
+  states.front().now.clear();
+  states.front().future.set(3);
+  planner(ranks, states, queue, stop);
+  assert(started(drain(queue)) ==
+             (std::set<std::pair<prf::ID, prf::ID>>{{1, 3}, {2, 2}}) &&
+         "自分の保持するクラスタから到達できるクラスタは後回しにされる");
+}
+
+void test_6() {
+  std::atomic_int n(0);
+
+  prf::StreamSink<int> s;
+  int sum = 0;
+
+  for (int i = 1; i <= 3; ++i) {
+    prf::Cluster cluster;
+    s.map([&n, i](int x) -> int {
+       if (x == i) {
+         n.fetch_add(1);
+         while (n.load() != 3) {
+         }
+       }
+       return x;
+     }).listen([&sum](int x) -> void { sum += x; });
+  }
+
+  prf::use_parallel_execution = true;
+  prf::parallel_planner = prf::ParallelPlanner::Reachability;
+  prf::build();
+
+  std::vector<prf::JoinHandler> handlers;
+  for (int i = 1; i <= 3; ++i) {
+    prf::Transaction trans;
+    s.send(i);
+    handlers.push_back(trans.get_join_handler());
+  }
+
+  for (auto &handler : handlers) {
+    handler.join();
+  }
+
+  assert(sum == 18 && "到達可能性を元にしたPlannerで並列に更新されている");
+}
+
+void test_7() {
+  // 1 -> 2 -> 3 の鎖と、単独の4
+  std::vector<prf::Rank> ranks({prf::Rank(0), prf::Rank(1), prf::Rank(2),
+                                prf::Rank(3), prf::Rank(1)});
+  std::vector<std::vector<prf::ID>> successors({{}, {2}, {3}, {}, {}});
+  std::vector<prf::ID> order({3, 4, 2, 1, 0});
+
+  std::vector<double> lengths =
+      prf::critical_path_lengths(successors, order, {1, 1, 1, 1, 1});
+  assert(lengths == (std::vector<double>{1, 3, 2, 1, 1}) &&
+         "葉までの最長経路の長さが求められている");
+
+  std::deque<prf::TransactionState> states;
+  states.push_back(prf::TransactionState(1, 5, 4));
+  states.back().initialized = true;
+  states.back().future.set(1);
+  states.back().future.set(4);
+
+  prf::MpscRingQueue<prf::ExecutorMessage> queue;
+  std::atomic_bool stop(false);
+
+  auto issued = [&queue]() -> std::vector<prf::ID> {
+    std::vector<prf::ID> res;
+    for (auto &msg : drain(queue)) {
+      res.push_back(std::get<prf::StartUpdateClusterMessage>(msg).cluster_id);
+    }
+    return res;
+  };
+
+  prf::Planner planner = prf::make_critical_path_planner(successors, order, {});
+  planner(ranks, states, queue, stop);
+  assert(issued() == (std::vector<prf::ID>{1, 4}) &&
+         "見積もりが無ければ長い鎖の先頭から依頼する");
+
+  planner = prf::make_critical_path_planner(
+      successors, order, {{0, 1}, {1, 1}, {2, 1}, {3, 1}, {4, 1000}});
+  planner(ranks, states, queue, stop);
+  assert(issued() == (std::vector<prf::ID>{4, 1}) &&
+         "重いクラスタは鎖より先に依頼する");
+}
+
+void test_8() {
+  // 菱形の依存関係でも順番を保って更新される
+  prf::StreamSink<int> s;
+  prf::Stream<int> left, right, merged;
+  {
+    prf::Cluster cluster("left", 10);
+    left = s.map([](int x) -> int { return x + 1; });
+  }
+  {
+    prf::Cluster cluster("right", 1000);
+    right = s.map([](int x) -> int { return x * 2; });
+  }
+  {
+    prf::Cluster cluster;
+    merged = left.merge(right, [](int l, int r) -> int { return l + r; });
+  }
+
+  std::vector<int> results;
+  merged.listen([&results](int x) -> void { results.push_back(x); });
+
+  prf::use_parallel_execution = true;
+  prf::parallel_planner = prf::ParallelPlanner::CriticalPath;
+  prf::build();
+
+  std::vector<prf::JoinHandler> handlers;
+  for (int i = 0; i < 100; ++i) {
+    prf::Transaction trans;
+    s.send(i);
+    handlers.push_back(trans.get_join_handler());
+  }
+  for (auto &handler : handlers) {
+    handler.join();
+  }
+
+  assert(results.size() == 100 && "全てのトランザクションが終了している");
+  for (int i = 0; i < 100; ++i) {
+    assert(results[i] == (i + 1) + i * 2 &&
+           "最長経路を元にしたPlannerでも順番を保って更新されている");
+  }
+}
+
+void test_9() {
+  // 無関係な部分グラフ同士は互いの終了を待たない
+  prf::StreamSink<int> a, b;
+  std::atomic_bool released(false);
+  std::atomic_int slow(0);
+  {
+    prf::Cluster cluster;
+    a.map([&released](int x) -> int {
+       while (not released.load()) {
+       }
+       return x;
+     }).listen([&slow](int x) -> void { slow.store(x); });
+  }
+  int fast = 0;
+  {
+    prf::Cluster cluster;
+    b.map([](int x) -> int { return x * 2; }).listen([&fast](int x) -> void {
+      fast = x;
+    });
+  }
+
+  prf::use_parallel_execution = true;
+  prf::use_ordering_domains = true;
+  prf::build();
+
+  std::future<void> future = a.send_async(1);
+  b.send(2);
+  assert(fast == 4 && "先のトランザクションが終わっていなくても終了できる");
+  assert(slow.load() == 0 && "先のトランザクションはまだ終わっていない");
+
+  released.store(true);
+  future.wait();
+  assert(slow.load() == 1 && "止まっていたトランザクションも終了する");
+}
+
+void test_10() {
+  // 複数の部分グラフを触るトランザクションがあっても、それぞれの中の順番は保たれる
+  prf::StreamSink<int> a, b;
+  std::vector<int> left, right;
+  {
+    prf::Cluster cluster;
+    a.map([](int x) -> int { return x + 1; }).listen([&left](int x) -> void {
+      left.push_back(x);
+    });
+  }
+  {
+    prf::Cluster cluster;
+    b.map([](int x) -> int { return x * 2; }).listen([&right](int x) -> void {
+      right.push_back(x);
+    });
+  }
+
+  prf::use_parallel_execution = true;
+  prf::use_ordering_domains = true;
+  prf::build();
+
+  std::vector<prf::JoinHandler> handlers;
+  for (int i = 0; i < 100; ++i) {
+    prf::Transaction trans;
+    if (i % 3 != 1) {
+      a.send(i);
+    }
+    if (i % 3 != 0) {
+      b.send(i);
+    }
+    handlers.push_back(trans.get_join_handler());
+  }
+  for (auto &handler : handlers) {
+    handler.join();
+  }
+
+  std::vector<int> expected_left, expected_right;
+  for (int i = 0; i < 100; ++i) {
+    if (i % 3 != 1) {
+      expected_left.push_back(i + 1);
+    }
+    if (i % 3 != 0) {
+      expected_right.push_back(i * 2);
+    }
+  }
+  assert(left == expected_left && "部分グラフ毎に順番を保って更新されている");
+  assert(right == expected_right && "部分グラフ毎に順番を保って更新されている");
+}
+
+void test_11() {
+  // build()で求めたクラスタの並びを使っても、長い鎖の先頭から依頼する
+  prf::StreamSink<int> s;
+  prf::Stream<int> chain = s;
+  for (int i = 0; i < 3; ++i) {
+    prf::Cluster cluster;
+    chain = chain.map([](int x) -> int { return x + 1; });
+  }
+  {
+    prf::Cluster cluster;
+    s.map([](int x) -> int { return x; });
+  }
+
+  prf::build();
+
+  prf::NodeManager &node_manager = *prf::NodeManager::globalNodeManager;
+  const std::vector<std::vector<prf::ID>> &successors =
+      node_manager.get_cluster_successors();
+  const std::vector<prf::ID> &order = node_manager.get_cluster_order();
+  const std::vector<prf::Rank> &ranks = node_manager.get_cluster_ranks();
+  assert(order.size() == successors.size() &&
+         "全てのクラスタが並びに含まれている");
+
+  // Sinkのクラスタの後続は、鎖の先頭と単独のクラスタ
+  prf::ID sink = prf::ClusterManager::UNMANAGED_CLUSTER_ID;
+  assert(successors[sink].size() == 2 && "Sinkの後続は二つある");
+  prf::ID head = successors[sink][0], single = successors[sink][1];
+  if (successors[head].empty()) {
+    std::swap(head, single);
+  }
+
+  std::vector<double> lengths = prf::critical_path_lengths(
+      successors, order, std::vector<double>(successors.size(), 1));
+  assert(lengths[head] == 3 && lengths[single] == 1 &&
+         "葉までの最長経路の長さが求められている");
+
+  size_t rank_count = 0;
+  for (const prf::Rank &rank : ranks) {
+    rank_count = std::max(rank_count, (size_t)rank.value + 1);
+  }
+  std::deque<prf::TransactionState> states;
+  states.push_back(prf::TransactionState(1, successors.size(), rank_count));
+  states.back().initialized = true;
+  states.back().future.set(head);
+  states.back().future.set(single);
+
+  prf::MpscRingQueue<prf::ExecutorMessage> queue;
+  std::atomic_bool stop(false);
+  prf::Planner planner =
+      prf::make_critical_path_planner(successors, order, {});
+  planner(ranks, states, queue, stop);
+
+  std::vector<prf::ID> issued;
+  for (auto &msg : drain(queue)) {
+    issued.push_back(std::get<prf::StartUpdateClusterMessage>(msg).cluster_id);
+  }
+  assert(issued == (std::vector<prf::ID>{head, single}) &&
+         "長い鎖の先頭から依頼する");
+}
+
+int main() {
+  test_1();
+  run_test(test_2);
+  run_test(test_3);
+  run_test(test_4);
+  test_5();
+  run_test(test_6);
+  run_test(test_7);
+  run_test(test_8);
+  run_test(test_9);
+  run_test(test_10);
+  run_test(test_11);
+}
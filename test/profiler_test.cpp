@@ -0,0 +1,68 @@
+#include "prf/cluster.hpp"
+#include "prf/prf.hpp"
+#include "prf/profiler.hpp"
+#include "prf/stream.hpp"
+#include "test_utils.hpp"
+#include <cassert>
+#include <chrono>
+#include <thread>
+
+void test_1() {
+  prf::ClusterProfiler profiler(
+      5, {{1, "light"}, {2, "heavy"}, {3, "NO_NAME"}, {4, "NO_NAME"}});
+
+  for (prf::u64 i = 1; i <= 100; ++i) {
+    profiler.record(1, 10, 10);
+    profiler.record(2, i * 100, i * 50);
+  }
+
+  prf::ClusterProfile light = profiler.profile(1);
+  assert(light.count == 100 && "記録した回数が数えられている");
+  assert(light.ewma_wall_ns == 10 && light.ewma_cpu_ns == 10 &&
+         "同じ値だけを記録すれば平均もその値になる");
+
+  prf::ClusterProfile heavy = *profiler.profile("heavy");
+  assert(heavy.max_wall_ns == 10000 && "最大値が記録されている");
+  assert(heavy.p50_wall_ns == 5000 && heavy.p90_wall_ns == 9000 &&
+         heavy.p99_wall_ns == 9900 && "百分位が正しく求められている");
+  assert(heavy.ewma_wall_ns > heavy.p50_wall_ns &&
+         "指数移動平均は新しい計測を重く見る");
+
+  assert(not profiler.profile("unknown").has_value() &&
+         "登録されていない名前の統計は無い");
+  assert(profiler.profiles().size() == 2 &&
+         "名前の付いたクラスタの統計だけが全て返る");
+}
+
+void test_2() {
+  prf::StreamSink<int> s;
+  {
+    prf::Cluster cluster("sleep");
+    s.map([](int x) -> int {
+       std::this_thread::sleep_for(std::chrono::milliseconds(2));
+       return x;
+     }).listen([](int) -> void {});
+  }
+
+  assert(not prf::get_cluster_profile("sleep").has_value() &&
+         "build前には統計が無い");
+
+  prf::use_parallel_execution = true;
+  prf::build();
+
+  for (int i = 0; i < 5; ++i) {
+    s.send(i);
+  }
+
+  auto profile = prf::get_cluster_profile("sleep");
+  assert(profile.has_value() && "名前からクラスタの統計を引ける");
+  assert(profile->count == 5 && "全ての更新が計測されている");
+  assert(profile->ewma_wall_ns >= 2000000 && "経過時間が計測されている");
+  assert(profile->ewma_cpu_ns < profile->ewma_wall_ns &&
+         "眠っている間はCPU時間に含まれない");
+}
+
+int main() {
+  test_1();
+  run_test(test_2);
+}
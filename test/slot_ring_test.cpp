@@ -0,0 +1,71 @@
+#include "prf/slot_ring.hpp"
+#include <cassert>
+#include <memory>
+
+void test_1() {
+  prf::SlotRing<int> ring;
+  assert(not ring.get(0).has_value() && "書き込む前は値が無い");
+
+  ring.set(0, prf::InlineValue<int>(1));
+  ring.set(1, prf::InlineValue<int>(2));
+  assert(**ring.get(0) == 1 && "書き込んだ値を読める");
+  assert(**ring.get(1) == 2 && "書き込んだ値を読める");
+
+  ring.set(1, prf::InlineValue<int>(3));
+  assert(**ring.get(1) == 3 && "同じトランザクションでは上書きされる");
+
+  ring.erase(0);
+  assert(not ring.get(0).has_value() && "破棄した値は読めない");
+  assert(not ring.get(prf::SlotRing<int>::CAPACITY).has_value() &&
+         "同じ枠を使う別のトランザクションの値としては読めない");
+}
+
+void test_2() {
+  // 枠の数を超えて同時に値を持つと、溢れた分はmapに置かれる
+  prf::SlotRing<int> ring;
+  const prf::u64 n = prf::SlotRing<int>::CAPACITY * 3;
+  for (prf::u64 i = 0; i < n; ++i) {
+    ring.set(i, prf::InlineValue<int>(i));
+  }
+  for (prf::u64 i = 0; i < n; ++i) {
+    assert(**ring.get(i) == (int)i && "枠から溢れた値も読める");
+  }
+
+  for (prf::u64 i = 0; i < n; i += 2) {
+    ring.erase(i);
+  }
+  for (prf::u64 i = 0; i < n; ++i) {
+    assert(ring.get(i).has_value() == (i % 2 == 1) &&
+           "破棄した値だけが読めなくなる");
+  }
+
+  // 空いた枠は次のトランザクションが使える
+  ring.set(n, prf::InlineValue<int>(-1));
+  assert(**ring.get(n) == -1 && "空いた枠に書き込める");
+}
+
+void test_3() {
+  // 枠が塞がっていてmapに置いた値を、枠が空いた後に上書きしても値が残らない
+  prf::SlotRing<int> ring;
+  const prf::u64 capacity = prf::SlotRing<int>::CAPACITY;
+  ring.set(0, prf::InlineValue<int>(1));
+  ring.set(capacity, prf::InlineValue<int>(2));
+  ring.erase(0);
+  ring.set(capacity, prf::InlineValue<int>(3));
+  assert(**ring.get(capacity) == 3 && "上書きした値が読める");
+
+  ring.erase(capacity);
+  assert(not ring.get(capacity).has_value() && "破棄した値は読めない");
+
+  // mapが空になっていれば、同じ枠を使う次のトランザクションが枠に置ける
+  ring.set(capacity * 2, prf::InlineValue<int>(4));
+  ring.erase(capacity * 2);
+  assert(not ring.get(capacity * 2).has_value() &&
+         "枠に置いた値を破棄すると読めなくなる");
+}
+
+int main() {
+  test_1();
+  test_2();
+  test_3();
+}
@@ -5,6 +5,7 @@
 #include "prf/transaction.hpp"
 #include "test_utils.hpp"
 #include <cassert>
+#include <memory>
 #include <string>
 
 void test_1() {
@@ -291,6 +292,62 @@ void test_10() {
   assert(sum == 2 && "map_toとor_elseが正しく動作している");
 }
 
+/**
+ * コピーされた回数を数える値
+ */
+class Counted {
+public:
+  int value;
+  int *copies;
+
+  Counted(int value, int *copies) : value(value), copies(copies) {}
+  Counted(const Counted &other) : value(other.value), copies(other.copies) {
+    ++*copies;
+  }
+  Counted(Counted &&other) = default;
+  Counted &operator=(const Counted &other) = default;
+  Counted &operator=(Counted &&other) = default;
+};
+
+void test_11() {
+  // ムーブしかできない値もStreamに流せる
+  prf::StreamSink<std::unique_ptr<int>> s1;
+  prf::Stream<std::unique_ptr<int>> s2 =
+      s1.filter([](const std::unique_ptr<int> &x) -> bool { return *x > 0; });
+  prf::Stream<int> s3 =
+      s2.map([](const std::unique_ptr<int> &x) -> int { return *x * 2; });
+
+  int sum = 0;
+  s3.listen([&sum](int x) -> void { sum += x; });
+
+  prf::build();
+
+  s1.send(std::make_unique<int>(1));
+  assert(sum == 2 && "ムーブしかできない値が届いている");
+  s1.send(std::make_unique<int>(-1));
+  assert(sum == 2 && "filterで落とした値は届かない");
+  s1.send(std::make_unique<int>(3));
+  assert(sum == 8 && "ムーブしかできない値が届いている");
+}
+
+void test_12() {
+  // sinkから下流まで値がコピーされない
+  int copies = 0;
+  prf::StreamSink<Counted> s1;
+  prf::Stream<Counted> s2 =
+      s1.filter([](const Counted &x) -> bool { return x.value > 0; });
+
+  int sum = 0;
+  s2.listen([&sum](const Counted &x) -> void { sum += x.value; });
+
+  prf::build();
+
+  s1.send(Counted(1, &copies));
+  s1.send(Counted(2, &copies));
+  assert(sum == 3 && "値が届いている");
+  assert(copies == 0 && "値がコピーされていない");
+}
+
 int main() {
   run_test(test_1);
   run_test(test_2);
@@ -302,4 +359,6 @@ int main() {
   run_test(test_8);
   run_test(test_9);
   run_test(test_10);
+  run_test(test_11);
+  run_test(test_12);
 }
@@ -8,4 +8,10 @@
     func();                                                                    \
     prf::stop_execution();                                                     \
     prf::use_parallel_execution = false;                                       \
+    prf::parallel_planner = prf::ParallelPlanner::RankBased;                   \
+    prf::use_unified_scheduler = false;                                        \
+    prf::use_dataflow_scheduler = false;                                       \
+    prf::max_inflight_transactions = 0;                                        \
+    prf::use_pipelined_listeners = false;                                      \
+    prf::use_ordering_domains = false;                                         \
   } while (false)
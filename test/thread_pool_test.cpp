@@ -0,0 +1,47 @@
+#include "prf/thread_pool.hpp"
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <vector>
+
+void test_1() {
+  prf::ThreadPool pool(4);
+
+  std::atomic_int sum(0);
+  std::vector<std::shared_ptr<prf::utils::Waiter>> waiters;
+  for (int i = 1; i <= 100; ++i) {
+    waiters.push_back(pool.request([&sum, i]() { sum.fetch_add(i); }));
+  }
+  for (auto &waiter : waiters) {
+    waiter->wait();
+  }
+
+  assert(sum.load() == 5050 && "依頼した仕事が全て実行される");
+}
+
+void test_2() {
+  prf::ThreadPool pool(4);
+
+  std::atomic_int count(0);
+  prf::utils::Waiter finished;
+
+  // ワーカーから依頼した仕事も他のワーカーに奪われながら全て実行される
+  const int CHILDREN = 1000;
+  pool.request([&]() {
+    for (int i = 0; i < CHILDREN; ++i) {
+      pool.request([&]() {
+        if (count.fetch_add(1) + 1 == CHILDREN) {
+          finished.done();
+        }
+      });
+    }
+  });
+  finished.wait();
+
+  assert(count.load() == CHILDREN && "ワーカーから依頼した仕事が実行される");
+}
+
+int main() {
+  test_1();
+  test_2();
+}
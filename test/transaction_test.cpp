@@ -6,11 +6,36 @@
 #include <atomic>
 #include <cassert>
 #include <chrono>
+#include <cstdlib>
+#include <future>
 #include <mutex>
+#include <new>
 #include <string>
 #include <thread>
 #include <vector>
 
+// 解放し忘れを調べるため、生存している確保の数を数える
+std::atomic_long live_allocations(0);
+
+void *operator new(std::size_t size) {
+  void *ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  live_allocations.fetch_add(1);
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+  if (ptr == nullptr) {
+    return;
+  }
+  live_allocations.fetch_sub(1);
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept { operator delete(ptr); }
+
 void test_1() {
   std::string sum = "";
   prf::StreamSink<int> s;
@@ -166,9 +191,177 @@ void test_4() {
   auto s4 = s3.map([](int n) -> int { return n + 2; });
 }
 
+void test_5() {
+  std::atomic_bool release(false);
+
+  prf::StreamSink<int> s;
+  int sum = 0;
+  {
+    prf::Cluster cluster;
+    s.map([&release](int x) -> int {
+       while (not release.load()) {
+       }
+       return x;
+     }).listen([&sum](int x) -> void { sum += x; });
+  }
+
+  prf::use_parallel_execution = true;
+  prf::max_inflight_transactions = 2;
+  prf::build();
+
+  std::vector<prf::JoinHandler> handlers;
+  for (int i = 1; i <= 2; ++i) {
+    prf::Transaction trans;
+    s.send(i);
+    handlers.push_back(trans.get_join_handler());
+  }
+
+  assert(prf::transaction_window.size() == 2 &&
+         "終了していないトランザクションが枠を占有している");
+  assert(not s.try_send(3) && "枠が空いていなければtry_sendは失敗する");
+  {
+    prf::Transaction trans(std::try_to_lock);
+    assert(not trans.is_open() && "枠が空いていなければ開始しない");
+  }
+
+  // 枠が空くまでブロッキングされる
+  std::atomic_bool sent(false);
+  std::thread producer([&s, &sent]() -> void {
+    s.send(4);
+    sent.store(true);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  assert(not sent.load() && "枠が空くまで送信が待たされている");
+
+  release.store(true);
+  for (auto &handler : handlers) {
+    handler.join();
+  }
+  producer.join();
+
+  assert(s.try_send(5) && "枠が空いていればtry_sendは成功する");
+  assert(sum == 12 && "待たされた送信も含めて更新されている");
+  assert(prf::transaction_window.size() == 0 && "全ての枠が返されている");
+}
+
+void test_6() {
+  prf::StreamSink<int> s;
+  std::atomic_int sum(0);
+  {
+    prf::Cluster cluster;
+    s.map([](int x) -> int { return x * 2; }).listen([&sum](int x) -> void {
+      sum.fetch_add(x);
+    });
+  }
+
+  prf::use_parallel_execution = true;
+  prf::build();
+
+  std::atomic_int completed(0);
+  std::atomic_bool on_caller(false);
+  std::thread::id caller = std::this_thread::get_id();
+
+  std::vector<std::future<void>> futures;
+  for (int i = 1; i <= 10; ++i) {
+    futures.push_back(s.send_async(i, [&completed, &on_caller, caller]() {
+      completed.fetch_add(1);
+      if (std::this_thread::get_id() == caller) {
+        on_caller.store(true);
+      }
+    }));
+  }
+  {
+    prf::Transaction trans;
+    s.send(100);
+    futures.push_back(trans.commit_async());
+  }
+
+  for (auto &future : futures) {
+    future.wait();
+  }
+
+  assert(completed.load() == 10 && "全ての完了時のコールバックが呼ばれている");
+  assert(not on_caller.load() &&
+         "完了時のコールバックは呼び出したスレッドでは実行されない");
+  assert(sum.load() == 310 && "非同期に終了したトランザクションも更新されている");
+}
+
+void test_7() {
+  // 管理用の領域に収まらない数の時変値を一つのトランザクションで更新する
+  prf::StreamSink<int> s;
+  std::atomic_int sum(0);
+  for (int i = 0; i < 10; ++i) {
+    prf::Cluster cluster;
+    for (int j = 0; j < 100; ++j) {
+      s.map([](int x) -> int { return x + 1; }).listen([&sum](int x) -> void {
+        sum.fetch_add(x);
+      });
+    }
+  }
+
+  prf::use_parallel_execution = true;
+  prf::build();
+
+  for (int i = 0; i < 10; ++i) {
+    s.send(i);
+  }
+
+  assert(sum.load() == 1000 * 55 && "全ての時変値が更新されている");
+}
+
+void test_8() {
+  prf::StreamSink<int> s;
+  std::atomic_int sum(0);
+  {
+    prf::Cluster cluster;
+    s.map([](int x) -> int { return x * 2; }).listen([&sum](int x) -> void {
+      sum.fetch_add(x);
+    });
+  }
+
+  prf::use_parallel_execution = true;
+  prf::build();
+
+  auto run = [&s](int n) -> void {
+    std::vector<std::future<void>> futures;
+    for (int i = 0; i < n; ++i) {
+      futures.push_back(s.send_async(1));
+      prf::Transaction trans;
+      s.send(1);
+      futures.push_back(trans.commit_async());
+    }
+    for (int i = 0; i < n; ++i) {
+      prf::Transaction trans;
+      s.send(1);
+      trans.get_join_handler().join();
+    }
+    for (auto &future : futures) {
+      future.wait();
+    }
+  };
+
+  // 使い回される領域を先に確保しておく
+  run(200);
+  long before = live_allocations.load();
+  for (int i = 0; i < 10; ++i) {
+    run(200);
+  }
+  // 完了を通知した後のメッセージの破棄を待つ
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  long after = live_allocations.load();
+
+  assert(sum.load() == 2 * 3 * 2200 && "全てのトランザクションが更新されている");
+  assert(after - before < 1000 &&
+         "終了を待たないトランザクションも終了処理の後に破棄されている");
+}
+
 int main() {
   run_test(test_1);
   run_test(test_2);
   run_test(test_3);
   run_test(test_4);
+  run_test(test_5);
+  run_test(test_6);
+  run_test(test_7);
+  run_test(test_8);
 }
@@ -0,0 +1,92 @@
+#include "prf/slot_ring.hpp"
+#include "prf/value_pool.hpp"
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// 値を確保していないことを調べるため、確保の回数を数える
+std::atomic_long allocations(0);
+
+void *operator new(std::size_t size) {
+  void *ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  allocations.fetch_add(1);
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+void test_1() {
+  prf::ValuePool pool;
+  std::shared_ptr<int> a = prf::make_pooled<int>(pool, 1);
+  assert(*a == 1 && "確保した値を読める");
+
+  int *address = a.get();
+  a.reset();
+  std::shared_ptr<int> b = prf::make_pooled<int>(pool, 2);
+  assert(b.get() == address && "返却したブロックが使い回される");
+  assert(*b == 2 && "使い回したブロックにも値が正しく置かれる");
+}
+
+void test_2() {
+  // 別のスレッドで返却されたブロックも使い回せる
+  prf::ValuePool pool;
+  std::vector<std::shared_ptr<std::vector<int>>> values;
+  for (int i = 0; i < 100; ++i) {
+    values.push_back(prf::make_pooled<std::vector<int>>(pool, i, i));
+  }
+  std::thread releaser([&values]() -> void { values.clear(); });
+  releaser.join();
+
+  for (int i = 0; i < 100; ++i) {
+    std::shared_ptr<std::vector<int>> value =
+        prf::make_pooled<std::vector<int>>(pool, 3, i);
+    assert(value->size() == 3 && (*value)[2] == i &&
+           "使い回したブロックにも値が正しく置かれる");
+  }
+}
+
+struct Large {
+  char data[prf::INLINE_VALUE_MAX_SIZE + 1];
+};
+
+void test_3() {
+  static_assert(std::is_same_v<prf::ValueRef<int>, prf::InlineValue<int>>,
+                "小さくコピーの軽い型はそのまま持つ");
+  static_assert(std::is_same_v<prf::ValueRef<std::vector<int>>,
+                               std::shared_ptr<std::vector<int>>>,
+                "コピーの重い型は共有する");
+  static_assert(std::is_same_v<prf::ValueRef<Large>, std::shared_ptr<Large>>,
+                "キャッシュラインに収まらない型は共有する");
+
+  prf::ValuePool pool;
+  prf::SlotRing<int> ring;
+  long before = allocations.load();
+  for (prf::ID i = 0; i < prf::SlotRing<int>::CAPACITY; ++i) {
+    ring.set(i, prf::make_value<int>(pool, (int)i));
+  }
+  prf::ValueRef<int> value = *ring.get(3);
+  for (prf::ID i = 0; i < prf::SlotRing<int>::CAPACITY; ++i) {
+    ring.erase(i);
+  }
+  assert(allocations.load() == before && "そのまま持つ値は確保されない");
+  assert(*value == 3 && "値は複製されて渡される");
+
+  prf::InlineValue<int> empty = nullptr;
+  assert(not empty && "nullptrで空になる");
+}
+
+int main() {
+  test_1();
+  test_2();
+  test_3();
+}
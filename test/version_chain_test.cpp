@@ -0,0 +1,86 @@
+#include "prf/version_chain.hpp"
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <thread>
+#include <vector>
+
+void test_1() {
+  prf::VersionChain<int> chain;
+  {
+    prf::VersionChain<int>::ReadGuard guard(chain);
+    assert(chain.find(10) == nullptr && "書き込む前は版が無い");
+  }
+
+  chain.put(2, prf::InlineValue<int>(2));
+  chain.put(5, prf::InlineValue<int>(5));
+  // 古いトランザクションの版が後から来ても順番に並ぶ
+  chain.put(3, prf::InlineValue<int>(3));
+
+  {
+    prf::VersionChain<int>::ReadGuard guard(chain);
+    assert(chain.find(1) == nullptr && "最初の版より前には値が無い");
+    assert(*chain.find(2)->value == 2 && "その時刻の版を読める");
+    assert(*chain.find(4)->value == 3 && "それ以前で最新の版を読める");
+    assert(*chain.find(100)->value == 5 && "それ以前で最新の版を読める");
+  }
+
+  chain.put(5, prf::InlineValue<int>(6));
+  assert(chain.contains(5) && "同じ時刻の版は置き換えられる");
+  assert(not chain.contains(4) && "版の無い時刻は含まれない");
+
+  // 公開した後で値を置き換える版は、繋いだ時点で排他が必要と分かる
+  chain.put(7, prf::InlineValue<int>(7), true);
+  {
+    prf::VersionChain<int>::ReadGuard guard(chain);
+    assert(chain.find(7)->guarded.load() &&
+           "繋いだ時点で排他が必要な版になっている");
+    assert(not chain.find(5)->guarded.load() && "通常の版は排他が要らない");
+  }
+
+  chain.truncate(4);
+  {
+    prf::VersionChain<int>::ReadGuard guard(chain);
+    assert(*chain.find(4)->value == 3 && "指定した時刻で読む版は残る");
+    assert(chain.find(2) == nullptr && "それより古い版は外される");
+    assert(*chain.find(5)->value == 6 && "新しい版は残る");
+  }
+}
+
+void test_2() {
+  // 読み込みと並行して版を追加、破棄しても、読んだ版が壊れない
+  prf::VersionChain<int> chain;
+  chain.put(0, prf::InlineValue<int>(0));
+
+  const int n = 10000;
+  std::atomic<int> written(0);
+  std::atomic_bool stop(false);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 3; ++i) {
+    readers.emplace_back([&chain, &written, &stop, n]() -> void {
+      while (not stop.load()) {
+        int latest = written.load();
+        // 最新の版は外されないので、常に何かしらの版が読める
+        prf::VersionChain<int>::ReadGuard guard(chain);
+        prf::VersionChain<int>::Version *version = chain.find(n);
+        assert(version != nullptr && "最新の版が読める");
+        assert(*version->value >= latest && "読んだ版の値が正しい");
+      }
+    });
+  }
+
+  for (int i = 1; i <= n; ++i) {
+    chain.put(i, prf::InlineValue<int>(i));
+    written.store(i);
+    chain.truncate(i);
+  }
+  stop.store(true);
+  for (std::thread &reader : readers) {
+    reader.join();
+  }
+}
+
+int main() {
+  test_1();
+  test_2();
+}